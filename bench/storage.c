@@ -0,0 +1,158 @@
+// Benchmarks of the text storage engines (gap buffer and piece table)
+//
+// Usage: bench_storage [megabytes]
+//
+// A file of the given size is generated, then each engine
+// loads it, iterates over its lines, looks lines up, edits
+// it at random positions and saves it.
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/utils/gap_buffer.h"
+
+#define SAMPLE_FILE "bench_storage_sample.txt"
+#define OUTPUT_FILE "bench_storage_output.txt"
+
+#define NUM_LOOKUPS 100000
+#define NUM_MOVES   1000
+#define NUM_EDITS   100
+
+static double now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool generateSampleFile(size_t size)
+{
+    FILE *stream = fopen(SAMPLE_FILE, "wb");
+    if (stream == NULL)
+        return false;
+
+    static const char *words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "caf\xc3\xa9", "\xe2\x82\xac"};
+
+    size_t written = 0;
+    size_t column = 0;
+    while (written < size) {
+        const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        fwrite(word, 1, len, stream);
+        column += len;
+        if (column > 60 + (size_t) (rand() % 40)) {
+            fputc('\n', stream);
+            column = 0;
+        } else
+            fputc(' ', stream);
+        written += len + 1;
+    }
+    fclose(stream);
+    return true;
+}
+
+static void benchmark(const char *name, GapBuffer *(*create)(void))
+{
+    // Both engines look up and edit the same lines
+    srand(2);
+
+    double start;
+    GapBuffer *buff = create();
+    if (buff == NULL) {
+        fprintf(stderr, "%s: Couldn't create buffer\n", name);
+        return;
+    }
+
+    start = now();
+    if (!GapBuffer_insertFile(buff, SAMPLE_FILE)) {
+        fprintf(stderr, "%s: Couldn't load file\n", name);
+        GapBuffer_destroy(buff);
+        return;
+    }
+    double t_load = now() - start;
+
+    start = now();
+    size_t lines = GapBuffer_getLineCount(buff);
+    double t_count = now() - start;
+
+    start = now();
+    size_t bytes = 0;
+    size_t iterated = 0;
+    GapBufferIter iter;
+    GapBufferLine line;
+    GapBufferIter_init(&iter, buff);
+    while (GapBufferIter_next(&iter, &line)) {
+        bytes += line.len[0] + line.len[1];
+        iterated++;
+    }
+    GapBufferIter_free(&iter);
+    double t_iter = now() - start;
+
+    // Piece tables estimate the lines of the parts of the
+    // file they didn't count yet, so lookups pick from the
+    // lines that were iterated.
+    lines = iterated;
+
+    start = now();
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+        bytes += GapBuffer_getLineOffset(buff, rand() % lines);
+    double t_lookup = now() - start;
+
+    // Clicking around or selecting text
+    start = now();
+    for (int i = 0; i < NUM_MOVES; i++) {
+        size_t offset = GapBuffer_getLineOffset(buff, rand() % lines);
+        GapBuffer_moveAbsoluteRaw(buff, offset);
+        bytes += GapBuffer_getColumn(buff);
+    }
+    double t_move = now() - start;
+
+    start = now();
+    for (int i = 0; i < NUM_EDITS; i++) {
+        size_t offset = GapBuffer_getLineOffset(buff, rand() % lines);
+        GapBuffer_moveAbsoluteRaw(buff, offset);
+        GapBuffer_insertString(buff, "hello\n", 6);
+        GapBuffer_removeBackwards(buff, 3);
+    }
+    double t_edit = now() - start;
+
+    start = now();
+    GapBuffer_saveTo(buff, OUTPUT_FILE);
+    double t_save = now() - start;
+
+    GapBuffer_destroy(buff);
+
+    // The checksum is printed to make sure the
+    // engines agree and the loops aren't optimized out.
+    printf("%-12s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9zu\n", name, 
+           t_load * 1000, t_count * 1000, t_iter * 1000, t_lookup * 1000, 
+           t_move * 1000, t_edit * 1000, t_save * 1000, bytes % 1000000);
+}
+
+static GapBuffer *createGapBuffer(void)
+{
+    return GapBuffer_create(1 << 16);
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = 64;
+    if (argc > 1)
+        megabytes = atoi(argv[1]);
+
+    srand(1);
+    if (!generateSampleFile(megabytes << 20)) {
+        fprintf(stderr, "Couldn't generate the sample file\n");
+        return -1;
+    }
+
+    printf("%zu MB, times in milliseconds\n", megabytes);
+    printf("%-12s %9s %9s %9s %9s %9s %9s %9s %9s\n", "engine", "load", "lines", "iterate", "lookups", "moves", "edits", "save", "checksum");
+    benchmark("gap buffer",  createGapBuffer);
+    benchmark("piece table", GapBuffer_createPieceTable);
+
+    remove(SAMPLE_FILE);
+    remove(OUTPUT_FILE);
+    return 0;
+}
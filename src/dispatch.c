@@ -26,6 +26,16 @@ static void saveFileInWidget(Widget *widget)
     handleWidgetEvent(widget, event);
 }
 
+static void undoInWidget(Widget *widget, bool redo)
+{
+    Event event;
+    event.type = redo ? EVENT_REDO : EVENT_UNDO;
+    event.mouse = GetMousePosition();
+    event.mouse.x -= widget->last_offset.x;
+    event.mouse.y -= widget->last_offset.y;
+    handleWidgetEvent(widget, event);
+}
+
 static void insertCharIntoWidget(Widget *widget, int code)
 {
     Event event;
@@ -49,11 +59,15 @@ static void chooseFileAndOpenIntoWidget(Widget *widget)
         openFileIntoWidget(widget, file);
 }
 
+// The new view shows the same document as the focused one,
+// if that's a buffer view, without copying it.
 static void split(SplitDirection dir)
 {
     Widget *focus = getFocus();
-    if (focus)
-        stylizedSplitView(dir, focus, (Widget*) createStylizedBufferView());
+    if (focus) {
+        Document *doc = getBufferViewDocument(focus);
+        stylizedSplitView(dir, focus, (Widget*) createStylizedBufferView(doc));
+    }
 }
 
 static void applyKeyToWidget(Widget *widget, int key)
@@ -87,11 +101,28 @@ static void unclickFromWidget(Widget *widget)
     handleWidgetEvent(widget, event);
 }
 
+// Returns true if there was any input since the last frame
+static bool receivedInput(void)
+{
+    Vector2 mouse_delta = GetMouseDelta();
+    return mouse_delta.x != 0 || mouse_delta.y != 0
+        || IsMouseButtonPressed(MOUSE_BUTTON_LEFT)
+        || IsMouseButtonReleased(MOUSE_BUTTON_LEFT)
+        || IsWindowResized()
+        || IsKeyRepeatPending();
+}
+
 void dispatchEvents(Widget *root)
 {
     Widget *focus = getFocus();
     Widget *mouse_focus = getMouseFocus();
 
+    // Widgets can't tell all the ways input changes how
+    // they're drawn, so the window is drawn again when
+    // there is any.
+    if (receivedInput())
+        requestRedraw();
+
     if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
         clickOntoWidget(root);
     
@@ -109,6 +140,7 @@ void dispatchEvents(Widget *root)
 
     Vector2 wheel = GetMouseWheelMoveV();
     if (wheel.x != 0 || wheel.y != 0) {
+        requestRedraw();
         Event event;
         event.type = EVENT_MOUSE_WHEEL;
         event.mouse = GetMousePosition();
@@ -119,8 +151,13 @@ void dispatchEvents(Widget *root)
     int first_repeat_freq = 500000;
     int       repeat_freq =  30000;
     for (int key, repeat; (key = GetKeyPressedOrRepeated(&repeat, repeat_freq, first_repeat_freq)) > 0;) {
+        requestRedraw();
         if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
-            if (!repeat) {
+            bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+            if (key == KEY_Z || key == KEY_Y) {
+                // Undo and redo can be held down
+                if (focus) undoInWidget(focus, key == KEY_Y || shift);
+            } else if (!repeat) {
                 switch (key) {
                     case KEY_UP:    split(SPLIT_UP);    break;
                     case KEY_DOWN:  split(SPLIT_DOWN);  break;
@@ -138,6 +175,42 @@ void dispatchEvents(Widget *root)
         }
     }
 
-    for (int code; (code = GetCharPressed()) > 0;)
+    for (int code; (code = GetCharPressed()) > 0;) {
+        requestRedraw();
         if (focus) insertCharIntoWidget(focus, code);
+    }
+}
+
+/* Symbol: drawFrame
+**
+**   Draw [root] over the whole window if a redraw was asked
+**   for since the last frame. Otherwise, wait for input.
+**
+**   While nothing changes, raylib is left waiting for events
+**   instead of polling them at the target frame rate, so an
+**   idle window doesn't use the CPU. Frames are drawn one
+**   after the other only while input comes in or widgets
+**   keep asking for a redraw while they're drawn.
+*/
+void drawFrame(Widget *root)
+{
+    if (!isRedrawRequested()) {
+        EnableEventWaiting();
+        PollInputEvents();
+        return;
+    }
+    clearRedrawRequest();
+
+    BeginDrawing();
+    ClearBackground(WHITE);
+    Vector2 offset = {0, 0};
+    Vector2 area = {GetScreenWidth(), GetScreenHeight()};
+    drawWidget(root, offset, area);
+
+    // EndDrawing polls for the input of the next frame
+    if (isRedrawRequested())
+        DisableEventWaiting();
+    else
+        EnableEventWaiting();
+    EndDrawing();
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "widget/widget.h"
 
 void dispatchEvents(Widget *root);
+void drawFrame(Widget *root);
 void openFileIntoWidget(Widget *widget, const char *file);
\ No newline at end of file
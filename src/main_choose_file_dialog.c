@@ -332,12 +332,7 @@ int chooseFileDialog(int argc, char **argv)
         }
 
         dispatchEvents(file_chooser.root);
-        BeginDrawing();
-        ClearBackground(WHITE);
-        Vector2 offset = {0, 0};
-        Vector2 area = {window_w, window_h};
-        drawWidget(file_chooser.root, offset, area);
-        EndDrawing();
+        drawFrame(file_chooser.root);
     }
 
     if (file_chooser.submited) {
@@ -19,7 +19,7 @@ int editor(int argc, char **argv)
     InitWindow(720, 500, "SnB");
     loadStyleFrom("style.cfg");
 
-    Widget *root = (Widget*) createStylizedBufferView();
+    Widget *root = (Widget*) createStylizedBufferView(NULL);
     root->parent = &root;
 
     if (file)
@@ -27,12 +27,7 @@ int editor(int argc, char **argv)
 
     while (!WindowShouldClose()) {
         dispatchEvents(root);
-        BeginDrawing();
-        ClearBackground(WHITE);
-        Vector2 offset = {0, 0};
-        Vector2 area = {GetScreenWidth(), GetScreenHeight()};
-        drawWidget(root, offset, area);
-        EndDrawing();
+        drawFrame(root);
     }
 
     freeWidget(root);
@@ -121,6 +121,7 @@ static void applyStyle(void)
         
         .font_file = getParamString("buffer.font.file", "SourceCodePro-Regular.ttf"),
         .font_size = getParamIntMin("buffer.font.size", 20, 0),
+        .font_sdf  = getParamBool("buffer.font.sdf", false),
         .spaces_per_tab = getParamIntMin("buffer.spaces_per_tab", 8, 1),
     };
 
@@ -221,9 +222,9 @@ void initStylizedTableView(TableView *table, void *context,
         abort();
 }
 
-BufferView *createStylizedBufferView(void)
+BufferView *createStylizedBufferView(Document *doc)
 {
-    BufferView *buff = createBufferView(&base_style, &style);
+    BufferView *buff = createBufferView(&base_style, &style, doc);
     if (buff == NULL)
         abort();
     return buff;   
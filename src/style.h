@@ -13,6 +13,6 @@ void decreaseFontSize(void);
 TextInput  *createStylizedTextInput(void);
 Button     *createStylizedButton(const char *label, void *context, ButtonCallback callback);
 GroupView  *createStylizedGroupView(void);
-BufferView *createStylizedBufferView(void);
+BufferView *createStylizedBufferView(Document *doc);
 void         initStylizedTableView(TableView *table, void *context, TableFunctions iter_funcs, TableCallback callback);
 void stylizedSplitView(SplitDirection dir, Widget *first, Widget *second);
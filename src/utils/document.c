@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "basic.h"
+#include "newline.h"
+#include "document.h"
+
+/* Documents
+**
+**   A document is the text of a file along with its path, its
+**   undo history and the save running in the background, if
+**   any. Views that show the same file share one document, so
+**   the text is held once however many views show it, and an
+**   edit made through one of them is seen by all the others.
+**
+**   Documents are counted references and are freed when the
+**   last view releases them. Opening a file that's already
+**   open returns the document that holds it.
+**
+**   The buffer has one cursor but each view has its own. Views
+**   keep their cursors, and any other offset they care about,
+**   as anchors, which the document moves when text is inserted
+**   or removed before them. Before moving the cursor or editing,
+**   a view puts the buffer's cursor where its own is (see
+**   Document_useCursor), and after editing the document finds
+**   the range that changed from where the cursor moved and how
+**   many bytes were added or removed.
+**
+**   Views are also told which lines an edit replaced through
+**   listeners, so that they can forget what they know about
+**   those lines only.
+*/
+
+// The gap buffer grows by itself as text is inserted
+// so this is only the starting capacity.
+#define INITIAL_GAP_CAPACITY (1 << 16)
+
+// Files bigger than this are opened in a piece table,
+// which maps them in memory instead of loading them.
+// They aren't validated either, since that would read
+// all of them: invalid UTF-8 that makes smaller files
+// fail to open is shown as '?' in them.
+#define PIECE_TABLE_THRESHOLD ((long) 64 << 20)
+
+// Undo history kept in memory by each document. Older
+// history is moved to a temporary file.
+#define UNDO_MEMORY_LIMIT (4 << 20)
+
+static Document *open_documents = NULL;
+
+// Versions are counted for all documents together, so
+// that no two documents ever have the same one.
+static uint64_t last_version = 0;
+
+static Document *createWithBuffer(GapBuffer *gap)
+{
+    Document *doc = malloc(sizeof(Document));
+    if (doc == NULL)
+        return NULL;
+
+    if (!GapBuffer_enableUndo(gap, UNDO_MEMORY_LIMIT))
+        fprintf(stderr, "Couldn't enable undo\n");
+
+    doc->gap = gap;
+    doc->saving = NULL;
+    doc->file[0] = '\0';
+    doc->refs = 1;
+    doc->line_count = GapBuffer_getLineCount(gap);
+    doc->version = ++last_version;
+    doc->anchors = NULL;
+    doc->cursor_owner = NULL;
+    doc->listeners = NULL;
+
+    doc->next = open_documents;
+    open_documents = doc;
+    return doc;
+}
+
+/* Symbol: Document_create
+**   Returns a new empty document, or NULL if there's no
+**   memory. It must be given back with Document_release.
+*/
+Document *Document_create(void)
+{
+    GapBuffer *gap = GapBuffer_create(INITIAL_GAP_CAPACITY);
+    if (gap == NULL)
+        return NULL;
+
+    Document *doc = createWithBuffer(gap);
+    if (doc == NULL)
+        GapBuffer_destroy(gap);
+    return doc;
+}
+
+// Returns the size of [filename] in bytes, or -1 if it
+// can't be opened.
+static long getFileSize(const char *filename)
+{
+    FILE *stream = fopen(filename, "rb");
+    if (stream == NULL)
+        return -1;
+
+    long size = -1;
+    if (!fseek(stream, 0, SEEK_END))
+        size = ftell(stream);
+    fclose(stream);
+    return size;
+}
+
+// Returns the absolute path of [file] with no links or dots
+// in it, or NULL if it can't be resolved. It must be freed.
+static char *resolvePath(const char *file)
+{
+#ifdef _WIN32
+    return _fullpath(NULL, file, 0);
+#else
+    return realpath(file, NULL);
+#endif
+}
+
+static bool samePath(const char *a, const char *b)
+{
+    if (!strcmp(a, b))
+        return true;
+
+    char *resolved_a = resolvePath(a);
+    char *resolved_b = resolvePath(b);
+    bool same = resolved_a && resolved_b && !strcmp(resolved_a, resolved_b);
+    free(resolved_a);
+    free(resolved_b);
+    return same;
+}
+
+static Document *findOpenDocument(const char *file)
+{
+    for (Document *doc = open_documents; doc; doc = doc->next)
+        if (doc->file[0] && samePath(doc->file, file))
+            return doc;
+    return NULL;
+}
+
+/* Symbol: Document_open
+**
+**   Returns a document with the contents of [file], or NULL
+**   if it can't be loaded. If the file is open already, the
+**   document that holds it is returned and nothing is loaded,
+**   so that views on the same file share its text and edits.
+**   The document must be given back with Document_release.
+*/
+Document *Document_open(const char *file)
+{
+    size_t file_len = strlen(file);
+    if (file_len >= sizeof(((Document*) NULL)->file)) {
+        fprintf(stderr, "File path is too long (longer than the buffer file path limit)\n");
+        return NULL;
+    }
+
+    Document *open = findOpenDocument(file);
+    if (open)
+        return Document_acquire(open);
+
+    GapBuffer *gap;
+    if (getFileSize(file) >= PIECE_TABLE_THRESHOLD)
+        gap = GapBuffer_createPieceTable();
+    else
+        gap = GapBuffer_create(INITIAL_GAP_CAPACITY);
+    if (gap == NULL) {
+        fprintf(stderr, "Failed to allocate gap buffer memory to load file\n");
+        return NULL;
+    }
+
+    if (!GapBuffer_insertFile(gap, file)) {
+        fprintf(stderr, "Failed to load '%s' into gap buffer (out of memory or not valid utf-8)\n", file);
+        GapBuffer_destroy(gap);
+        return NULL;
+    }
+
+    Document *doc = createWithBuffer(gap);
+    if (doc == NULL) {
+        GapBuffer_destroy(gap);
+        return NULL;
+    }
+    memcpy(doc->file, file, file_len+1);
+    return doc;
+}
+
+/* Symbol: Document_setFile
+**
+**   Give [doc] the name of the [file] it's about to be saved
+**   to. Returns false if another document has that file open,
+**   since two documents editing one file would overwrite each
+**   other's changes, or if the path is too long.
+*/
+bool Document_setFile(Document *doc, const char *file)
+{
+    size_t file_len = strlen(file);
+    if (file_len >= sizeof(doc->file)) {
+        fprintf(stderr, "File path is too long (longer than the buffer file path limit)\n");
+        return false;
+    }
+
+    Document *open = findOpenDocument(file);
+    if (open && open != doc) {
+        fprintf(stderr, "'%s' is already open in another buffer\n", file);
+        return false;
+    }
+    memcpy(doc->file, file, file_len+1);
+    return true;
+}
+
+Document *Document_acquire(Document *doc)
+{
+    doc->refs++;
+    return doc;
+}
+
+void Document_release(Document *doc)
+{
+    if (doc == NULL || --doc->refs > 0)
+        return;
+
+    Document **prev = &open_documents;
+    while (*prev && *prev != doc)
+        prev = &(*prev)->next;
+    if (*prev)
+        *prev = doc->next;
+
+    if (doc->saving)
+        Save_finish(doc->saving); // Wait for it
+    GapBuffer_destroy(doc->gap);
+    free(doc);
+}
+
+void Document_addAnchor(Document *doc, DocumentAnchor *anchor, size_t offset)
+{
+    anchor->offset = MIN(offset, GapBuffer_getByteCount(doc->gap));
+    anchor->next = doc->anchors;
+    doc->anchors = anchor;
+}
+
+void Document_removeAnchor(Document *doc, DocumentAnchor *anchor)
+{
+    DocumentAnchor **prev = &doc->anchors;
+    while (*prev && *prev != anchor)
+        prev = &(*prev)->next;
+    if (*prev)
+        *prev = anchor->next;
+
+    if (doc->cursor_owner == anchor)
+        doc->cursor_owner = NULL;
+}
+
+void Document_addListener(Document *doc, DocumentListener *listener)
+{
+    listener->next = doc->listeners;
+    doc->listeners = listener;
+}
+
+void Document_removeListener(Document *doc, DocumentListener *listener)
+{
+    DocumentListener **prev = &doc->listeners;
+    while (*prev && *prev != listener)
+        prev = &(*prev)->next;
+    if (*prev)
+        *prev = listener->next;
+}
+
+/* Symbol: Document_useCursor
+**
+**   Move the cursor of the buffer to the [cursor] anchor of
+**   a view and return the buffer, so that the view can move
+**   its cursor with the functions of the buffer. The anchor
+**   isn't updated by them: the view copies the cursor of the
+**   buffer into it when it's done.
+**
+**   The buffer's cursor is left alone if it's already there
+**   for the same view, so that its target column for moving
+**   up and down is kept.
+*/
+GapBuffer *Document_useCursor(Document *doc, DocumentAnchor *cursor)
+{
+    GapBuffer *gap = doc->gap;
+    if (doc->cursor_owner != cursor || GapBuffer_rawCursorPosition(gap) != cursor->offset) {
+        GapBuffer_moveAbsoluteRaw(gap, cursor->offset);
+        doc->cursor_owner = cursor;
+    }
+    return gap;
+}
+
+static void notifyListeners(Document *doc, size_t first, size_t removed, size_t inserted)
+{
+    for (DocumentListener *listener = doc->listeners; listener; listener = listener->next)
+        listener->changedLines(listener->data, first, removed, inserted);
+}
+
+/* Symbol: syncLineCount
+**
+**   Tell the listeners about lines the buffer found since
+**   they were last told about its lines.
+**
+**   Buffers of huge files estimate the lines they didn't
+**   count yet, and the estimate changes as lines are looked
+**   up. Lines before the ones that weren't counted keep
+**   their index, so it's only the count that's corrected.
+*/
+static void syncLineCount(Document *doc)
+{
+    size_t line_count = GapBuffer_getLineCount(doc->gap);
+    if (line_count == doc->line_count)
+        return;
+
+    size_t first = MIN(line_count, doc->line_count);
+    size_t removed = doc->line_count - first;
+    doc->line_count = line_count;
+    notifyListeners(doc, first, removed, line_count - first);
+}
+
+/* Symbol: Document_getLineCount
+**   Returns the number of lines of the document. Views use
+**   this instead of asking the buffer so that the lines they
+**   were told about add up to it.
+*/
+size_t Document_getLineCount(Document *doc)
+{
+    syncLineCount(doc);
+    return doc->line_count;
+}
+
+// The [removed] bytes at [start] were replaced by [inserted]
+// bytes. Anchors after them are moved by the bytes that were
+// added or removed, and the ones that were inside removed
+// text are moved where it was.
+static void moveAnchors(Document *doc, size_t start, size_t removed, size_t inserted)
+{
+    for (DocumentAnchor *anchor = doc->anchors; anchor; anchor = anchor->next) {
+        if (anchor->offset >= start + removed)
+            anchor->offset = anchor->offset - removed + inserted;
+        else if (anchor->offset > start)
+            anchor->offset = start;
+    }
+}
+
+/* Symbol: Document_beginEdit
+**
+**   Called by a view before it edits the buffer at its
+**   [cursor]. It puts the cursor of the buffer there and
+**   returns what Document_endEdit needs to know about the
+**   text before the edit.
+*/
+DocumentEdit Document_beginEdit(Document *doc, DocumentAnchor *cursor)
+{
+    GapBuffer *gap = Document_useCursor(doc, cursor);
+    size_t cursor_line = GapBuffer_getLineIndex(gap, GapBuffer_rawCursorPosition(gap));
+    syncLineCount(doc);
+    return (DocumentEdit) {
+        .cursor      = GapBuffer_rawCursorPosition(gap),
+        .cursor_line = cursor_line,
+        .line_count  = doc->line_count,
+        .byte_count  = GapBuffer_getByteCount(gap),
+    };
+}
+
+/* Symbol: Document_endEdit
+**
+**   Called after an edit that touched the text between where
+**   the cursor was before it and where it's now, which is the
+**   case of all edits made at the cursor.
+**
+**   The bytes between the two positions were replaced by the
+**   ones the edit left there, and the anchors are moved to
+**   follow them. The [cursor] is moved where the buffer's
+**   cursor is now.
+**
+**   Listeners are told which lines were replaced.
+*/
+void Document_endEdit(Document *doc, DocumentAnchor *cursor, DocumentEdit edit)
+{
+    GapBuffer *gap = doc->gap;
+    size_t new_cursor = GapBuffer_rawCursorPosition(gap);
+    size_t byte_count = GapBuffer_getByteCount(gap);
+
+    size_t start = MIN(edit.cursor, new_cursor);
+    size_t removed_bytes  = 0;
+    size_t inserted_bytes = 0;
+    if (byte_count > edit.byte_count)
+        inserted_bytes = byte_count - edit.byte_count;
+    else
+        removed_bytes = edit.byte_count - byte_count;
+
+    moveAnchors(doc, start, removed_bytes, inserted_bytes);
+    cursor->offset = new_cursor;
+    doc->version = ++last_version;
+    doc->cursor_owner = cursor;
+
+    // The count is taken before looking up the line of the
+    // cursor, which may correct it (see syncLineCount).
+    size_t  line_count = GapBuffer_getLineCount(gap);
+    size_t cursor_line = GapBuffer_getLineIndex(gap, new_cursor);
+
+    size_t removed  = 1;
+    size_t inserted = 1;
+    if (line_count > edit.line_count)
+        inserted += line_count - edit.line_count;
+    else
+        removed += edit.line_count - line_count;
+
+    doc->line_count = line_count;
+    syncLineCount(doc);
+    notifyListeners(doc, MIN(edit.cursor_line, cursor_line), removed, inserted);
+}
+
+// Called with each edit an undo or redo is made of, right
+// before it's applied to the buffer.
+static void replayedEdit(void *data, const GapBufferEdit *edit)
+{
+    Document  *doc = data;
+    GapBuffer *gap = doc->gap;
+
+    size_t first = GapBuffer_getLineIndex(gap, edit->offset);
+    size_t last  = GapBuffer_getLineIndex(gap, edit->offset + edit->delete_len);
+    size_t inserted = Newline_count(edit->insert, edit->insert_len);
+    syncLineCount(doc);
+
+    moveAnchors(doc, edit->offset, edit->delete_len, edit->insert_len);
+    doc->version = ++last_version;
+    doc->line_count = doc->line_count - (last - first) + inserted;
+    notifyListeners(doc, first, last - first + 1, inserted + 1);
+}
+
+/* Symbol: Document_undo
+**
+**   Revert the last change to the document, or apply again
+**   the last one that was reverted if [redo] is true, and
+**   move the [cursor] of the view that asked for it where
+**   the change was. Returns false if there was nothing to
+**   replay.
+**
+**   Changes are replayed as edits like the ones they were
+**   made of, and each moves the anchors and is told to the
+**   listeners as any other edit.
+*/
+bool Document_undo(Document *doc, DocumentAnchor *cursor, bool redo)
+{
+    GapBuffer *gap = Document_useCursor(doc, cursor);
+
+    bool replayed;
+    if (redo)
+        replayed = GapBuffer_redo(gap, replayedEdit, doc);
+    else
+        replayed = GapBuffer_undo(gap, replayedEdit, doc);
+
+    // A step that can't be applied, which only happens when
+    // there's no memory, leaves the text as it was although
+    // it was reported. Then all lines are replaced.
+    size_t byte_count = GapBuffer_getByteCount(gap);
+    for (DocumentAnchor *anchor = doc->anchors; anchor; anchor = anchor->next)
+        anchor->offset = MIN(anchor->offset, byte_count);
+
+    // Steps that failed were already counted as edits
+    size_t line_count = GapBuffer_getLineCount(gap);
+    if (line_count != doc->line_count) {
+        notifyListeners(doc, 0, doc->line_count, line_count);
+        doc->line_count = line_count;
+    }
+
+    cursor->offset = GapBuffer_rawCursorPosition(gap);
+    doc->cursor_owner = cursor;
+    return replayed;
+}
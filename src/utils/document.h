@@ -0,0 +1,59 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gap_buffer.h"
+#include "save.h"
+
+typedef struct DocumentAnchor DocumentAnchor;
+struct DocumentAnchor {
+    DocumentAnchor *next;
+    size_t offset;
+};
+
+typedef struct DocumentListener DocumentListener;
+struct DocumentListener {
+    DocumentListener *next;
+    void *data;
+    void (*changedLines)(void *data, size_t first, size_t removed, size_t inserted);
+};
+
+typedef struct {
+    size_t cursor;
+    size_t cursor_line;
+    size_t line_count;
+    size_t byte_count;
+} DocumentEdit;
+
+typedef struct Document Document;
+struct Document {
+    Document  *next; // Of the documents that are open
+    GapBuffer *gap;
+    SaveJob   *saving; // Save running in the background, if any
+    char file[1024];
+    int  refs;
+    size_t line_count;
+    uint64_t version; // Changes with every edit, and is never the one of another document
+    DocumentAnchor   *anchors;
+    DocumentAnchor   *cursor_owner; // Anchor the buffer's cursor was last moved to
+    DocumentListener *listeners;
+};
+
+Document    *Document_create(void);
+Document    *Document_open(const char *file);
+bool         Document_setFile(Document *doc, const char *file);
+Document    *Document_acquire(Document *doc);
+void         Document_release(Document *doc);
+void         Document_addAnchor(Document *doc, DocumentAnchor *anchor, size_t offset);
+void         Document_removeAnchor(Document *doc, DocumentAnchor *anchor);
+void         Document_addListener(Document *doc, DocumentListener *listener);
+void         Document_removeListener(Document *doc, DocumentListener *listener);
+size_t       Document_getLineCount(Document *doc);
+GapBuffer   *Document_useCursor(Document *doc, DocumentAnchor *cursor);
+DocumentEdit Document_beginEdit(Document *doc, DocumentAnchor *cursor);
+void         Document_endEdit(Document *doc, DocumentAnchor *cursor, DocumentEdit edit);
+bool         Document_undo(Document *doc, DocumentAnchor *cursor, bool redo);
+
+#endif
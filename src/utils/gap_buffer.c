@@ -1,14 +1,44 @@
+#ifdef __linux__
+#define _GNU_SOURCE // mremap
+#endif
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include "utf8.h"
+#include "newline.h"
+#include "piece_table.h"
+#include "journal.h"
+#include "save.h"
 #include "gap_buffer.h"
 
+#ifndef GAPBUFFER_NOMALLOC
+#include <stdlib.h>
+#endif
+
+#if !defined(GAPBUFFER_NOMALLOC) && !defined(_WIN32)
+#define GAPBUFFER_MMAP
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Gaps that need to grow past this size are moved
+// from the heap to anonymous mappings, which on
+// Linux can be resized with mremap without copying
+// the text before the gap.
+#ifndef GAPBUFFER_MMAP_THRESHOLD
+#define GAPBUFFER_MMAP_THRESHOLD (1 << 20)
+#endif
+
+// Minimum capacity of a buffer after it grew
+#define GAPBUFFER_MIN_GROWTH (1 << 12)
+
 #ifdef GAPBUFFER_DEBUG
 #define PRIVATE
 #else
 #define PRIVATE static
 #endif
 
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
 #define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
 
 typedef struct {
@@ -16,36 +46,93 @@ typedef struct {
     size_t      size;
 } String;
 
+typedef enum {
+    STORAGE_INLINE, // Data lives in the memory block of the GapBuffer struct
+    STORAGE_HEAP,   // Data lives in a separate malloc'd block
+    STORAGE_MAPPED, // Data lives in an anonymous memory mapping
+    STORAGE_FILE,   // Like STORAGE_MAPPED, but the text after the gap
+                    // is a private (copy-on-write) mapping of a file
+} Storage;
+
 struct GapBuffer {
     void (*free)(void*);
+    char   *data;
+    Storage storage;
     size_t gap_offset;
     size_t gap_length;
     size_t total;
+    size_t cursor; // Logical offset. The gap is only moved here when editing.
     size_t column_target;
     size_t column_current;
-    char   data[];
+
+    // Line index (see "Line index" below)
+    size_t    newlines;
+    size_t    line_chunk_count;
+    uint16_t *line_chunks;
+    size_t   *line_tree;
+
+    // When set, the text is stored in this piece table
+    // and the functions of the gap buffer forward to it.
+    PieceTable *pieces;
+
+    // Undo history, or NULL if edits aren't recorded
+    Journal *journal;
+
+    char   inline_data[];
+};
+
+struct GapBufferSnapshot {
+    char  *copy;
+    size_t size;
+    PieceTableSnapshot *pieces; // Set instead of [copy] for piece tables
 };
 
 size_t GapBuffer_getColumn(GapBuffer *gap)
 {
+    if (gap->pieces)
+        return PieceTable_getColumn(gap->pieces);
+
     return gap->column_current;
 }
 
 size_t GapBuffer_getTargetColumn(GapBuffer *gap)
 {
+    if (gap->pieces)
+        return PieceTable_getTargetColumn(gap->pieces);
+
     return gap->column_target;
 }
 
 size_t GapBuffer_rawCursorPosition(GapBuffer *buff)
 {
-    return buff->gap_offset;
+    if (buff->pieces)
+        return PieceTable_getCursor(buff->pieces);
+
+    return buff->cursor;
 }
 
 size_t GapBuffer_getByteCount(GapBuffer *buff)
 {
+    if (buff->pieces)
+        return PieceTable_getByteCount(buff->pieces);
+
     return buff->total - buff->gap_length;
 }
 
+PRIVATE void releaseStorage(GapBuffer *buff);
+PRIVATE void createLineIndex(GapBuffer *buff);
+PRIVATE void resizeLineIndex(GapBuffer *buff);
+PRIVATE void clearLineIndex(GapBuffer *buff);
+PRIVATE void freeLineIndex(GapBuffer *buff);
+PRIVATE void moveGapToCursor(GapBuffer *buff);
+PRIVATE void moveBytesAfterGap(GapBuffer *buff, size_t num);
+PRIVATE void moveBytesBeforeGap(GapBuffer *buff, size_t num);
+PRIVATE size_t findFollowingSymbol(GapBuffer *buff, size_t offset, size_t num);
+PRIVATE size_t findPrecedingSymbol(GapBuffer *buff, size_t offset, size_t num);
+PRIVATE void recordEdit(GapBuffer *buff, const GapBufferEdit *edit, ptrdiff_t shift, bool joined);
+PRIVATE void recordEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count);
+PRIVATE void checkRecordedEdit(GapBuffer *buff, size_t expected);
+
 GapBuffer *GapBuffer_createUsingMemory(void *mem, size_t len, void (*free)(void*))
 {
     if (mem == NULL || len < sizeof(GapBuffer)) {
@@ -56,19 +143,41 @@ GapBuffer *GapBuffer_createUsingMemory(void *mem, size_t len, void (*free)(void*
     size_t capacity = len - sizeof(GapBuffer);
 
     GapBuffer *buff = mem;
+    buff->data = buff->inline_data;
+    buff->storage = STORAGE_INLINE;
     buff->gap_offset = 0;
     buff->gap_length = capacity;
+    buff->cursor = 0;
     buff->column_target = 0;
     buff->column_current = 0;
     buff->total = capacity;
     buff->free = free;
+    buff->newlines = 0;
+    buff->line_chunk_count = 0;
+    buff->line_chunks = NULL;
+    buff->line_tree = NULL;
+    buff->pieces = NULL;
+    buff->journal = NULL;
+    createLineIndex(buff);
     return buff;
 }
 
 void GapBuffer_whipeClean(GapBuffer *gap)
 {
+    if (gap->journal)
+        Journal_clear(gap->journal);
+
+    if (gap->pieces) {
+        PieceTable_whipeClean(gap->pieces);
+        return;
+    }
+
     gap->gap_offset = 0;
     gap->gap_length = gap->total;
+    gap->cursor = 0;
+    gap->column_target = 0;
+    gap->column_current = 0;
+    clearLineIndex(gap);
 }
 
 /* Symbol: GapBuffer_destroy
@@ -76,6 +185,12 @@ void GapBuffer_whipeClean(GapBuffer *gap)
 */
 void GapBuffer_destroy(GapBuffer *buff)
 {
+    if (buff->pieces)
+        PieceTable_destroy(buff->pieces);
+    if (buff->journal)
+        Journal_destroy(buff->journal);
+    freeLineIndex(buff);
+    releaseStorage(buff);
     if (buff->free)
         buff->free(buff);
 }
@@ -129,124 +244,443 @@ PRIVATE bool isSymbolAuxiliaryByte(uint8_t byte)
     return (byte & 0xC0) == 0x80;
 }
 
-PRIVATE int getSymbolRune(const char *sym, size_t symlen, uint32_t *rune)
+static size_t countSymbolsAfterLastNewline(String str, bool *have_newline)
 {
-    if(symlen == 0)
-        return 0;
-    
-    if(sym[0] & 0x80) {
+    size_t cur = Newline_findLast(str.data, str.size);
+    if (cur < str.size) {
+        *have_newline = true;
+        cur++; // Skip the newline
+    } else {
+        *have_newline = false;
+        cur = 0;
+    }
 
-        // May be UTF-8.
-            
-        if((unsigned char) sym[0] >= 0xF0) {
-
-            // 4 bytes.
-            // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-
-            if(symlen < 4)
-                return -1;
-
-            if (!isSymbolAuxiliaryByte(sym[1]) ||
-                !isSymbolAuxiliaryByte(sym[2]) ||
-                !isSymbolAuxiliaryByte(sym[3]))
-                return -1;
-                    
-            uint32_t temp 
-                = (((uint32_t) sym[0] & 0x07) << 18) 
-                | (((uint32_t) sym[1] & 0x3f) << 12)
-                | (((uint32_t) sym[2] & 0x3f) <<  6)
-                | (((uint32_t) sym[3] & 0x3f));
-
-            if(temp < 0x010000 || temp > 0x10ffff)
-                return -1;
-
-            *rune = temp;
-            return 4;
-        }
-            
-        if((unsigned char) sym[0] >= 0xE0) {
+    return UTF8_countRunes(str.data + cur, str.size - cur);
+}
+
+/* Line index
+**
+**   The memory of the buffer is split into fixed-size chunks
+**   and the number of newlines in each chunk is stored in
+**   [line_chunks] and summed up by a Fenwick tree [line_tree].
+**   Only text bytes are counted, the ones in the gap aren't.
+**
+**   Since chunks are physical regions of the buffer, an edit
+**   only needs to update the chunks containing the bytes that
+**   were written, removed or moved around, which is the work
+**   the edit already does. Mapping a line to its offset (and
+**   the other way around) costs a descent of the tree plus
+**   a scan of a single chunk.
+**
+**   If the index couldn't be allocated, queries fall back to
+**   scanning the whole buffer.
+*/
 
-            // 3 bytes.
-            // 1110xxxx 10xxxxxx 10xxxxxx
+#define LINE_CHUNK_SHIFT 12
+#define LINE_CHUNK_SIZE  ((size_t) 1 << LINE_CHUNK_SHIFT)
 
-            if(symlen < 3)
-                return -1;
+static void updateLineTree(GapBuffer *buff, size_t chunk, size_t count, bool add)
+{
+    for (size_t i = chunk + 1; i <= buff->line_chunk_count; i += i & -i) {
+        if (add)
+            buff->line_tree[i] += count;
+        else
+            buff->line_tree[i] -= count;
+    }
+}
 
-            if (!isSymbolAuxiliaryByte(sym[1]) ||
-                !isSymbolAuxiliaryByte(sym[2]))
-                return -1;
+static void rebuildLineTree(GapBuffer *buff)
+{
+    size_t num = buff->line_chunk_count;
+    size_t *tree = buff->line_tree;
 
-            uint32_t temp
-                = (((uint32_t) sym[0] & 0x0f) << 12)
-                | (((uint32_t) sym[1] & 0x3f) <<  6)
-                | (((uint32_t) sym[2] & 0x3f));
-            
-            if (temp < 0x0800 || temp > 0xffff)
-                return -1;
+    tree[0] = 0;
+    for (size_t i = 1; i <= num; i++)
+        tree[i] = buff->line_chunks[i-1];
 
-            *rune = temp;
-            return 3;
+    for (size_t i = 1; i <= num; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= num)
+            tree[parent] += tree[i];
+    }
+}
+
+/* Symbol: indexBytes
+**   Add to the line index the newlines in the [len] bytes
+**   at physical offset [offset], or remove them from the
+**   index if [add] is false. It must be called after bytes
+**   become part of the text and before they become part of
+**   the gap.
+*/
+PRIVATE void indexBytes(GapBuffer *buff, size_t offset, size_t len, bool add)
+{
+    size_t end = offset + len;
+    while (offset < end) {
+
+        size_t chunk = offset >> LINE_CHUNK_SHIFT;
+        size_t chunk_end = MIN((chunk + 1) << LINE_CHUNK_SHIFT, end);
+
+        size_t count = Newline_count(buff->data + offset, chunk_end - offset);
+        if (count > 0) {
+            if (add)
+                buff->newlines += count;
+            else
+                buff->newlines -= count;
+            if (buff->line_chunks) {
+                if (add)
+                    buff->line_chunks[chunk] += count;
+                else
+                    buff->line_chunks[chunk] -= count;
+                updateLineTree(buff, chunk, count, add);
+            }
         }
-            
-        if((unsigned char) sym[0] >= 0xC0) {
+        offset = chunk_end;
+    }
+}
+
+PRIVATE void freeLineIndex(GapBuffer *buff)
+{
+#ifndef GAPBUFFER_NOMALLOC
+    free(buff->line_chunks);
+    free(buff->line_tree);
+#endif
+    buff->line_chunks = NULL;
+    buff->line_tree = NULL;
+    buff->line_chunk_count = 0;
+}
+
+PRIVATE void clearLineIndex(GapBuffer *buff)
+{
+    buff->newlines = 0;
+    if (buff->line_chunks) {
+        memset(buff->line_chunks, 0, buff->line_chunk_count * sizeof(uint16_t));
+        memset(buff->line_tree,   0, (buff->line_chunk_count + 1) * sizeof(size_t));
+    }
+}
+
+PRIVATE void createLineIndex(GapBuffer *buff)
+{
+#ifdef GAPBUFFER_NOMALLOC
+    (void) buff;
+#else
+    size_t count = (buff->total + LINE_CHUNK_SIZE - 1) >> LINE_CHUNK_SHIFT;
+    buff->line_chunks = calloc(count + 1, sizeof(uint16_t));
+    buff->line_tree   = calloc(count + 1, sizeof(size_t));
+    if (buff->line_chunks == NULL || buff->line_tree == NULL) {
+        freeLineIndex(buff);
+        return;
+    }
+    buff->line_chunk_count = count;
+#endif
+}
 
-            // 2 bytes.
-            // 110xxxxx 10xxxxxx
+/* Symbol: resizeLineIndex
+**   Make the line index cover the whole memory of the
+**   buffer after it grew. The new chunks are empty. If
+**   the index can't be allocated it's dropped and queries
+**   will scan the text.
+*/
+PRIVATE void resizeLineIndex(GapBuffer *buff)
+{
+#ifdef GAPBUFFER_NOMALLOC
+    (void) buff;
+#else
+    if (buff->line_chunks == NULL)
+        return;
 
-            if(symlen < 2)
-                return -1;
+    size_t old_count = buff->line_chunk_count;
+    size_t new_count = (buff->total + LINE_CHUNK_SIZE - 1) >> LINE_CHUNK_SHIFT;
 
-            if (!isSymbolAuxiliaryByte(sym[1]))
-                return -1;
+    uint16_t *chunks = realloc(buff->line_chunks, (new_count + 1) * sizeof(uint16_t));
+    if (chunks == NULL) {
+        freeLineIndex(buff);
+        return;
+    }
+    buff->line_chunks = chunks;
 
-            *rune 
-                = (((uint32_t) sym[0] & 0x1f) << 6)
-                | (((uint32_t) sym[1] & 0x3f));
+    size_t *tree = realloc(buff->line_tree, (new_count + 1) * sizeof(size_t));
+    if (tree == NULL) {
+        freeLineIndex(buff);
+        return;
+    }
+    buff->line_tree = tree;
 
-            if (*rune < 0x80 || *rune > 0x07ff)
-                return -1;
+    if (new_count > old_count)
+        memset(chunks + old_count, 0, (new_count - old_count) * sizeof(uint16_t));
+    buff->line_chunk_count = new_count;
+    rebuildLineTree(buff);
+#endif
+}
 
-            assert(*rune <= 0x10ffff);
-            return 2;
+static size_t newlinesBeforeChunk(const GapBuffer *buff, size_t chunk)
+{
+    size_t count = 0;
+    for (size_t i = chunk; i > 0; i -= i & -i)
+        count += buff->line_tree[i];
+    return count;
+}
+
+/* Symbol: findChunkOfNewline
+**   Returns the index of the chunk containing the [*nth]
+**   newline (counting from 1) of the buffer and sets [*nth]
+**   to the position of that newline relative to the chunk.
+*/
+static size_t findChunkOfNewline(const GapBuffer *buff, size_t *nth)
+{
+    size_t num = buff->line_chunk_count;
+
+    size_t step = 1;
+    while (2 * step <= num)
+        step *= 2;
+
+    size_t chunk = 0;
+    for (; step > 0; step /= 2) {
+        if (chunk + step <= num && buff->line_tree[chunk + step] < *nth) {
+            chunk += step;
+            *nth -= buff->line_tree[chunk];
         }
-            
-        return -1;
     }
+    return chunk;
+}
 
-    // It's ASCII
-    // 0xxxxxxx
+// Count the newlines in the text bytes between the physical offsets [lo] and [hi]
+static size_t countTextNewlines(const GapBuffer *buff, size_t lo, size_t hi)
+{
+    size_t gap_end = buff->gap_offset + buff->gap_length;
+    size_t count = 0;
+    if (lo < buff->gap_offset)
+        count += Newline_count(buff->data + lo, MIN(hi, buff->gap_offset) - lo);
+    if (hi > gap_end) {
+        lo = MAX(lo, gap_end);
+        count += Newline_count(buff->data + lo, hi - lo);
+    }
+    return count;
+}
 
-    *rune = (uint32_t) sym[0];
-    return 1;
+// Returns the physical offset of the [nth] newline in the
+// text bytes between the physical offsets [lo] and [hi], or
+// [hi] if there aren't that many.
+static size_t findTextNewline(const GapBuffer *buff, size_t lo, size_t hi, size_t nth)
+{
+    size_t gap_end = buff->gap_offset + buff->gap_length;
+    if (lo < buff->gap_offset) {
+        size_t end = MIN(hi, buff->gap_offset);
+        size_t i = lo + Newline_findNth(buff->data + lo, end - lo, &nth);
+        if (i < end)
+            return i;
+    }
+    if (hi > gap_end) {
+        lo = MAX(lo, gap_end);
+        size_t i = lo + Newline_findNth(buff->data + lo, hi - lo, &nth);
+        if (i < hi)
+            return i;
+    }
+    return hi;
 }
 
-static size_t countSymbolsAfterLastNewline(String str, bool *have_newline)
+size_t GapBuffer_getLineCount(GapBuffer *buff)
 {
-    size_t cur = str.size;
-    
-    while (cur > 0 && str.data[cur-1] != '\n')
-        cur--;
+    if (buff->pieces)
+        return PieceTable_getLineCount(buff->pieces);
+
+    return buff->newlines + 1;
+}
+
+size_t GapBuffer_getLineOffset(GapBuffer *buff, size_t line)
+{
+    if (buff->pieces)
+        return PieceTable_getLineOffset(buff->pieces, line);
+
+    if (line == 0)
+        return 0;
+
+    if (line > buff->newlines)
+        return GapBuffer_getByteCount(buff);
+
+    size_t i;
+    if (buff->line_chunks) {
+        size_t nth = line;
+        size_t chunk = findChunkOfNewline(buff, &nth);
+        size_t lo = chunk << LINE_CHUNK_SHIFT;
+        size_t hi = MIN(lo + LINE_CHUNK_SIZE, buff->total);
+        i = findTextNewline(buff, lo, hi, nth);
+    } else
+        i = findTextNewline(buff, 0, buff->total, line);
+    assert(i < buff->total && buff->data[i] == '\n');
+
+    // Convert the physical offset of the newline
+    // to the logical offset of the following byte.
+    if (i >= buff->gap_offset)
+        i -= buff->gap_length;
+    return i + 1;
+}
+
+size_t GapBuffer_getLineIndex(GapBuffer *buff, size_t offset)
+{
+    if (buff->pieces)
+        return PieceTable_getLineIndex(buff->pieces, offset);
+
+    size_t byte_count = GapBuffer_getByteCount(buff);
+    if (offset > byte_count)
+        offset = byte_count;
+
+    size_t i = offset;
+    if (i >= buff->gap_offset)
+        i += buff->gap_length;
+
+    if (buff->line_chunks == NULL)
+        return countTextNewlines(buff, 0, i);
+
+    size_t chunk = i >> LINE_CHUNK_SHIFT;
+    return newlinesBeforeChunk(buff, chunk) 
+         + countTextNewlines(buff, chunk << LINE_CHUNK_SHIFT, i);
+}
+
+#ifdef GAPBUFFER_MMAP
+static size_t roundUpToPageSize(size_t len)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (len + page - 1) & ~(page - 1);
+}
+#endif
+
+static void releaseData(char *data, Storage storage, size_t total)
+{
+    switch (storage) {
+        case STORAGE_INLINE: break;
+#ifndef GAPBUFFER_NOMALLOC
+        case STORAGE_HEAP: free(data); break;
+#endif
+#ifdef GAPBUFFER_MMAP
+        case STORAGE_FILE:
+        case STORAGE_MAPPED: munmap(data, total); break;
+#endif
+        default: (void) data; (void) total; break;
+    }
+}
+
+PRIVATE void releaseStorage(GapBuffer *buff)
+{
+    releaseData(buff->data, buff->storage, buff->total);
+    buff->data = buff->inline_data;
+    buff->storage = STORAGE_INLINE;
+}
 
-    *have_newline = (cur > 0);
+/* Symbol: growGap
+**
+**   Make sure the gap is at least [min_gap] bytes long
+**   by moving the data to a bigger memory region.
+**
+**   The capacity is at least doubled each time so that
+**   a sequence of insertions costs amortized O(1) per
+**   byte. Small buffers live on the heap while big ones
+**   are moved to anonymous mappings. On Linux mappings
+**   are grown using mremap, which moves pages instead of
+**   copying bytes, so only the text after the gap is
+**   touched.
+**
+**   Returns false if the buffer couldn't grow. In that
+**   case the buffer is left untouched.
+*/
+PRIVATE bool growGap(GapBuffer *buff, size_t min_gap)
+{
+#ifdef GAPBUFFER_NOMALLOC
+    return buff->gap_length >= min_gap;
+#else
+    if (buff->gap_length >= min_gap)
+        return true;
+
+    size_t used = buff->total - buff->gap_length;
+    if (used + min_gap < used)
+        return false; // Overflow
+
+    size_t new_total = MAX(2 * buff->total, used + min_gap);
+    new_total = MAX(new_total, GAPBUFFER_MIN_GROWTH);
+
+    String after = getStringAfterGap(buff);
+    char  *new_data;
+
+    // The text after the gap will be moved to the end
+    // of the new memory region, so it's removed from the
+    // line index and added back once it's been moved.
+    indexBytes(buff, after.data - buff->data, after.size, false);
+
+#ifdef GAPBUFFER_MMAP
+    if (new_total >= GAPBUFFER_MMAP_THRESHOLD) {
+
+        new_total = roundUpToPageSize(new_total);
+
+#ifdef __linux__
+        // File-backed buffers span two mappings, which
+        // mremap can't handle, so they're always copied.
+        if (buff->storage == STORAGE_MAPPED) {
+            new_data = mremap(buff->data, buff->total, new_total, MREMAP_MAYMOVE);
+            if (new_data == MAP_FAILED)
+                goto failed;
+            memmove(new_data + new_total - after.size, new_data + (after.data - buff->data), after.size);
+            buff->data = new_data;
+            buff->gap_length = new_total - used;
+            buff->total = new_total;
+            goto done;
+        }
+#endif
+        new_data = mmap(NULL, new_total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (new_data == MAP_FAILED)
+            goto failed;
+        memcpy(new_data, buff->data, buff->gap_offset);
+        memcpy(new_data + new_total - after.size, after.data, after.size);
+        releaseStorage(buff);
+        buff->data = new_data;
+        buff->storage = STORAGE_MAPPED;
+        buff->gap_length = new_total - used;
+        buff->total = new_total;
+        goto done;
+    }
+#endif
 
-    size_t col = 0;
-    while (cur < str.size && str.data[cur] != '\n') {
-        uint32_t unused;
-        cur += getSymbolRune(str.data + cur, str.size - cur, &unused);
-        col++;
+    if (buff->storage == STORAGE_HEAP) {
+        size_t after_offset = after.data - buff->data;
+        new_data = realloc(buff->data, new_total);
+        if (new_data == NULL)
+            goto failed;
+        memmove(new_data + new_total - after.size, new_data + after_offset, after.size);
+    } else {
+        new_data = malloc(new_total);
+        if (new_data == NULL)
+            goto failed;
+        memcpy(new_data, buff->data, buff->gap_offset);
+        memcpy(new_data + new_total - after.size, after.data, after.size);
+        releaseStorage(buff);
     }
+    buff->data = new_data;
+    buff->storage = STORAGE_HEAP;
+    buff->gap_length = new_total - used;
+    buff->total = new_total;
+
+done:
+    resizeLineIndex(buff);
+    after = getStringAfterGap(buff);
+    indexBytes(buff, after.data - buff->data, after.size, true);
+    return true;
 
-    return col;
+failed:
+    indexBytes(buff, after.data - buff->data, after.size, true);
+    return false;
+#endif
 }
 
 PRIVATE bool insertBytesBeforeCursor(GapBuffer *buff, String str)
 {
-    if (buff->gap_length < str.size)
+    if (!growGap(buff, str.size))
         return false;
     
+    assert(buff->cursor == buff->gap_offset);
+
     memcpy(buff->data + buff->gap_offset, str.data, str.size);
+    indexBytes(buff, buff->gap_offset, str.size, true);
     buff->gap_offset += str.size;
     buff->gap_length -= str.size;
+    buff->cursor = buff->gap_offset;
 
     // Update column index
     {
@@ -262,10 +696,13 @@ PRIVATE bool insertBytesBeforeCursor(GapBuffer *buff, String str)
 
 PRIVATE bool insertBytesAfterCursor(GapBuffer *buff, String str)
 {
-    if (buff->gap_length < str.size)
+    assert(buff->cursor == buff->gap_offset);
+
+    if (!growGap(buff, str.size))
         return false;
 
     memcpy(buff->data + buff->gap_offset + buff->gap_length - str.size, str.data, str.size);
+    indexBytes(buff, buff->gap_offset + buff->gap_length - str.size, str.size, true);
     buff->gap_length -= str.size;
     return true;
 }
@@ -278,6 +715,22 @@ GapBuffer *GapBuffer_cloneUsingMemory(void *mem, size_t len,
     if (!clone)
         return NULL;
 
+    if (src->pieces) {
+        // Copy the text one piece at the time, then
+        // place the cursor where it is in the source.
+        size_t offset = 0;
+        size_t total = PieceTable_getByteCount(src->pieces);
+        while (offset < total) {
+            String slice;
+            slice.data = PieceTable_getSlice(src->pieces, offset, &slice.size);
+            if (!insertBytesBeforeCursor(clone, slice))
+                goto oopsie;
+            offset += slice.size;
+        }
+        GapBuffer_moveAbsoluteRaw(clone, PieceTable_getCursor(src->pieces));
+        return clone;
+    }
+
     String before = getStringBeforeGap(src);
     if (!insertBytesBeforeCursor(clone, before))
         goto oopsie;
@@ -286,6 +739,7 @@ GapBuffer *GapBuffer_cloneUsingMemory(void *mem, size_t len,
     if (!insertBytesAfterCursor(clone, after))
         goto oopsie;
 
+    GapBuffer_moveAbsoluteRaw(clone, src->cursor);
     return clone;
 
 oopsie:
@@ -293,101 +747,115 @@ oopsie:
     return NULL;
 }
 
-PRIVATE bool isValidUTF8(const char *str, size_t len)
+bool GapBuffer_insertString(GapBuffer *buff, const char *str, size_t len)
 {
-    size_t i = 0;
-    while (i < len) {
-        uint32_t rune; // Unused
-        int n = getSymbolRune(str + i, len - i, &rune);
-        if (n < 0)
-            return false;
-        i += n;
+    if (!UTF8_isValid(str, len))
+        return false;
+
+    size_t cursor = GapBuffer_rawCursorPosition(buff);
+    size_t total  = GapBuffer_getByteCount(buff);
+    recordEdit(buff, &(GapBufferEdit) {cursor, 0, str, len}, 0, false);
+
+    bool ok;
+    if (buff->pieces)
+        ok = PieceTable_insertString(buff->pieces, str, len);
+    else {
+        moveGapToCursor(buff);
+        ok = insertBytesBeforeCursor(buff, (String) {.data=str, .size=len});
+        if (ok)
+            buff->column_target = buff->column_current;
     }
-    return true;
+    checkRecordedEdit(buff, total + len);
+    return ok;
 }
 
-bool GapBuffer_insertString(GapBuffer *buff, const char *str, size_t len)
+bool GapBuffer_insertRune(GapBuffer *gap, unsigned int code)
 {
-    if (!isValidUTF8(str, len))
-        return false;
-    bool ok = insertBytesBeforeCursor(buff, (String) {.data=str, .size=len});
-    if (ok)
-        buff->column_target = buff->column_current;
-    return ok;
+    char temp[4];
+    
+    size_t num = UTF8_encodeRune(temp, code);
+    return GapBuffer_insertString(gap, temp, num);
 }
 
-// https://stackoverflow.com/questions/42012563/convert-unicode-code-points-to-utf-8-and-utf-32
-static size_t runeToUTF8(unsigned char *const buffer, const unsigned int code)
+static char getByte(const GapBuffer *buff, size_t offset)
 {
-    if (code <= 0x7F) {
-        buffer[0] = code;
-        return 1;
-    }
-    if (code <= 0x7FF) {
-        buffer[0] = 0xC0 | (code >> 6);            /* 110xxxxx */
-        buffer[1] = 0x80 | (code & 0x3F);          /* 10xxxxxx */
-        return 2;
-    }
-    if (code <= 0xFFFF) {
-        buffer[0] = 0xE0 | (code >> 12);           /* 1110xxxx */
-        buffer[1] = 0x80 | ((code >> 6) & 0x3F);   /* 10xxxxxx */
-        buffer[2] = 0x80 | (code & 0x3F);          /* 10xxxxxx */
-        return 3;
+    if (offset >= buff->gap_offset)
+        offset += buff->gap_length;
+    return buff->data[offset];
+}
+
+/* Symbol: getTextRange
+**   Get the text between the logical offsets [lo] and [hi]
+**   as the slices that come before and after the gap. One
+**   or both of them may be empty.
+*/
+PRIVATE void getTextRange(const GapBuffer *buff, size_t lo, size_t hi,
+                          String *first, String *second)
+{
+    assert(lo <= hi);
+
+    *first  = (String) {.data=buff->data, .size=0};
+    *second = (String) {.data=buff->data, .size=0};
+
+    if (lo < buff->gap_offset) {
+        first->data = buff->data + lo;
+        first->size = MIN(hi, buff->gap_offset) - lo;
     }
-    if (code <= 0x10FFFF) {
-        buffer[0] = 0xF0 | (code >> 18);           /* 11110xxx */
-        buffer[1] = 0x80 | ((code >> 12) & 0x3F);  /* 10xxxxxx */
-        buffer[2] = 0x80 | ((code >> 6) & 0x3F);   /* 10xxxxxx */
-        buffer[3] = 0x80 | (code & 0x3F);          /* 10xxxxxx */
-        return 4;
+    if (hi > buff->gap_offset) {
+        size_t start = MAX(lo, buff->gap_offset);
+        second->data = buff->data + start + buff->gap_length;
+        second->size = hi - start;
     }
-    return 0;
 }
 
-bool GapBuffer_insertRune(GapBuffer *gap, unsigned int code)
+// Like countSymbolsAfterLastNewline, but for the text
+// between the logical offsets [lo] and [hi].
+static size_t countSymbolsAfterLastNewlineInRange(const GapBuffer *buff, size_t lo, size_t hi,
+                                                  bool *have_newline)
 {
-    char temp[4];
-    
-    size_t num = runeToUTF8((unsigned char*) temp, code);
-    return GapBuffer_insertString(gap, temp, num);
+    String first, second;
+    getTextRange(buff, lo, hi, &first, &second);
+
+    size_t count = countSymbolsAfterLastNewline(second, have_newline);
+    if (!*have_newline)
+        count += countSymbolsAfterLastNewline(first, have_newline);
+    return count;
 }
 
 /* Symbol: getPrecedingSymbol
 **
-**   Calculate the absolute byte offset of the 
-**   [num]-th unicode symbol preceding the cursor.
+**   Calculate the logical byte offset of the 
+**   [num]-th unicode symbol preceding [offset].
 **
-**   If less than [num] symbols precede the
-**   cursor, 0 is returned.
+**   If less than [num] symbols precede it,
+**   0 is returned.
 **
 ** Arguments:
 **   - buff: Reference to the gap buffer
 **
+**   - offset: Logical offset the symbols are
+**             counted from.
+**
 **   - num: Position of the unicode symbol preceding
-**          the cursor of which the offset should be
-**          returned, relative to the cursor.
+**          [offset] of which the offset should be
+**          returned, relative to [offset].
 **
 ** Notes:
 **   - It's analogous to getFollowingSymbol.
 */
-PRIVATE size_t getPrecedingSymbol(GapBuffer *buff, size_t num)
+PRIVATE size_t getPrecedingSymbol(const GapBuffer *buff, size_t offset, size_t num)
 {
-    size_t i = buff->gap_offset;
+    size_t i = offset;
 
     while (num > 0 && i > 0) {
 
         // Consume the auxiliary bytes of the
         // UTF-8 sequence (those in the form
-        // 10xxxxxx) preceding the cursor
-        do {
-            assert(i > 0); // FIXME: This triggers sometimes
+        // 10xxxxxx) preceding the offset and
+        // then its first byte.
+        do
             i--;
-            // The index can never be negative because
-            // this loop only iterates over the auxiliary
-            // bytes of a UTF-8 byte sequence. If the
-            // buffer only contains valid UTF-8, it will
-            // not underflow.
-        } while (isSymbolAuxiliaryByte(buff->data[i]));
+        while (i > 0 && isSymbolAuxiliaryByte(getByte(buff, i)));
 
         // A character was consumed.
         num--;
@@ -396,72 +864,176 @@ PRIVATE size_t getPrecedingSymbol(GapBuffer *buff, size_t num)
     return i;
 }
 
-PRIVATE size_t getSymbolLengthFromFirstByte(uint8_t first)
-{
-    // NOTE: It's assumed a valid first byte
-    if (first >= 0xf0)
-        return 4;
-    if (first >= 0xe0)
-        return 3;
-    if (first >= 0xc0)
-        return 2;
-    return 1;
-}
-
 /* Symbol: getFollowingSymbol
 **
-**   Calculate the absolute byte offset of the 
-**   [num]-th unicode symbol following the cursor.
+**   Calculate the logical byte offset of the 
+**   [num]-th unicode symbol following [offset],
+**   without going past [limit].
 **
-**   If less than [num] symbols follow the cursor, 
-**   0 is returned.
+**   If less than [num] symbols follow it, 
+**   [limit] is returned.
 **
 ** Arguments:
 **   - buff: Reference to the gap buffer
 **
+**   - offset: Logical offset the symbols are
+**             counted from.
+**
+**   - limit: Logical offset the result can't
+**            go past.
+**
 **   - num: Position of the unicode symbol following
-**          the cursor of which the offset should be
-**          returned, relative to the cursor.
+**          [offset] of which the offset should be
+**          returned, relative to [offset].
 **
 ** Notes:
 **   - It's analogous to getPrecedingSymbol.
 */
-PRIVATE size_t getFollowingSymbol(GapBuffer *buff, size_t num)
+PRIVATE size_t getFollowingSymbol(const GapBuffer *buff, size_t offset, size_t limit, size_t num)
 {
-    size_t i = buff->gap_offset + buff->gap_length;
-    while (num > 0 && i < buff->total) {
-        i += getSymbolLengthFromFirstByte(buff->data[i]);
-        num--;
-    }
-    return i;
+    String first, second;
+    getTextRange(buff, offset, limit, &first, &second);
+
+    size_t count = UTF8_countRunes(first.data, first.size);
+    if (count > num)
+        return offset + UTF8_skipRunes(first.data, first.size, num);
+    num -= count;
+
+    return offset + first.size + UTF8_skipRunes(second.data, second.size, num);
 }
 
-size_t GapBuffer_removeForwards(GapBuffer *buff, size_t num)
+static void moveGapTo(GapBuffer *buff, size_t offset)
 {
-    size_t gap_length = buff->gap_length;
-    size_t i = getFollowingSymbol(buff, num);
-    buff->gap_length = i - buff->gap_offset;
-    size_t removed = buff->gap_length - gap_length;
-    return removed;
+    if (offset < buff->gap_offset)
+        moveBytesAfterGap(buff, buff->gap_offset - offset);
+    else if (offset > buff->gap_offset)
+        moveBytesBeforeGap(buff, offset - buff->gap_offset);
 }
 
-void GapBuffer_removeForwardsRaw(GapBuffer *buff, size_t num)
+/* Symbol: moveGapToCursor
+**
+**   Move the gap where the cursor is.
+**
+**   The cursor is a logical offset and moving it doesn't
+**   move the gap, so navigating and selecting text costs
+**   no copies. The gap is only brought to the cursor when
+**   the text is edited there.
+*/
+PRIVATE void moveGapToCursor(GapBuffer *buff)
 {
-    buff->gap_length += num;
+    moveGapTo(buff, buff->cursor);
 }
 
 static void recalculateColumn(GapBuffer *buff)
 {
     bool unused;
-    buff->column_current = countSymbolsAfterLastNewline(getStringBeforeGap(buff), &unused);
+    buff->column_current = countSymbolsAfterLastNewlineInRange(buff, 0, buff->cursor, &unused);
+}
+
+/* Symbol: moveCursor
+**   Move the cursor to the logical [offset] and update the
+**   current column by only looking at the symbols between
+**   the old and new position, unless the cursor went back
+**   to a previous line.
+*/
+PRIVATE void moveCursor(GapBuffer *buff, size_t offset)
+{
+    assert(offset <= GapBuffer_getByteCount(buff));
+
+    bool have_newline;
+    if (offset > buff->cursor) {
+        size_t count = countSymbolsAfterLastNewlineInRange(buff, buff->cursor, offset, &have_newline);
+        if (have_newline)
+            buff->column_current = count;
+        else
+            buff->column_current += count;
+        buff->cursor = offset;
+    } else if (offset < buff->cursor) {
+        size_t count = countSymbolsAfterLastNewlineInRange(buff, offset, buff->cursor, &have_newline);
+        buff->cursor = offset;
+        if (have_newline)
+            recalculateColumn(buff);
+        else
+            buff->column_current -= count;
+    }
+}
+
+size_t GapBuffer_removeForwards(GapBuffer *buff, size_t num)
+{
+    if (buff->journal) {
+        size_t cursor = GapBuffer_rawCursorPosition(buff);
+        size_t end = findFollowingSymbol(buff, cursor, num);
+        size_t total = GapBuffer_getByteCount(buff);
+        recordEdit(buff, &(GapBufferEdit) {cursor, end - cursor, "", 0}, 0, false);
+        if (buff->pieces) {
+            size_t removed = PieceTable_removeForwards(buff->pieces, num);
+            checkRecordedEdit(buff, total - (end - cursor));
+            return removed;
+        }
+    }
+
+    if (buff->pieces)
+        return PieceTable_removeForwards(buff->pieces, num);
+
+    moveGapToCursor(buff);
+
+    size_t end = getFollowingSymbol(buff, buff->cursor, GapBuffer_getByteCount(buff), num);
+    size_t removed = end - buff->cursor;
+    indexBytes(buff, buff->gap_offset + buff->gap_length, removed, false);
+    buff->gap_length += removed;
+    return removed;
+}
+
+void GapBuffer_removeForwardsRaw(GapBuffer *buff, size_t num)
+{
+    if (buff->journal) {
+        size_t cursor = GapBuffer_rawCursorPosition(buff);
+        size_t total = GapBuffer_getByteCount(buff);
+        num = MIN(num, total - cursor);
+        recordEdit(buff, &(GapBufferEdit) {cursor, num, "", 0}, 0, false);
+        if (buff->pieces) {
+            PieceTable_removeForwardsRaw(buff->pieces, num);
+            checkRecordedEdit(buff, total - num);
+            return;
+        }
+    }
+
+    if (buff->pieces) {
+        PieceTable_removeForwardsRaw(buff->pieces, num);
+        return;
+    }
+
+    moveGapToCursor(buff);
+
+    indexBytes(buff, buff->gap_offset + buff->gap_length, num, false);
+    buff->gap_length += num;
 }
 
 size_t GapBuffer_removeBackwards(GapBuffer *buff, size_t num)
 {
+    if (buff->journal) {
+        size_t cursor = GapBuffer_rawCursorPosition(buff);
+        size_t start = findPrecedingSymbol(buff, cursor, num);
+        size_t total = GapBuffer_getByteCount(buff);
+        recordEdit(buff, &(GapBufferEdit) {start, cursor - start, "", 0}, 0, false);
+        if (buff->pieces) {
+            size_t removed = PieceTable_removeBackwards(buff->pieces, num);
+            checkRecordedEdit(buff, total - (cursor - start));
+            return removed;
+        }
+    }
+
+    if (buff->pieces)
+        return PieceTable_removeBackwards(buff->pieces, num);
+
+    moveGapToCursor(buff);
+
     size_t gap_length = buff->gap_length;
-    size_t i = getPrecedingSymbol(buff, num);
+    size_t i = getPrecedingSymbol(buff, buff->cursor, num);
+    indexBytes(buff, i, buff->gap_offset - i, false);
     buff->gap_length += buff->gap_offset - i;
     buff->gap_offset = i;
+    buff->cursor = i;
     
     size_t removed_bytes = buff->gap_length - gap_length;
 
@@ -474,163 +1046,427 @@ size_t GapBuffer_removeBackwards(GapBuffer *buff, size_t num)
     return removed_bytes;
 }
 
+/////////////////////////////////////////////////////////////////
+// Undo                                                        //
+/////////////////////////////////////////////////////////////////
+
+// Like getFollowingSymbol, but for both kinds of storage
+PRIVATE size_t findFollowingSymbol(GapBuffer *buff, size_t offset, size_t num)
+{
+    if (buff->pieces)
+        return PieceTable_skipForwards(buff->pieces, offset, num);
+    return getFollowingSymbol(buff, offset, GapBuffer_getByteCount(buff), num);
+}
+
+// Like getPrecedingSymbol, but for both kinds of storage
+PRIVATE size_t findPrecedingSymbol(GapBuffer *buff, size_t offset, size_t num)
+{
+    if (buff->pieces)
+        return PieceTable_skipBackwards(buff->pieces, offset, num);
+    return getPrecedingSymbol(buff, offset, num);
+}
+
+// Copy the text between the logical offsets [lo] and [hi] into [dst]
+static void copyText(GapBuffer *buff, size_t lo, size_t hi, char *dst)
+{
+    if (buff->pieces) {
+        while (lo < hi) {
+            size_t len;
+            const char *str = PieceTable_getSlice(buff->pieces, lo, &len);
+            len = MIN(len, hi - lo);
+            memcpy(dst, str, len);
+            dst += len;
+            lo += len;
+        }
+        return;
+    }
+
+    String first, second;
+    getTextRange(buff, lo, hi, &first, &second);
+    memcpy(dst, first.data, first.size);
+    memcpy(dst + first.size, second.data, second.size);
+}
+
+/* Symbol: recordEdit
+**
+**   Add [edit] to the undo journal, if there is one. It must
+**   be called before the edit is applied, since the bytes it
+**   removes are copied from the buffer.
+**
+**   The edit is recorded [shift] bytes from where it's
+**   applied, which is how edits applied in a batch are
+**   turned into a sequence of edits (see recordEdits).
+*/
+PRIVATE void recordEdit(GapBuffer *buff, const GapBufferEdit *edit, ptrdiff_t shift, bool joined)
+{
+    if (buff->journal == NULL || (edit->delete_len == 0 && edit->insert_len == 0))
+        return;
+
+    char *dst = Journal_record(buff->journal, edit->offset + shift, edit->delete_len,
+                               edit->insert, edit->insert_len,
+                               GapBuffer_rawCursorPosition(buff), joined);
+    if (dst)
+        copyText(buff, edit->offset, edit->offset + edit->delete_len, dst);
+}
+
+// Record a batch of edits as a sequence that's undone
+// and redone as a whole.
+PRIVATE void recordEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count)
+{
+    ptrdiff_t shift = 0;
+    bool joined = false;
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].delete_len == 0 && edits[i].insert_len == 0)
+            continue;
+        recordEdit(buff, &edits[i], shift, joined);
+        shift += edits[i].insert_len - edits[i].delete_len;
+        joined = true;
+    }
+}
+
+// Called after a recorded edit was applied. If it didn't
+// leave the buffer with [expected] bytes, it failed and
+// the journal doesn't describe the text anymore.
+PRIVATE void checkRecordedEdit(GapBuffer *buff, size_t expected)
+{
+    if (buff->journal && GapBuffer_getByteCount(buff) != expected)
+        Journal_clear(buff->journal);
+}
+
+PRIVATE bool checkEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count, size_t *peak);
+
+/* Symbol: replayJournal
+**   Apply the steps returned by [next] until one that isn't
+**   followed by others of the same change. Returns false if
+**   there was nothing to replay.
+**
+**   Each step is handed to [replayed], if it's not NULL,
+**   right before it's applied.
+*/
+PRIVATE bool replayJournal(GapBuffer *buff, bool (*next)(Journal*, JournalStep*),
+                           GapBufferReplayFunc replayed_func, void *data)
+{
+    Journal *journal = buff->journal;
+    if (journal == NULL)
+        return false;
+
+    // The steps themselves aren't recorded
+    buff->journal = NULL;
+
+    bool replayed = false;
+    JournalStep step;
+    while (next(journal, &step)) {
+        GapBufferEdit edit = {
+            .offset = step.offset,
+            .delete_len = step.remove_len,
+            .insert = step.insert,
+            .insert_len = step.insert_len,
+        };
+        size_t peak;
+        if (replayed_func && checkEdits(buff, &edit, 1, &peak))
+            replayed_func(data, &edit);
+        if (!GapBuffer_applyEdits(buff, &edit, 1)) {
+            Journal_clear(journal);
+            break;
+        }
+        GapBuffer_moveAbsoluteRaw(buff, step.cursor);
+        replayed = true;
+        if (!step.more)
+            break;
+    }
+
+    buff->journal = journal;
+    return replayed;
+}
+
+/* Symbol: GapBuffer_undo
+**
+**   Revert the last change recorded since undo was enabled
+**   (see GapBuffer_enableUndo). Returns false if there's
+**   nothing to undo.
+**
+**   A change is undone as a sequence of edits, which are
+**   passed to [replayed], if it's not NULL, right before
+**   each is applied, so that offsets into the text can be
+**   moved along with them.
+*/
+bool GapBuffer_undo(GapBuffer *buff, GapBufferReplayFunc replayed, void *data)
+{
+    return replayJournal(buff, Journal_undo, replayed, data);
+}
+
+/* Symbol: GapBuffer_redo
+**   Apply again the last change that was undone, unless
+**   the text was edited since then. The edits are passed
+**   to [replayed] as for GapBuffer_undo.
+*/
+bool GapBuffer_redo(GapBuffer *buff, GapBufferReplayFunc replayed, void *data)
+{
+    return replayJournal(buff, Journal_redo, replayed, data);
+}
+
+/* Symbol: checkEdits
+**   Returns true if the [edits] are sorted by offset, don't
+**   overlap, fit in the text and only insert valid UTF-8.
+**   The largest amount of bytes the text grows by at any
+**   point while applying them is stored in [peak].
+*/
+PRIVATE bool checkEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count, size_t *peak)
+{
+    size_t total = GapBuffer_getByteCount(buff);
+    size_t prev  = 0;
+    size_t added = 0;
+    size_t removed = 0;
+
+    *peak = 0;
+    for (size_t i = 0; i < count; i++) {
+        const GapBufferEdit *edit = &edits[i];
+        if (edit->offset < prev || edit->offset > total || edit->delete_len > total - edit->offset)
+            return false;
+        if (!UTF8_isValid(edit->insert, edit->insert_len))
+            return false;
+        prev = edit->offset + edit->delete_len;
+        added   += edit->insert_len;
+        removed += edit->delete_len;
+        if (added > removed)
+            *peak = MAX(*peak, added - removed);
+    }
+    return true;
+}
+
+/* Symbol: GapBuffer_applyEdits
+**
+**   Apply a batch of edits, each replacing the [delete_len]
+**   bytes at [offset] with [insert]. Offsets refer to the text
+**   before any of the edits is applied, so the edits must be
+**   sorted by offset and can't overlap. This is meant for
+**   operations that change the text in many places at once,
+**   like typing with multiple cursors or replacing all the
+**   matches of a search.
+**
+**   Applying the edits one at the time would move the gap
+**   from the start of the text to each edit, costing the
+**   whole text per edit in the worst case. Here the gap is
+**   moved to the first edit and then carried forward, so
+**   the text between edits is moved only once.
+**
+**   The cursor is moved as GapBuffer_mapOffsets describes.
+**   Returns false, leaving the text unchanged, if the edits
+**   aren't well formed or memory couldn't be allocated.
+*/
+bool GapBuffer_applyEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count)
+{
+    size_t peak;
+    if (!checkEdits(buff, edits, count, &peak))
+        return false;
+
+    if (count == 0)
+        return true;
+
+    size_t cursor = buff->cursor;
+    if (buff->pieces)
+        cursor = PieceTable_getCursor(buff->pieces);
+    GapBuffer_mapOffsets(edits, count, &cursor, 1);
+
+    if (buff->pieces) {
+        recordEdits(buff, edits, count);
+        if (!PieceTable_applyEdits(buff->pieces, edits, count)) {
+            if (buff->journal)
+                Journal_clear(buff->journal);
+            return false;
+        }
+        PieceTable_moveAbsoluteRaw(buff->pieces, cursor);
+        return true;
+    }
+
+    // The gap must be able to hold the text that's
+    // inserted before the bytes removed after it make
+    // up for it.
+    if (!growGap(buff, peak))
+        return false;
+
+    recordEdits(buff, edits, count);
+
+    moveGapTo(buff, edits[0].offset);
+    for (size_t i = 0; i < count; i++) {
+
+        const GapBufferEdit *edit = &edits[i];
+
+        // The removed bytes are the first ones after the gap
+        indexBytes(buff, buff->gap_offset + buff->gap_length, edit->delete_len, false);
+        buff->gap_length += edit->delete_len;
+
+        memcpy(buff->data + buff->gap_offset, edit->insert, edit->insert_len);
+        indexBytes(buff, buff->gap_offset, edit->insert_len, true);
+        buff->gap_offset += edit->insert_len;
+        buff->gap_length -= edit->insert_len;
+
+        // Carry the gap to the next edit
+        if (i+1 < count)
+            moveBytesBeforeGap(buff, edits[i+1].offset - edit->offset - edit->delete_len);
+    }
+
+    buff->cursor = cursor;
+    recalculateColumn(buff);
+    buff->column_target = buff->column_current;
+    return true;
+}
+
+/* Symbol: GapBuffer_mapOffsets
+**
+**   Translate the logical [offsets] from the text before the
+**   [edits] were applied to the text after, so that cursors
+**   and selections can follow the edits. The offsets must be
+**   sorted, so that they're mapped with a single walk of the
+**   edits.
+**
+**   An offset inside an edited range, or at its start, is
+**   moved after the text inserted there. This way a cursor
+**   is left after the text typed at its position.
+*/
+void GapBuffer_mapOffsets(const GapBufferEdit *edits, size_t count,
+                          size_t *offsets, size_t num_offsets)
+{
+    size_t i = 0;
+    size_t added = 0;
+    size_t removed = 0;
+    size_t prev = 0;
+    for (size_t k = 0; k < num_offsets; k++) {
+
+        size_t offset = offsets[k];
+        assert(offset >= prev);
+        prev = offset;
+
+        // Consume the edits that end before the offset, or
+        // that are followed by another edit reaching it.
+        while (i < count && (edits[i].offset + edits[i].delete_len < offset
+                         || (i+1 < count && edits[i+1].offset <= offset))) {
+            added   += edits[i].insert_len;
+            removed += edits[i].delete_len;
+            i++;
+        }
+
+        if (i < count && edits[i].offset <= offset)
+            offsets[k] = edits[i].offset + added - removed + edits[i].insert_len;
+        else
+            offsets[k] = offset + added - removed;
+    }
+}
+
 PRIVATE void moveBytesAfterGap(GapBuffer *buff, size_t num)
 {
     assert(buff->gap_offset >= num);
 
-    assert(buff->gap_offset <= buff->total);
     assert(buff->gap_offset <= buff->total);
     assert(buff->gap_offset + buff->gap_length <= buff->total); 
 
     char *src = buff->data + buff->gap_offset - num;
     char *dst = src + buff->gap_length;
 
+    indexBytes(buff, src - buff->data, num, false);
     memmove(dst, src, num);
+    indexBytes(buff, dst - buff->data, num, true);
     buff->gap_offset -= num;
-
-    // Update the cursor index
-    {
-        String dst2 = {.data=dst, .size=num};
-        bool have_newline;
-        size_t syms_after_newline = countSymbolsAfterLastNewline(dst2, &have_newline);
-        if (have_newline)
-            recalculateColumn(buff);
-        else
-            buff->column_current -= syms_after_newline;
-    }
 }
 
 PRIVATE void moveBytesBeforeGap(GapBuffer *buff, size_t num)
 {
-    assert(buff->total - buff->gap_offset - buff->gap_length >= num); // FIXME: This triggers sometimes
+    assert(buff->total - buff->gap_offset - buff->gap_length >= num);
 
-    assert(buff->gap_offset <= buff->total);
     assert(buff->gap_offset <= buff->total);
     assert(buff->gap_offset + buff->gap_length <= buff->total);
 
     char *dst = buff->data + buff->gap_offset;
     char *src = dst + buff->gap_length;
 
+    indexBytes(buff, src - buff->data, num, false);
     memmove(dst, src, num);
+    indexBytes(buff, dst - buff->data, num, true);
     buff->gap_offset += num;
-    
-    // Update the column index    
-    {
-        String dst2 = {.data=dst, .size=num};
-        bool have_newline;
-        size_t syms_after_newline = countSymbolsAfterLastNewline(dst2, &have_newline);
-        if (have_newline)
-            buff->column_current = syms_after_newline;
-        else
-            buff->column_current += syms_after_newline;
-    }
 }
 
 size_t GapBuffer_moveRelative(GapBuffer *buff, int off)
 {
-    if (off < 0) {
-        size_t i = getPrecedingSymbol(buff, -off);
-        moveBytesAfterGap(buff, buff->gap_offset - i);
-    } else {
-        size_t i = getFollowingSymbol(buff, off);
-        moveBytesBeforeGap(buff, i - buff->gap_offset - buff->gap_length);
-    }
+    if (buff->pieces)
+        return PieceTable_moveRelative(buff->pieces, off);
+
+    size_t i;
+    if (off < 0)
+        i = getPrecedingSymbol(buff, buff->cursor, -off);
+    else
+        i = getFollowingSymbol(buff, buff->cursor, GapBuffer_getByteCount(buff), off);
+    moveCursor(buff, i);
     buff->column_target = buff->column_current;
-    return buff->gap_offset;
+    return buff->cursor;
 }
 
 size_t GapBuffer_moveAbsolute(GapBuffer *buff, size_t num)
 {
-    size_t i;
-    if (buff->gap_offset > 0)
-        i = 0;
-    else
-        i = buff->gap_length;
-
-    while (num > 0 && i < buff->total) {
+    if (buff->pieces)
+        return PieceTable_moveAbsolute(buff->pieces, num);
 
-        i += getSymbolLengthFromFirstByte(buff->data[i]);
-
-        // If the cursor reached the gap, jump over it.
-        if (i == buff->gap_offset)
-            i += buff->gap_length;
-
-        num--;
-    }
-    
-    if (i <= buff->gap_offset)
-        moveBytesAfterGap(buff, buff->gap_offset - i);
-    else
-        moveBytesBeforeGap(buff, i - buff->gap_offset - buff->gap_length);
+    moveCursor(buff, getFollowingSymbol(buff, 0, GapBuffer_getByteCount(buff), num));
     buff->column_target = buff->column_current;
-    
-    return buff->gap_offset;
+    return buff->cursor;
 }
 
 void GapBuffer_moveAbsoluteRaw(GapBuffer *gap, size_t num)
 {
-    if (gap->gap_offset < num)
-        moveBytesBeforeGap(gap, num - gap->gap_offset);
-    else
-        moveBytesAfterGap(gap, gap->gap_offset - num);
+    if (gap->pieces) {
+        PieceTable_moveAbsoluteRaw(gap->pieces, num);
+        return;
+    }
+
+    moveCursor(gap, MIN(num, GapBuffer_getByteCount(gap)));
     gap->column_target = gap->column_current;
 }
 
 void GapBuffer_moveRelativeVertically(GapBuffer *buff, bool up)
 {
-    size_t cur;
-    
-    if (up) {
+    if (buff->pieces) {
+        PieceTable_moveRelativeVertically(buff->pieces, up);
+        return;
+    }
 
-        // Get to the start of the current line
-        cur = buff->gap_offset;
+    size_t line = GapBuffer_getLineIndex(buff, buff->cursor);
+    size_t target;
 
-        while (cur > 0 && buff->data[cur-1] != '\n')
-            cur--;
+    if (up) {
 
-        if (cur == 0)
+        if (line == 0)
             // There's no previous line, so we can't move up
             return;
 
-        cur--;
-        assert(buff->data[cur] == '\n');
-
-        // Now find the start of the previous line
-        while (cur > 0 && buff->data[cur-1] != '\n')
-            cur--;
+        target = line-1;
 
     } else {
 
-        // Get to the end of the current line
-        cur = (int) (buff->gap_offset + buff->gap_length);
-
-        while (cur < buff->total && buff->data[cur] != '\n')
-            cur++;
-
-        if (cur == buff->total)
+        if (line+1 == GapBuffer_getLineCount(buff))
             // It's the last line. Can't move down
             return;
 
-        assert(buff->data[cur] == '\n');
-        cur++;
-    }
-
-    // Find the byte offset of the character at the given column
-    size_t col = 0;
-    while (col < buff->column_target && cur < buff->total && buff->data[cur] != '\n') {
-        uint32_t unused;
-        cur += getSymbolRune(buff->data + cur, buff->gap_offset - cur, &unused);
-        col++;
+        target = line+1;
     }
 
-    if (up)
-        moveBytesAfterGap(buff, buff->gap_offset - cur);
+    // Find the byte offset of the character at the given column,
+    // or the end of the line if it's shorter than that.
+    size_t start = GapBuffer_getLineOffset(buff, target);
+    size_t end;
+    if (target+1 < GapBuffer_getLineCount(buff))
+        end = GapBuffer_getLineOffset(buff, target+1) - 1; // Before the newline
     else
-        moveBytesBeforeGap(buff, cur - (buff->gap_offset + buff->gap_length));
+        end = GapBuffer_getByteCount(buff);
+
+    moveCursor(buff, getFollowingSymbol(buff, start, end, buff->column_target));
 }
 
 void GapBuffer_copyDataOut(GapBuffer *gap, char *dst, size_t max)
 {
+    if (gap->pieces) {
+        PieceTable_copyDataOut(gap->pieces, dst, max);
+        return;
+    }
+
     String before = getStringBeforeGap(gap);
     String  after =  getStringAfterGap(gap);
 
@@ -662,13 +1498,48 @@ void GapBufferIter_init(GapBufferIter *iter, GapBuffer *buff)
     iter->mem = NULL;
 }
 
+void GapBufferIter_initAtLine(GapBufferIter *iter, GapBuffer *buff, size_t line)
+{
+    size_t offset = GapBuffer_getLineOffset(buff, line);
+    GapBufferIter_init(iter, buff);
+    if (buff->pieces)
+        // Piece tables are iterated by logical offset
+        iter->cur = offset;
+    else if (offset > buff->gap_offset) {
+        iter->cur = offset + buff->gap_length;
+        iter->crossed_gap = true;
+    } else
+        iter->cur = offset;
+}
+
 void GapBufferIter_free(GapBufferIter *iter)
 {
+    // Lines of piece tables that span multiple
+    // pieces are copied in [mem].
+    if (iter->mem)
+        PieceTable_freeLine(iter->mem);
     iter->mem = NULL;
 }
 
+/* Symbol: GapBufferIter_next
+**
+**   Get the next line, without its newline. Lines aren't
+**   copied: they point into the memory of the buffer and
+**   are valid until it's changed. A line that goes across
+**   the gap is returned as the two slices around it, and
+**   any other line as a single slice.
+**
+**   Lines of piece tables that span more than one piece
+**   are copied in memory owned by the iterator.
+*/
 bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
 {
+    line->str[1] = NULL;
+    line->len[1] = 0;
+
+    if (iter->buff->pieces)
+        return PieceTable_nextLine(iter->buff->pieces, &iter->cur, &line->str[0], &line->len[0], &iter->mem);
+
     iter->mem = NULL;
 
     size_t i = iter->cur;
@@ -679,8 +1550,7 @@ bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
     if (iter->crossed_gap) {
         
         size_t line_offset = iter->cur;
-        while (i < total && data[i] != '\n')
-            i++;
+        i += Newline_find(data + i, total - i);
         size_t line_length = i - line_offset;
 
         if (i < total)
@@ -690,14 +1560,13 @@ bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
                 return false;
         }
 
-        line->str = data + line_offset;
-        line->len = line_length;
+        line->str[0] = data + line_offset;
+        line->len[0] = line_length;
     
     } else {
 
         size_t line_offset = i;
-        while (i < gap_offset && data[i] != '\n')
-            i++;
+        i += Newline_find(data + i, gap_offset - i);
         size_t line_length = i - line_offset;
 
         if (i == gap_offset) {
@@ -705,8 +1574,7 @@ bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
             i += iter->buff->gap_length;
 
             size_t line_offset_2 = i;
-            while (i < total && data[i] != '\n')
-                i++;
+            i += Newline_find(data + i, total - i);
             size_t line_length_2 = i - line_offset_2;
 
             if (i < total)
@@ -718,28 +1586,22 @@ bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
 
             iter->crossed_gap = true;
 
-            if (line_length + line_length_2 > sizeof(iter->maybe)) {
-                // Line will be truncated
-                if (line_length > sizeof(iter->maybe))
-                    memcpy(iter->maybe, data + line_offset, sizeof(iter->maybe));
-                else {
-                    memcpy(iter->maybe,               data + line_offset,   line_length);
-                    memcpy(iter->maybe + line_offset, data + line_offset_2, sizeof(iter->maybe) - line_length);
-                }
-                line->str = iter->maybe;
-                line->len = line_length + line_length_2;
+            // A line that starts at the gap doesn't go across it
+            if (line_length == 0) {
+                line->str[0] = data + line_offset_2;
+                line->len[0] = line_length_2;
             } else {
-                memcpy(iter->maybe,               data + line_offset,   line_length);
-                memcpy(iter->maybe + line_length, data + line_offset_2, line_length_2);
-                line->str = iter->maybe;
-                line->len = line_length + line_length_2;
+                line->str[0] = data + line_offset;
+                line->len[0] = line_length;
+                line->str[1] = data + line_offset_2;
+                line->len[1] = line_length_2;
             }
 
         } else {
             i++; // Consume "\n"
 
-            line->str = data + line_offset;
-            line->len = line_length;
+            line->str[0] = data + line_offset;
+            line->len[0] = line_length;
         }
     }
     iter->cur = i;
@@ -748,90 +1610,334 @@ bool GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line)
 
 #ifndef GAPBUFFER_NOIO
 #include <stdio.h>
-bool GapBuffer_insertFile(GapBuffer *gap, const char *file)
+#ifdef GAPBUFFER_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+/* Symbol: validateAndIndexBytes
+**
+**   Check that the [len] bytes at physical offset [offset]
+**   are valid UTF-8 and add them to the line index. This is
+**   done in a single pass over blocks small enough to still
+**   be in cache when they are indexed after validation.
+**
+**   If the bytes aren't valid UTF-8, false is returned and
+**   the line index is left untouched.
+*/
+PRIVATE bool validateAndIndexBytes(GapBuffer *buff, size_t offset, size_t len)
 {
-    FILE *stream = fopen(file, "rb");
-    if (stream == NULL)
-        return false;
+    const size_t block = 1 << 16;
+    const char *str = buff->data + offset;
+
+    size_t i = 0;
+    while (i < len) {
+
+        size_t end = MIN(i + block, len);
 
-    char buffer[1024];
-    for (bool done = false; !done;) {
-        size_t num = fread(buffer, 1, sizeof(buffer), stream);
-        if (num < sizeof(buffer)) {
-            if (ferror(stream))
-                goto ouch; // Failed to read from stream
-            done = true;
+        // Don't split a multi-byte symbol between two blocks
+        size_t back = 0;
+        while (end < len && back < 3 && isSymbolAuxiliaryByte(str[end - back]))
+            back++;
+        if (back < end - i)
+            end -= back;
+
+        if (!UTF8_isValid(str + i, end - i)) {
+            indexBytes(buff, offset, i, false);
+            return false;
         }
-        bool ok = GapBuffer_insertString(gap, buffer, num);
-        if (!ok)
-            // NOTE: It's possible to have a failure because
-            //       the buffer doesn't contain valid utf-8
-            //       when a multi-byte symbol is truncated
-            //       while reading into the fixed-size buffer.
-            goto ouch; // File too big or invalid utf-8
+        indexBytes(buff, offset + i, end - i, true);
+        i = end;
     }
-    GapBuffer_moveAbsolute(gap, 0);
-
-    fclose(stream);
     return true;
+}
 
-ouch:
-    fclose(stream);
-    return false;
+/* Symbol: reserveBytesAfterCursor
+**   Make room for [len] bytes after the cursor and return
+**   a pointer to where they need to be written, or NULL if
+**   the buffer couldn't grow. The bytes are only part of
+**   the text once they are committed.
+*/
+PRIVATE char *reserveBytesAfterCursor(GapBuffer *buff, size_t len)
+{
+    if (!growGap(buff, len))
+        return NULL;
+    return buff->data + buff->gap_offset + buff->gap_length - len;
 }
 
-bool GapBuffer_saveTo(GapBuffer *gap, const char *file)
+PRIVATE bool commitBytesAfterCursor(GapBuffer *buff, size_t len)
 {
-    FILE *stream = fopen(file, "wb");
-    if (stream == NULL)
+    if (!validateAndIndexBytes(buff, buff->gap_offset + buff->gap_length - len, len))
         return false;
+    buff->gap_length -= len;
+    return true;
+}
 
-    String before = getStringBeforeGap(gap);
-    fwrite(before.data, 1, before.size, stream);
-    if (ferror(stream)) {
-        fclose(stream);
+#ifdef GAPBUFFER_MMAP
+/* Symbol: mapFile
+**
+**   Map the file [fd] of [size] bytes in memory and make it
+**   the text of an empty buffer. The file is mapped right
+**   after a page-aligned gap, which is itself an anonymous
+**   mapping, so no byte is copied when loading. Pages of the
+**   file are only copied by the kernel when they're written
+**   to, which happens when the gap is moved over them.
+**
+**   The file must not be truncated by other programs while
+**   it's mapped. Saving is done by writing a new file and
+**   renaming it, which leaves the mapped one untouched.
+*/
+PRIVATE bool mapFile(GapBuffer *buff, int fd, size_t size)
+{
+    assert(GapBuffer_getByteCount(buff) == 0);
+
+    size_t gap_len = roundUpToPageSize(GAPBUFFER_MMAP_THRESHOLD);
+    size_t map_len = gap_len + roundUpToPageSize(size);
+
+    char *data = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    if (mmap(data + gap_len, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, map_len);
         return false;
     }
 
-    String after = getStringAfterGap(gap);
-    fwrite(after.data, 1, after.size, stream);
-    if (ferror(stream)) {
-        fclose(stream);
+    char   *old_data    = buff->data;
+    Storage old_storage = buff->storage;
+    size_t  old_total   = buff->total;
+
+    buff->data = data;
+    buff->storage = STORAGE_FILE;
+    buff->gap_offset = 0;
+    buff->gap_length = gap_len;
+    buff->total = gap_len + size;
+    resizeLineIndex(buff);
+
+    if (!validateAndIndexBytes(buff, gap_len, size)) {
+        munmap(data, map_len);
+        buff->data = old_data;
+        buff->storage = old_storage;
+        buff->gap_length = old_total;
+        buff->total = old_total;
+        resizeLineIndex(buff);
         return false;
     }
-    fclose(stream);    
+
+    releaseData(old_data, old_storage, old_total);
     return true;
 }
 #endif
 
+/* Symbol: GapBuffer_insertFile
+**
+**   Insert the contents of [file] at the cursor, then move
+**   the cursor to the start of the buffer.
+**
+**   The file is placed after the gap with one bulk copy (or
+**   read) and validated and indexed in a single pass. Big
+**   files loaded into empty buffers aren't copied at all:
+**   they are mapped in memory and used as backing store.
+**
+**   Returns false if the file couldn't be read, isn't
+**   valid UTF-8 or the buffer couldn't grow. In that case
+**   the buffer is left untouched.
+*/
+bool GapBuffer_insertFile(GapBuffer *gap, const char *file)
+{
+    // Files aren't recorded since they can be huge, so
+    // the history before them can't be undone anymore.
+    if (gap->journal)
+        Journal_clear(gap->journal);
+
+    if (gap->pieces)
+        return PieceTable_insertFile(gap->pieces, file);
+
+    // The file is placed after the cursor
+    moveGapToCursor(gap);
+
+    bool ok = false;
+
+#ifdef GAPBUFFER_MMAP
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+
+    if (size == 0)
+        ok = true;
+    else if (size >= GAPBUFFER_MMAP_THRESHOLD && GapBuffer_getByteCount(gap) == 0)
+        ok = mapFile(gap, fd, size);
+    else {
+        void *src = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (src != MAP_FAILED) {
+            char *dst = reserveBytesAfterCursor(gap, size);
+            if (dst) {
+                memcpy(dst, src, size);
+                ok = commitBytesAfterCursor(gap, size);
+            }
+            munmap(src, size);
+        }
+    }
+    close(fd);
+#else
+    FILE *stream = fopen(file, "rb");
+    if (stream == NULL)
+        return false;
+
+    long size = -1;
+    if (!fseek(stream, 0, SEEK_END)) {
+        size = ftell(stream);
+        if (fseek(stream, 0, SEEK_SET))
+            size = -1;
+    }
+
+    if (size >= 0) {
+        char *dst = reserveBytesAfterCursor(gap, size);
+        if (dst && fread(dst, 1, size, stream) == (size_t) size)
+            ok = commitBytesAfterCursor(gap, size);
+    }
+    fclose(stream);
+#endif
+
+    if (ok)
+        GapBuffer_moveAbsolute(gap, 0);
+    return ok;
+}
+
+/* Symbol: GapBuffer_saveTo
+**   Replace [file] with the text, writing the slices before
+**   and after the gap with a single system call and without
+**   copying them (see save.c).
+*/
+bool GapBuffer_saveTo(GapBuffer *gap, const char *file)
+{
+    if (gap->pieces)
+        return PieceTable_saveTo(gap->pieces, file);
+
+    String before = getStringBeforeGap(gap);
+    String after  = getStringAfterGap(gap);
+    SaveSlice slices[] = {
+        {.data=before.data, .size=before.size},
+        {.data=after.data,  .size=after.size},
+    };
+    return Save_writeSlices(file, slices, 2);
+}
+
+bool GapBufferSnapshot_saveTo(GapBufferSnapshot *snap, const char *file)
+{
+    if (snap->pieces)
+        return PieceTableSnapshot_saveTo(snap->pieces, file);
+
+    SaveSlice slice = {.data=snap->copy, .size=snap->size};
+    return Save_writeSlices(file, &slice, 1);
+}
+#endif
+
 #ifndef GAPBUFFER_NOMALLOC
-#include <stdlib.h>
 GapBuffer *GapBuffer_create(size_t capacity)
 {
     size_t len = sizeof(GapBuffer) + capacity;
     void  *mem = malloc(len);
     return GapBuffer_createUsingMemory(mem, len, free);
 }
-bool GapBuffer_insertStringMaybeRelocate(GapBuffer **buff, const char *str, size_t len)
+
+/* Symbol: GapBuffer_createPieceTable
+**   Create a buffer that stores its text in a piece table
+**   instead of a gap. It's meant for huge files, which are
+**   mapped in memory instead of being loaded (see piece_table.c).
+*/
+GapBuffer *GapBuffer_createPieceTable(void)
 {
-    if (!GapBuffer_insertString(*buff, str, len)) {
-        // Need to relocate
-        GapBuffer *buff2 = GapBuffer_create(GapBuffer_getByteCount(*buff) + len);
-        if (buff2 == NULL)
-            return false; // Failed to create new location
+    GapBuffer *buff = GapBuffer_create(0);
+    if (buff == NULL)
+        return NULL;
 
-        if (!GapBuffer_insertString(buff2, str, len)) {
-            // Insertion failed unexpectedly. The gap was created
-            // with enough free memory to hold the new text..
-            GapBuffer_destroy(buff2);
-            return false;
+    buff->pieces = PieceTable_create();
+    if (buff->pieces == NULL) {
+        GapBuffer_destroy(buff);
+        return NULL;
+    }
+    return buff;
+}
+/* Symbol: GapBuffer_enableUndo
+**   Start recording the edits so that they can be undone.
+**   At most [memory_limit] bytes of history are kept in
+**   memory, the rest goes to a temporary file.
+*/
+bool GapBuffer_enableUndo(GapBuffer *buff, size_t memory_limit)
+{
+    if (buff->journal == NULL)
+        buff->journal = Journal_create(memory_limit);
+    return buff->journal != NULL;
+}
+
+/* Symbol: GapBuffer_snapshot
+**
+**   Take an immutable copy of the text, which other threads
+**   can read (to save it, for instance) while the buffer is
+**   edited. Returns NULL if memory couldn't be allocated.
+**
+**   Piece tables share with the snapshot the file they were
+**   loaded from, so only the text inserted since then is
+**   copied. Gap buffers are copied whole with two memcpys,
+**   which for the sizes they're used for is cheap.
+**
+**   Snapshots must be freed by the thread that edits the
+**   buffer.
+*/
+GapBufferSnapshot *GapBuffer_snapshot(GapBuffer *buff)
+{
+    GapBufferSnapshot *snap = malloc(sizeof(GapBufferSnapshot));
+    if (snap == NULL)
+        return NULL;
+    snap->copy = NULL;
+    snap->size = 0;
+    snap->pieces = NULL;
+
+    if (buff->pieces) {
+        snap->pieces = PieceTable_snapshot(buff->pieces);
+        if (snap->pieces == NULL) {
+            free(snap);
+            return NULL;
         }
+        return snap;
+    }
 
-        // Swap the parent buffer with the new one
-        GapBuffer_destroy(*buff);
-        *buff = buff2;
+    String before = getStringBeforeGap(buff);
+    String after  = getStringAfterGap(buff);
+    snap->size = before.size + after.size;
+    snap->copy = malloc(MAX(snap->size, 1));
+    if (snap->copy == NULL) {
+        free(snap);
+        return NULL;
     }
+    memcpy(snap->copy, before.data, before.size);
+    memcpy(snap->copy + before.size, after.data, after.size);
+    return snap;
+}
 
-    return true;
+void GapBufferSnapshot_free(GapBufferSnapshot *snap)
+{
+    if (snap->pieces)
+        PieceTableSnapshot_free(snap->pieces);
+    free(snap->copy);
+    free(snap);
+}
+
+/* Symbol: GapBuffer_insertStringMaybeRelocate
+**   Kept for compatibility. Buffers grow in place when
+**   the gap is exhausted, so the buffer is never relocated
+**   and this is equivalent to GapBuffer_insertString.
+*/
+bool GapBuffer_insertStringMaybeRelocate(GapBuffer **buff, const char *str, size_t len)
+{
+    return GapBuffer_insertString(*buff, str, len);
 }
 #endif
\ No newline at end of file
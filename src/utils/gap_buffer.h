@@ -5,20 +5,32 @@
 #include <stdbool.h>
 
 typedef struct GapBuffer GapBuffer;
+typedef struct GapBufferSnapshot GapBufferSnapshot;
 
 typedef struct {
     GapBuffer *buff;
     bool crossed_gap;
     size_t cur;
     void *mem;
-    char maybe[512];
 } GapBufferIter;
 
+// A line is returned as the part of it before the gap
+// and the part after it. Only lines that go across the
+// gap have a second part.
 typedef struct {
-    const char *str;
-    size_t len;
+    const char *str[2];
+    size_t      len[2];
 } GapBufferLine;
 
+typedef struct {
+    size_t offset;
+    size_t delete_len;
+    const char *insert;
+    size_t insert_len;
+} GapBufferEdit;
+
+typedef void (*GapBufferReplayFunc)(void *data, const GapBufferEdit *edit);
+
 GapBuffer *GapBuffer_createUsingMemory(void *mem, size_t len, void (*free)(void*));
 GapBuffer *GapBuffer_cloneUsingMemory(void *mem, size_t len, void (*free)(void*), const GapBuffer *src);
 void       GapBuffer_whipeClean(GapBuffer *gap);
@@ -33,22 +45,35 @@ void       GapBuffer_moveAbsoluteRaw(GapBuffer *gap, size_t num);
 size_t     GapBuffer_removeForwards(GapBuffer *buff, size_t num);
 void       GapBuffer_removeForwardsRaw(GapBuffer *buff, size_t num);
 size_t     GapBuffer_removeBackwards(GapBuffer *buff, size_t num);
+bool       GapBuffer_applyEdits(GapBuffer *buff, const GapBufferEdit *edits, size_t count);
+void       GapBuffer_mapOffsets(const GapBufferEdit *edits, size_t count, size_t *offsets, size_t num_offsets);
+bool       GapBuffer_undo(GapBuffer *buff, GapBufferReplayFunc replayed, void *data);
+bool       GapBuffer_redo(GapBuffer *buff, GapBufferReplayFunc replayed, void *data);
 size_t     GapBuffer_getByteCount(GapBuffer *buff);
 size_t     GapBuffer_getColumn(GapBuffer *gap);
 size_t     GapBuffer_getTargetColumn(GapBuffer *gap);
 size_t     GapBuffer_rawCursorPosition(GapBuffer *buff);
+size_t     GapBuffer_getLineCount(GapBuffer *buff);
+size_t     GapBuffer_getLineOffset(GapBuffer *buff, size_t line);
+size_t     GapBuffer_getLineIndex(GapBuffer *buff, size_t offset);
 void       GapBufferIter_init(GapBufferIter *iter, GapBuffer *buff);
+void       GapBufferIter_initAtLine(GapBufferIter *iter, GapBuffer *buff, size_t line);
 void       GapBufferIter_free(GapBufferIter *iter);
 bool       GapBufferIter_next(GapBufferIter *iter, GapBufferLine *line);
 
 #ifndef GAPBUFFER_NOMALLOC
 GapBuffer *GapBuffer_create(size_t capacity);
+GapBuffer *GapBuffer_createPieceTable(void);
+bool       GapBuffer_enableUndo(GapBuffer *buff, size_t memory_limit);
+GapBufferSnapshot *GapBuffer_snapshot(GapBuffer *buff);
+void               GapBufferSnapshot_free(GapBufferSnapshot *snap);
 bool       GapBuffer_insertStringMaybeRelocate(GapBuffer **buff, const char *str, size_t len);
 #endif
 
 #ifndef GAPBUFFER_NOIO
 bool GapBuffer_insertFile(GapBuffer *gap, const char *file);
 bool GapBuffer_saveTo(GapBuffer *gap, const char *file);
+bool GapBufferSnapshot_saveTo(GapBufferSnapshot *snap, const char *file);
 #endif
 
 #endif
\ No newline at end of file
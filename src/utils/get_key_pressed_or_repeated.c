@@ -56,4 +56,11 @@ int GetKeyPressedOrRepeated(int *repeat, int repeat_freq_us, int first_repeat_fr
         }
     }
     return key;
-}
\ No newline at end of file
+}
+// Returns true while keys that were pressed may still
+// repeat, which needs GetKeyPressedOrRepeated to be
+// called even if no input comes in.
+bool IsKeyRepeatPending(void)
+{
+    return num_pressed_keys > 0;
+}
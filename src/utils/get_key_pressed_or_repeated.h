@@ -1,2 +1,4 @@
+#include <stdbool.h>
 
-int GetKeyPressedOrRepeated(int *repeat, int repeat_freq_us, int first_repeat_freq_us);
\ No newline at end of file
+int GetKeyPressedOrRepeated(int *repeat, int repeat_freq_us, int first_repeat_freq_us);
+bool IsKeyRepeatPending(void);
\ No newline at end of file
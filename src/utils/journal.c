@@ -0,0 +1,422 @@
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "journal.h"
+
+/* Journal
+**
+**   The undo history of a buffer, stored as a log of the
+**   edits that were applied to it. Each record holds the
+**   position of the edit, the bytes it removed and the bytes
+**   it inserted, so undoing or redoing an edit costs as much
+**   as the edit itself. Records are laid out as
+**
+**     [header][removed bytes][inserted bytes][record size]
+**
+**   The size at the end allows walking the log backwards.
+**
+**   Consecutive edits that are part of the same run of
+**   typing or deleting are merged into a single record, so
+**   that they're undone together and the log doesn't hold a
+**   header per character.
+**
+**   Only the newest part of the log is kept in memory. When
+**   it grows past the memory limit, older records are moved
+**   to a temporary file, from where they're read back if the
+**   history is walked that far. If the file can't be used,
+**   the old records are forgotten instead.
+*/
+
+#ifdef GAPBUFFER_DEBUG
+#define PRIVATE
+#else
+#define PRIVATE static
+#endif
+
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+#define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
+
+// Records aren't merged past this size, which bounds the
+// cost of making room at the start of a record when a run
+// of backspaces is merged.
+#define JOURNAL_MERGE_LIMIT 1024
+
+// The record belongs to the same change as the previous one
+#define RECORD_JOINED 1
+
+#define NO_RECORD UINT64_MAX
+
+#ifndef GAPBUFFER_NOIO
+#include <stdio.h>
+#ifdef _WIN32
+#define fseeko _fseeki64
+#endif
+#endif
+
+typedef struct {
+    uint64_t offset;
+    uint64_t removed;
+    uint64_t inserted;
+    uint64_t cursor; // Before the edit
+    uint64_t flags;
+} Header;
+
+typedef uint64_t Footer;
+
+struct Journal {
+
+    // Positions in the log. Records between [start] and
+    // [current] can be undone, the ones between [current]
+    // and [end] can be redone.
+    uint64_t start;
+    uint64_t current;
+    uint64_t end;
+
+    // Position of the newest record, which may be
+    // extended by the following edit, or NO_RECORD.
+    uint64_t last;
+
+    // The log from [base] to [end] is in memory. What
+    // comes before it is in [file].
+    uint64_t base;
+    char    *data;
+    size_t   capacity;
+    size_t   limit;
+#ifndef GAPBUFFER_NOIO
+    FILE    *file;
+#endif
+
+    // Holds the text of the last step read from the log
+    char    *scratch;
+    size_t   scratch_capacity;
+};
+
+Journal *Journal_create(size_t memory_limit)
+{
+    Journal *journal = malloc(sizeof(Journal));
+    if (journal == NULL)
+        return NULL;
+    memset(journal, 0, sizeof(Journal));
+    journal->last = NO_RECORD;
+    journal->limit = memory_limit;
+    return journal;
+}
+
+void Journal_destroy(Journal *journal)
+{
+#ifndef GAPBUFFER_NOIO
+    if (journal->file)
+        fclose(journal->file);
+#endif
+    free(journal->data);
+    free(journal->scratch);
+    free(journal);
+}
+
+void Journal_clear(Journal *journal)
+{
+    // The temporary file and the memory are kept
+    // around, they'll be overwritten.
+    journal->start = 0;
+    journal->current = 0;
+    journal->end = 0;
+    journal->base = 0;
+    journal->last = NO_RECORD;
+}
+
+static size_t getRecordSize(const Header *header)
+{
+    return sizeof(Header) + header->removed + header->inserted + sizeof(Footer);
+}
+
+static bool reserveMemory(Journal *journal, size_t num)
+{
+    size_t used = journal->end - journal->base;
+    if (used + num <= journal->capacity)
+        return true;
+
+    size_t capacity = MAX(used + num, MAX(2 * journal->capacity, (size_t) 1 << 12));
+    char *data = realloc(journal->data, capacity);
+    if (data == NULL)
+        return false;
+    journal->data = data;
+    journal->capacity = capacity;
+    return true;
+}
+
+static bool reserveScratch(Journal *journal, size_t num)
+{
+    if (num <= journal->scratch_capacity)
+        return true;
+
+    char *scratch = realloc(journal->scratch, num);
+    if (scratch == NULL)
+        return false;
+    journal->scratch = scratch;
+    journal->scratch_capacity = num;
+    return true;
+}
+
+/* Symbol: readLog
+**   Copy [len] bytes at position [pos] of the log into
+**   [dst]. The range must be either all in memory or all
+**   in the file, which holds since the log is only moved
+**   to the file one record at the time.
+*/
+PRIVATE bool readLog(Journal *journal, uint64_t pos, void *dst, size_t len)
+{
+    if (pos >= journal->base) {
+        assert(pos + len <= journal->end);
+        memcpy(dst, journal->data + (pos - journal->base), len);
+        return true;
+    }
+
+    assert(pos + len <= journal->base);
+#ifdef GAPBUFFER_NOIO
+    return false;
+#else
+    if (journal->file == NULL || fseeko(journal->file, pos, SEEK_SET))
+        return false;
+    return fread(dst, 1, len, journal->file) == len;
+#endif
+}
+
+/* Symbol: spillOldRecords
+**   Move the records that come before the newest one from
+**   memory to the temporary file, or forget them if that
+**   isn't possible.
+*/
+PRIVATE void spillOldRecords(Journal *journal)
+{
+    assert(journal->last != NO_RECORD && journal->last >= journal->base);
+
+    size_t num = journal->last - journal->base;
+    if (num == 0)
+        return;
+
+    bool spilled = false;
+#ifndef GAPBUFFER_NOIO
+    if (journal->file == NULL)
+        journal->file = tmpfile();
+    if (journal->file && !fseeko(journal->file, journal->base, SEEK_SET))
+        spilled = fwrite(journal->data, 1, num, journal->file) == num
+               && fflush(journal->file) == 0;
+#endif
+    if (!spilled)
+        journal->start = MAX(journal->start, journal->last);
+
+    memmove(journal->data, journal->data + num, journal->end - journal->last);
+    journal->base = journal->last;
+}
+
+// Drop the records that can be redone
+static void dropRedoRecords(Journal *journal)
+{
+    if (journal->current == journal->end)
+        return;
+
+    if (journal->current < journal->base)
+        // The file past this point will be overwritten
+        journal->base = journal->current;
+    journal->end = journal->current;
+    journal->last = NO_RECORD;
+}
+
+static char *getRecordData(Journal *journal, uint64_t pos)
+{
+    assert(pos >= journal->base);
+    return journal->data + (pos - journal->base);
+}
+
+// Returns true if the edit described by the arguments
+// can be merged into the newest record, which is stored
+// in [header].
+static bool canMergeIntoLastRecord(Journal *journal, size_t offset, size_t removed,
+                                   size_t inserted_len, bool joined, Header *header)
+{
+    if (joined || journal->last == NO_RECORD || journal->last < journal->base)
+        return false;
+
+    char *record = getRecordData(journal, journal->last);
+    memcpy(header, record, sizeof(Header));
+
+    if (header->flags & RECORD_JOINED)
+        return false;
+
+    if (header->removed + header->inserted + removed + inserted_len > JOURNAL_MERGE_LIMIT)
+        return false;
+
+    if (removed == 0 && header->removed == 0) {
+        // Typing. Newlines end the run, so that a change
+        // doesn't span more than one line.
+        const char *text = record + sizeof(Header);
+        return inserted_len > 0 && header->inserted > 0
+            && offset == header->offset + header->inserted
+            && text[header->inserted-1] != '\n';
+    }
+
+    if (inserted_len == 0 && header->inserted == 0)
+        // Deleting forwards (at the same offset)
+        // or backwards (right before it).
+        return offset == header->offset || offset + removed == header->offset;
+
+    return false;
+}
+
+/* Symbol: Journal_record
+**
+**   Add to the journal an edit that replaces [removed] bytes
+**   at [offset] with [inserted], made while the cursor was at
+**   [cursor]. If [joined] is true, the edit is undone and
+**   redone together with the previous one.
+**
+**   Returns where the caller must copy the removed bytes, or
+**   NULL if the edit couldn't be recorded, in which case the
+**   journal is cleared since it no longer describes how to
+**   get back to the previous states of the text.
+**
+**   Recording an edit drops the edits that could be redone.
+*/
+char *Journal_record(Journal *journal, size_t offset, size_t removed,
+                     const char *inserted, size_t inserted_len,
+                     size_t cursor, bool joined)
+{
+    dropRedoRecords(journal);
+
+    Header header;
+    size_t removed_pos; // Relative to the record
+
+    if (canMergeIntoLastRecord(journal, offset, removed, inserted_len, joined, &header)) {
+
+        if (!reserveMemory(journal, removed + inserted_len)) {
+            Journal_clear(journal);
+            return NULL;
+        }
+
+        char *text = getRecordData(journal, journal->last) + sizeof(Header);
+        if (removed > 0 && offset < header.offset) {
+            // Backspace. The bytes go before the ones
+            // that were removed already.
+            memmove(text + removed, text, header.removed);
+            removed_pos = sizeof(Header);
+            header.offset = offset;
+        } else
+            removed_pos = sizeof(Header) + header.removed;
+
+        memcpy(text + header.removed + removed + header.inserted, inserted, inserted_len);
+        header.removed  += removed;
+        header.inserted += inserted_len;
+
+    } else {
+
+        header = (Header) {
+            .offset = offset,
+            .removed = removed,
+            .inserted = inserted_len,
+            .cursor = cursor,
+            .flags = joined ? RECORD_JOINED : 0,
+        };
+        if (!reserveMemory(journal, getRecordSize(&header))) {
+            Journal_clear(journal);
+            return NULL;
+        }
+
+        journal->last = journal->end;
+        char *text = getRecordData(journal, journal->last) + sizeof(Header);
+        memcpy(text + removed, inserted, inserted_len);
+        removed_pos = sizeof(Header);
+    }
+
+    Footer size = getRecordSize(&header);
+    char *record = getRecordData(journal, journal->last);
+    memcpy(record, &header, sizeof(Header));
+    memcpy(record + size - sizeof(Footer), &size, sizeof(Footer));
+    journal->end = journal->last + size;
+    journal->current = journal->end;
+
+    if (journal->end - journal->base > journal->limit)
+        spillOldRecords(journal);
+    return getRecordData(journal, journal->last) + removed_pos;
+}
+
+// Read the record at [pos] and put in the scratch
+// memory the text it removed, if [removed] is true,
+// or the text it inserted.
+static bool readRecord(Journal *journal, uint64_t pos, Header *header, bool removed)
+{
+    if (!readLog(journal, pos, header, sizeof(Header)))
+        return false;
+
+    size_t len  = removed ? header->removed : header->inserted;
+    size_t skip = removed ? 0 : header->removed;
+    return reserveScratch(journal, MAX(len, 1))
+        && readLog(journal, pos + sizeof(Header) + skip, journal->scratch, len);
+}
+
+/* Symbol: Journal_undo
+**
+**   Store in [step] the edit that reverts the newest record
+**   that wasn't undone yet and move before it. If [more] is
+**   set in the step, the following step must be reverted
+**   too. Returns false if there's nothing to undo.
+**
+**   The text of the step is valid until the journal is used
+**   again.
+*/
+bool Journal_undo(Journal *journal, JournalStep *step)
+{
+    if (journal->current == journal->start)
+        return false;
+
+    Footer size;
+    Header header;
+    if (!readLog(journal, journal->current - sizeof(Footer), &size, sizeof(Footer)))
+        return false;
+    uint64_t pos = journal->current - size;
+    if (!readRecord(journal, pos, &header, true))
+        return false;
+
+    step->offset = header.offset;
+    step->remove_len = header.inserted;
+    step->insert = journal->scratch;
+    step->insert_len = header.removed;
+    step->cursor = header.cursor;
+    step->more = header.flags & RECORD_JOINED;
+
+    // Edits made after an undo start a new record
+    journal->current = pos;
+    journal->last = NO_RECORD;
+    return true;
+}
+
+/* Symbol: Journal_redo
+**   Like Journal_undo, but stores in [step] the edit of the
+**   oldest record that was undone and moves after it.
+*/
+bool Journal_redo(Journal *journal, JournalStep *step)
+{
+    if (journal->current == journal->end)
+        return false;
+
+    Header header;
+    if (!readRecord(journal, journal->current, &header, false))
+        return false;
+
+    step->offset = header.offset;
+    step->remove_len = header.removed;
+    step->insert = journal->scratch;
+    step->insert_len = header.inserted;
+    step->cursor = header.offset + header.inserted;
+    step->more = false;
+
+    journal->current += getRecordSize(&header);
+    journal->last = NO_RECORD;
+
+    if (journal->current < journal->end) {
+        Header next;
+        if (readLog(journal, journal->current, &next, sizeof(Header)))
+            step->more = next.flags & RECORD_JOINED;
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct Journal Journal;
+
+typedef struct {
+    size_t offset;
+    size_t remove_len;
+    const char *insert;
+    size_t insert_len;
+    size_t cursor;
+    bool more;
+} JournalStep;
+
+Journal *Journal_create(size_t memory_limit);
+void     Journal_destroy(Journal *journal);
+void     Journal_clear(Journal *journal);
+char    *Journal_record(Journal *journal, size_t offset, size_t removed,
+                        const char *inserted, size_t inserted_len,
+                        size_t cursor, bool joined);
+bool     Journal_undo(Journal *journal, JournalStep *step);
+bool     Journal_redo(Journal *journal, JournalStep *step);
+
+#endif
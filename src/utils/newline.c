@@ -0,0 +1,240 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "simd.h"
+#include "newline.h"
+
+/////////////////////////////////////////////////////////////////
+// Scalar kernels                                              //
+/////////////////////////////////////////////////////////////////
+
+static size_t findLastScalar(const char *str, size_t len)
+{
+    size_t i = len;
+    while (i > 0) {
+        i--;
+        if (str[i] == '\n')
+            return i;
+    }
+    return len;
+}
+
+static size_t findNthScalar(const char *str, size_t len, size_t *nth)
+{
+    for (size_t i = 0; i < len; i++)
+        if (str[i] == '\n' && --*nth == 0)
+            return i;
+    return len;
+}
+
+static size_t countScalar(const char *str, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        if (str[i] == '\n')
+            count++;
+    return count;
+}
+
+// Returns the position of the [nth] bit set in [mask],
+// which is assumed to have at least [nth] bits set.
+static int nthBitSet(uint32_t mask, size_t nth)
+{
+    while (--nth > 0)
+        mask &= mask - 1; // Drop the lowest set bit
+    return __builtin_ctz(mask);
+}
+
+#ifdef SIMD_X86
+
+/////////////////////////////////////////////////////////////////
+// SSE2 kernels                                                //
+/////////////////////////////////////////////////////////////////
+
+TARGET_SSE2 static uint32_t newlineMaskSSE2(const char *str)
+{
+    __m128i block = _mm_loadu_si128((const __m128i*) str);
+    __m128i match = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+    return (uint32_t) _mm_movemask_epi8(match);
+}
+
+TARGET_SSE2 static size_t findLastSSE2(const char *str, size_t len)
+{
+    size_t i = len;
+    while (i >= 16) {
+        i -= 16;
+        uint32_t mask = newlineMaskSSE2(str + i);
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    size_t k = findLastScalar(str, i);
+    return k < i ? k : len;
+}
+
+TARGET_SSE2 static size_t findNthSSE2(const char *str, size_t len, size_t *nth)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint32_t mask = newlineMaskSSE2(str + i);
+        size_t count = __builtin_popcount(mask);
+        if (count >= *nth) {
+            size_t k = i + nthBitSet(mask, *nth);
+            *nth = 0;
+            return k;
+        }
+        *nth -= count;
+    }
+    return i + findNthScalar(str + i, len - i, nth);
+}
+
+TARGET_SSE2 static size_t countSSE2(const char *str, size_t len)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+        count += __builtin_popcount(newlineMaskSSE2(str + i));
+    return count + countScalar(str + i, len - i);
+}
+
+/////////////////////////////////////////////////////////////////
+// AVX2 kernels                                                //
+/////////////////////////////////////////////////////////////////
+
+TARGET_AVX2 static uint32_t newlineMaskAVX2(const char *str)
+{
+    __m256i block = _mm256_loadu_si256((const __m256i*) str);
+    __m256i match = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'));
+    return (uint32_t) _mm256_movemask_epi8(match);
+}
+
+TARGET_AVX2 static size_t findLastAVX2(const char *str, size_t len)
+{
+    size_t i = len;
+    while (i >= 32) {
+        i -= 32;
+        uint32_t mask = newlineMaskAVX2(str + i);
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    size_t k = findLastScalar(str, i);
+    return k < i ? k : len;
+}
+
+TARGET_AVX2 static size_t findNthAVX2(const char *str, size_t len, size_t *nth)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint32_t mask = newlineMaskAVX2(str + i);
+        size_t count = __builtin_popcount(mask);
+        if (count >= *nth) {
+            size_t k = i + nthBitSet(mask, *nth);
+            *nth = 0;
+            return k;
+        }
+        *nth -= count;
+    }
+    return i + findNthScalar(str + i, len - i, nth);
+}
+
+TARGET_AVX2 static size_t countAVX2(const char *str, size_t len)
+{
+    // Accumulate the matches of 4 blocks at the time
+    // so that most of the work is a compare and an
+    // add per block.
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        uint64_t a = newlineMaskAVX2(str + i +  0) | ((uint64_t) newlineMaskAVX2(str + i + 32) << 32);
+        uint64_t b = newlineMaskAVX2(str + i + 64) | ((uint64_t) newlineMaskAVX2(str + i + 96) << 32);
+        count += __builtin_popcountll(a) + __builtin_popcountll(b);
+    }
+    for (; i + 32 <= len; i += 32)
+        count += __builtin_popcount(newlineMaskAVX2(str + i));
+    return count + countScalar(str + i, len - i);
+}
+
+#endif /* SIMD_X86 */
+
+/////////////////////////////////////////////////////////////////
+// Runtime dispatch                                            //
+/////////////////////////////////////////////////////////////////
+
+typedef struct {
+    size_t (*findLast)(const char *str, size_t len);
+    size_t (*findNth)(const char *str, size_t len, size_t *nth);
+    size_t (*count)(const char *str, size_t len);
+} Kernels;
+
+static Kernels kernels;
+static bool kernels_selected = false;
+
+static void selectKernels(void)
+{
+    kernels.findLast = findLastScalar;
+    kernels.findNth  = findNthScalar;
+    kernels.count    = countScalar;
+
+#ifdef SIMD_X86
+    if (cpuHasAVX2()) {
+        kernels.findLast = findLastAVX2;
+        kernels.findNth  = findNthAVX2;
+        kernels.count    = countAVX2;
+    } else if (cpuHasSSE2()) {
+        kernels.findLast = findLastSSE2;
+        kernels.findNth  = findNthSSE2;
+        kernels.count    = countSSE2;
+    }
+#endif
+
+    kernels_selected = true;
+}
+
+/* Symbol: Newline_find
+**   Returns the offset of the first '\n' of [str], or [len]
+**   if there isn't one. The C library's memchr is already
+**   vectorized, so this is a thin wrapper over it.
+*/
+size_t Newline_find(const char *str, size_t len)
+{
+    const char *found = len ? memchr(str, '\n', len) : NULL;
+    if (found == NULL)
+        return len;
+    return found - str;
+}
+
+/* Symbol: Newline_findLast
+**   Returns the offset of the last '\n' of [str], or [len]
+**   if there isn't one.
+*/
+size_t Newline_findLast(const char *str, size_t len)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.findLast(str, len);
+}
+
+/* Symbol: Newline_findNth
+**
+**   Returns the offset of the [nth] '\n' of [str], counting
+**   from 1, and sets [nth] to 0.
+**
+**   If [str] contains less newlines than that, [len] is
+**   returned and the newlines that were found are subtracted
+**   from [nth], so that the search can continue on the
+**   following string.
+*/
+size_t Newline_findNth(const char *str, size_t len, size_t *nth)
+{
+    if (*nth == 0)
+        return len;
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.findNth(str, len, nth);
+}
+
+size_t Newline_count(const char *str, size_t len)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.count(str, len);
+}
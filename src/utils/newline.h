@@ -0,0 +1,11 @@
+#ifndef NEWLINE_H
+#define NEWLINE_H
+
+#include <stddef.h>
+
+size_t Newline_find(const char *str, size_t len);
+size_t Newline_findLast(const char *str, size_t len);
+size_t Newline_findNth(const char *str, size_t len, size_t *nth);
+size_t Newline_count(const char *str, size_t len);
+
+#endif
@@ -0,0 +1,1575 @@
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "utf8.h"
+#include "newline.h"
+#include "piece_table.h"
+#include "save.h"
+
+/* Piece table
+**
+**   The text is described by a sequence of pieces, each one
+**   referring to a range of bytes of one of two sources: the
+**   original file, which is mapped in memory and never
+**   written to, and the add buffer, where inserted text is
+**   appended. Editing only changes the list of pieces, so
+**   loading a file costs a memory mapping and edits never
+**   move the text around.
+**
+**   This is an alternative to the gap buffer for huge files
+**   that are mostly read. Pieces are kept in a flat array,
+**   so edits cost a move of the pieces after them, while
+**   lookups search a Fenwick tree of the bytes and newlines
+**   of the pieces, which is brought up to date lazily.
+**
+**   Newlines of the original file are only counted where a
+**   query needs them. Until the whole file was seen, the
+**   line count is the newlines that were counted plus an
+**   estimate for the bytes that weren't, which is refined
+**   as lines further in the file are looked up.
+**
+**   The file isn't validated when loaded, since that would
+**   mean reading all of it. Invalid bytes are rendered as '?'
+**   and cursor movement steps over stray auxiliary bytes as
+**   if they were part of the preceding symbol.
+*/
+
+#if !defined(_WIN32) && !defined(GAPBUFFER_NOIO)
+#define PIECETABLE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef GAPBUFFER_DEBUG
+#define PRIVATE
+#else
+#define PRIVATE static
+#endif
+
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+#define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
+
+// Sources are split into chunks of this size and the
+// number of newlines in each chunk is counted the first
+// time a query needs it.
+#define INDEX_CHUNK_SHIFT 12
+#define INDEX_CHUNK_SIZE  ((size_t) 1 << INDEX_CHUNK_SHIFT)
+
+// Chunks indexed when a file is loaded, to estimate
+// the lines of the parts that weren't counted yet.
+#define INDEX_SAMPLE_CHUNKS 16
+
+// Newline count of a piece that wasn't counted yet
+#define UNKNOWN_NEWLINES SIZE_MAX
+
+typedef enum {
+    SOURCE_ORIGINAL,
+    SOURCE_ADDED,
+} SourceKind;
+
+// Data of a source that snapshots refer to. It's released
+// by whoever drops the last reference, be it the table or
+// one of the snapshots.
+typedef struct {
+    char  *data;
+    size_t size;
+    bool   mapped;
+    int    refs;
+} SharedData;
+
+typedef struct {
+    char  *data;
+    size_t size;
+    size_t capacity;
+    bool   mapped;
+    SharedData *shared;
+
+    // Lazily built line index. [prefix][k] is the number
+    // of newlines in the first k chunks. Only complete
+    // chunks are indexed since their bytes never change.
+    size_t *prefix;
+    size_t  indexed;
+    size_t  max_indexed;
+} Source;
+
+typedef struct {
+    SourceKind source;
+    size_t     offset;
+    size_t     length;
+    size_t     newlines;
+} Piece;
+
+// Node of the Fenwick tree over the pieces. The [k]-th
+// node sums the pieces from k - (k & -k) to k - 1.
+typedef struct {
+    size_t bytes;
+    size_t newlines;  // Of the pieces that were counted
+    size_t uncounted; // Pieces that weren't counted
+} PieceSums;
+
+struct PieceTable {
+    Source sources[2];
+    Piece *pieces;
+    size_t num_pieces;
+    size_t max_pieces;
+    size_t size;
+    size_t cursor;
+    size_t column_target;
+    size_t column_current;
+
+    // Fenwick tree with room for [max_pieces] nodes from 1.
+    // Only the first [num_sums] nodes are up to date, since
+    // the others are rebuilt by the first lookup that needs
+    // them after the pieces are moved.
+    PieceSums *sums;
+    size_t     num_sums;
+
+    size_t newlines;  // In the pieces that were counted
+    size_t uncounted; // Bytes of the pieces that weren't
+    size_t estimate;  // Guess of the newlines in those bytes
+
+    // Piece found by the last lookup and its logical
+    // offset. It makes sequential lookups constant time.
+    size_t cache_piece;
+    size_t cache_start;
+};
+
+PieceTable *PieceTable_create(void)
+{
+    PieceTable *table = malloc(sizeof(PieceTable));
+    if (table == NULL)
+        return NULL;
+    memset(table, 0, sizeof(PieceTable));
+    return table;
+}
+
+static void releaseData(char *data, size_t size, bool mapped)
+{
+#ifdef PIECETABLE_MMAP
+    if (mapped)
+        munmap(data, size);
+    else
+#else
+    (void) size;
+    (void) mapped;
+#endif
+    free(data);
+}
+
+static void dropSharedData(SharedData *shared)
+{
+    if (--shared->refs == 0) {
+        releaseData(shared->data, shared->size, shared->mapped);
+        free(shared);
+    }
+}
+
+static void releaseSource(Source *src)
+{
+    if (src->shared)
+        dropSharedData(src->shared);
+    else
+        releaseData(src->data, src->size, src->mapped);
+    free(src->prefix);
+    memset(src, 0, sizeof(Source));
+}
+
+void PieceTable_destroy(PieceTable *table)
+{
+    releaseSource(&table->sources[SOURCE_ORIGINAL]);
+    releaseSource(&table->sources[SOURCE_ADDED]);
+    free(table->pieces);
+    free(table->sums);
+    free(table);
+}
+
+void PieceTable_whipeClean(PieceTable *table)
+{
+    releaseSource(&table->sources[SOURCE_ORIGINAL]);
+    releaseSource(&table->sources[SOURCE_ADDED]);
+    table->num_pieces = 0;
+    table->size = 0;
+    table->cursor = 0;
+    table->column_target = 0;
+    table->column_current = 0;
+    table->num_sums = 0;
+    table->newlines = 0;
+    table->uncounted = 0;
+    table->estimate = 0;
+    table->cache_piece = 0;
+    table->cache_start = 0;
+}
+
+size_t PieceTable_getByteCount(PieceTable *table)
+{
+    return table->size;
+}
+
+size_t PieceTable_getColumn(PieceTable *table)
+{
+    return table->column_current;
+}
+
+size_t PieceTable_getTargetColumn(PieceTable *table)
+{
+    return table->column_target;
+}
+
+size_t PieceTable_getCursor(PieceTable *table)
+{
+    return table->cursor;
+}
+
+/////////////////////////////////////////////////////////////////
+// Sources                                                     //
+/////////////////////////////////////////////////////////////////
+
+/* Symbol: indexChunks
+**   Make sure the first [chunks] complete chunks of [src]
+**   are in its line index. Returns false if the index
+**   couldn't grow, in which case callers scan the text.
+*/
+PRIVATE bool indexChunks(Source *src, size_t chunks)
+{
+    chunks = MIN(chunks, src->size >> INDEX_CHUNK_SHIFT);
+    if (src->prefix && chunks <= src->indexed)
+        return true;
+
+    if (src->prefix == NULL || chunks > src->max_indexed) {
+        size_t max_indexed = MAX(chunks, 2 * src->max_indexed);
+        size_t *prefix = realloc(src->prefix, (max_indexed + 1) * sizeof(size_t));
+        if (prefix == NULL)
+            return false;
+        if (src->prefix == NULL)
+            prefix[0] = 0;
+        src->prefix = prefix;
+        src->max_indexed = max_indexed;
+    }
+
+    for (size_t k = src->indexed; k < chunks; k++) {
+        const char *chunk = src->data + (k << INDEX_CHUNK_SHIFT);
+        src->prefix[k+1] = src->prefix[k] + Newline_count(chunk, INDEX_CHUNK_SIZE);
+    }
+    src->indexed = chunks;
+    return true;
+}
+
+// Returns the number of newlines between the offsets [lo] and [hi] of [src]
+static size_t countSourceNewlines(Source *src, size_t lo, size_t hi)
+{
+    size_t first = (lo + INDEX_CHUNK_SIZE - 1) >> INDEX_CHUNK_SHIFT; // First chunk after [lo]
+    size_t last  = hi >> INDEX_CHUNK_SHIFT; // Chunk containing [hi]
+
+    if (first >= last || !indexChunks(src, last))
+        return Newline_count(src->data + lo, hi - lo);
+
+    size_t head = first << INDEX_CHUNK_SHIFT;
+    size_t tail = last  << INDEX_CHUNK_SHIFT;
+    return Newline_count(src->data + lo, head - lo)
+         + src->prefix[last] - src->prefix[first]
+         + Newline_count(src->data + tail, hi - tail);
+}
+
+/* Symbol: findSourceNewline
+**   Returns the offset of the [nth] newline between the
+**   offsets [lo] and [hi] of [src], or [hi] if there aren't
+**   that many. Like Newline_findNth, the newlines that were
+**   found are subtracted from [nth].
+*/
+static size_t findSourceNewline(Source *src, size_t lo, size_t hi, size_t *nth)
+{
+    size_t first = (lo + INDEX_CHUNK_SIZE - 1) >> INDEX_CHUNK_SHIFT;
+    size_t last  = hi >> INDEX_CHUNK_SHIFT;
+
+    if (first >= last)
+        return lo + Newline_findNth(src->data + lo, hi - lo, nth);
+
+    size_t head = first << INDEX_CHUNK_SHIFT;
+    size_t i = lo + Newline_findNth(src->data + lo, head - lo, nth);
+    if (i < head)
+        return i;
+
+    size_t k = first;
+    if (src->indexed >= last) {
+        // Binary search the chunk containing the newline
+        size_t target = src->prefix[first] + *nth;
+        size_t lo_k = first;
+        size_t hi_k = last;
+        while (lo_k < hi_k) {
+            size_t mid = lo_k + (hi_k - lo_k) / 2;
+            if (src->prefix[mid+1] >= target)
+                hi_k = mid;
+            else
+                lo_k = mid + 1;
+        }
+        k = lo_k;
+        *nth -= src->prefix[k] - src->prefix[first];
+    }
+
+    // Skip the chunks that don't contain the newline,
+    // indexing them along the way.
+    while (k < last && indexChunks(src, k+1)) {
+        size_t count = src->prefix[k+1] - src->prefix[k];
+        if (count >= *nth)
+            break;
+        *nth -= count;
+        k++;
+    }
+
+    size_t start = k << INDEX_CHUNK_SHIFT;
+    return start + Newline_findNth(src->data + start, hi - start, nth);
+}
+
+static bool appendToSource(Source *src, const char *str, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    if (src->size + len > src->capacity) {
+        size_t capacity = MAX(src->size + len, MAX(2 * src->capacity, (size_t) 1 << 12));
+        char *data = realloc(src->data, capacity);
+        if (data == NULL)
+            return false;
+        src->data = data;
+        src->capacity = capacity;
+    }
+    memcpy(src->data + src->size, str, len);
+    src->size += len;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+// Pieces                                                      //
+/////////////////////////////////////////////////////////////////
+
+static const char *getPieceData(PieceTable *table, Piece *piece)
+{
+    return table->sources[piece->source].data + piece->offset;
+}
+
+static PieceSums getPieceSums(Piece *piece)
+{
+    if (piece->newlines == UNKNOWN_NEWLINES)
+        return (PieceSums) { .bytes = piece->length, .uncounted = 1 };
+    return (PieceSums) { .bytes = piece->length, .newlines = piece->newlines };
+}
+
+static void addSums(PieceSums *dst, PieceSums src)
+{
+    dst->bytes     += src.bytes;
+    dst->newlines  += src.newlines;
+    dst->uncounted += src.uncounted;
+}
+
+typedef enum {
+    SUM_BYTES,
+    SUM_NEWLINES,
+    SUM_UNCOUNTED,
+} SumField;
+
+static size_t getSum(PieceSums sums, SumField field)
+{
+    switch (field) {
+        case SUM_BYTES:     return sums.bytes;
+        case SUM_NEWLINES:  return sums.newlines;
+        case SUM_UNCOUNTED: return sums.uncounted;
+    }
+    return 0;
+}
+
+// Forget the nodes of the Fenwick tree that sum
+// pieces from the [i]-th on, after they moved.
+static void invalidateSums(PieceTable *table, size_t i)
+{
+    table->num_sums = MIN(table->num_sums, i);
+}
+
+// Update the nodes of the Fenwick tree that sum the [i]-th
+// piece after it changed in place from [old]. Differences
+// are added as unsigned integers, which wrap around, so
+// that they can be negative.
+static void changedPiece(PieceTable *table, size_t i, PieceSums old)
+{
+    PieceSums new = getPieceSums(&table->pieces[i]);
+    for (size_t k = i+1; k <= table->num_sums; k += k & -k) {
+        table->sums[k].bytes     += new.bytes - old.bytes;
+        table->sums[k].newlines  += new.newlines - old.newlines;
+        table->sums[k].uncounted += new.uncounted - old.uncounted;
+    }
+}
+
+/* Symbol: updateSums
+**   Rebuild the nodes of the Fenwick tree that are out of
+**   date. Each node is the sum of its last piece and of the
+**   nodes that cover the pieces before it, which come first
+**   so they are up to date.
+*/
+static void updateSums(PieceTable *table)
+{
+    for (size_t k = table->num_sums+1; k <= table->num_pieces; k++) {
+        PieceSums sums = getPieceSums(&table->pieces[k-1]);
+        for (size_t j = k-1; j > k - (k & -k); j -= j & -j)
+            addSums(&sums, table->sums[j]);
+        table->sums[k] = sums;
+    }
+    table->num_sums = table->num_pieces;
+}
+
+// Returns the sums of the first [i] pieces
+static PieceSums sumPieces(PieceTable *table, size_t i)
+{
+    updateSums(table);
+
+    PieceSums sums = {0};
+    for (; i > 0; i -= i & -i)
+        addSums(&sums, table->sums[i]);
+    return sums;
+}
+
+/* Symbol: searchSums
+**   Returns how many pieces from the first add up to less
+**   than [limit] in [field], which since sums only grow is
+**   the index of the piece where the total reaches [limit],
+**   or the number of pieces if it never does. The sums of
+**   the pieces before it are stored in [before], if given.
+*/
+static size_t searchSums(PieceTable *table, SumField field, size_t limit, PieceSums *before)
+{
+    updateSums(table);
+
+    size_t step = 1;
+    while (2 * step <= table->num_pieces)
+        step *= 2;
+
+    size_t i = 0;
+    PieceSums sums = {0};
+    for (; step > 0; step /= 2) {
+        if (i + step > table->num_pieces)
+            continue;
+        PieceSums next = sums;
+        addSums(&next, table->sums[i + step]);
+        if (getSum(next, field) < limit) {
+            i += step;
+            sums = next;
+        }
+    }
+    if (before)
+        *before = sums;
+    return i;
+}
+
+/* Symbol: estimateNewlines
+**   Guess the newlines in the bytes that weren't counted
+**   from how many there are in the chunks of the original
+**   file that were indexed. The guess is at least 1 while
+**   there are such bytes, so that views can scroll past
+**   the lines that were counted, which counts more of them.
+*/
+static void estimateNewlines(PieceTable *table)
+{
+    if (table->uncounted == 0) {
+        table->estimate = 0;
+        return;
+    }
+    Source *src = &table->sources[SOURCE_ORIGINAL];
+    double density = 0;
+    if (src->indexed > 0)
+        density = (double) src->prefix[src->indexed] / (src->indexed << INDEX_CHUNK_SHIFT);
+    table->estimate = MAX((size_t) 1, (size_t) (density * table->uncounted));
+}
+
+// Store the [count] of newlines of the [i]-th piece,
+// which wasn't counted.
+static void setPieceNewlines(PieceTable *table, size_t i, size_t count)
+{
+    Piece *piece = &table->pieces[i];
+    assert(piece->newlines == UNKNOWN_NEWLINES);
+
+    PieceSums old = getPieceSums(piece);
+    piece->newlines = count;
+    changedPiece(table, i, old);
+
+    table->newlines  += count;
+    table->uncounted -= piece->length;
+    estimateNewlines(table);
+}
+
+// Returns the newlines of the [i]-th piece,
+// counting them if that wasn't done yet.
+static size_t countPiece(PieceTable *table, size_t i)
+{
+    Piece *piece = &table->pieces[i];
+    if (piece->newlines == UNKNOWN_NEWLINES) {
+        Source *src = &table->sources[piece->source];
+        setPieceNewlines(table, i, countSourceNewlines(src, piece->offset, piece->offset + piece->length));
+    }
+    return piece->newlines;
+}
+
+/* Symbol: findPiece
+**   Returns the index of the piece containing the byte at
+**   logical [offset] and stores its logical offset in [start].
+**   If [offset] is the end of the text, the number of pieces
+**   is returned and [start] is set to the end of the text.
+*/
+PRIVATE size_t findPiece(PieceTable *table, size_t offset, size_t *start)
+{
+    // Sequential lookups find the piece of the last
+    // lookup or the following one without a search.
+    size_t i = table->cache_piece;
+    size_t cur = table->cache_start;
+    if (i < table->num_pieces && cur <= offset) {
+        if (offset < cur + table->pieces[i].length) {
+            *start = cur;
+            return i;
+        }
+        cur += table->pieces[i].length;
+        i++;
+        if (i < table->num_pieces && offset < cur + table->pieces[i].length) {
+            table->cache_piece = i;
+            table->cache_start = cur;
+            *start = cur;
+            return i;
+        }
+    }
+
+    PieceSums before;
+    i = searchSums(table, SUM_BYTES, offset + 1, &before);
+    if (i < table->num_pieces) {
+        table->cache_piece = i;
+        table->cache_start = before.bytes;
+    }
+    *start = before.bytes;
+    return i;
+}
+
+static void forgetCachedPiece(PieceTable *table)
+{
+    table->cache_piece = 0;
+    table->cache_start = 0;
+}
+
+static bool reservePieces(PieceTable *table, size_t num)
+{
+    if (table->num_pieces + num <= table->max_pieces)
+        return true;
+
+    size_t max_pieces = MAX(table->num_pieces + num, MAX(2 * table->max_pieces, 16));
+    Piece *pieces = realloc(table->pieces, max_pieces * sizeof(Piece));
+    if (pieces == NULL)
+        return false;
+    table->pieces = pieces;
+
+    // Nodes of the tree are numbered from 1
+    PieceSums *sums = realloc(table->sums, (max_pieces + 1) * sizeof(PieceSums));
+    if (sums == NULL)
+        return false;
+    table->sums = sums;
+
+    table->max_pieces = max_pieces;
+    return true;
+}
+
+// Split the [i]-th piece after its first [len] bytes.
+// There must be room for one more piece. The halves of
+// a piece that was counted are counted too.
+static void splitPiece(PieceTable *table, size_t i, size_t len)
+{
+    assert(table->num_pieces < table->max_pieces);
+
+    Piece *piece = &table->pieces[i];
+    assert(len > 0 && len < piece->length);
+
+    memmove(piece + 2, piece + 1, (table->num_pieces - i - 1) * sizeof(Piece));
+    table->num_pieces++;
+    invalidateSums(table, i);
+
+    size_t newlines = UNKNOWN_NEWLINES;
+    if (piece->newlines != UNKNOWN_NEWLINES) {
+        // The source is indexed up to the end of the
+        // piece since it was counted, so this is quick.
+        Source *src = &table->sources[piece->source];
+        newlines = countSourceNewlines(src, piece->offset, piece->offset + len);
+    }
+
+    piece[1].source = piece->source;
+    piece[1].offset = piece->offset + len;
+    piece[1].length = piece->length - len;
+    piece[1].newlines = UNKNOWN_NEWLINES;
+    if (newlines != UNKNOWN_NEWLINES)
+        piece[1].newlines = piece->newlines - newlines;
+    piece->length = len;
+    piece->newlines = newlines;
+}
+
+/* Symbol: countPrefix
+**
+**   Record that the first [len] bytes of the [i]-th piece,
+**   which wasn't counted, have [count] newlines.
+**
+**   They join the previous piece when it was counted and
+**   they follow it in its source, otherwise they are split
+**   in a piece of their own. This way the part of the text
+**   that wasn't counted shrinks as lines further in it are
+**   looked up, without adding a piece each time.
+*/
+static void countPrefix(PieceTable *table, size_t i, size_t len, size_t count)
+{
+    Piece *piece = &table->pieces[i];
+    assert(piece->newlines == UNKNOWN_NEWLINES);
+
+    if (len == piece->length) {
+        setPieceNewlines(table, i, count);
+        return;
+    }
+
+    Piece *prev = piece - 1;
+    if (i > 0 && prev->newlines != UNKNOWN_NEWLINES && prev->source == piece->source
+        && prev->offset + prev->length == piece->offset) {
+
+        PieceSums old_prev = getPieceSums(prev);
+        PieceSums old = getPieceSums(piece);
+        prev->length   += len;
+        prev->newlines += count;
+        piece->offset  += len;
+        piece->length  -= len;
+        changedPiece(table, i-1, old_prev);
+        changedPiece(table, i, old);
+
+    } else {
+
+        // Without memory the bytes are just counted
+        // again by the next lookup.
+        if (!reservePieces(table, 1))
+            return;
+        splitPiece(table, i, len);
+        table->pieces[i].newlines = count;
+    }
+
+    table->newlines  += count;
+    table->uncounted -= len;
+    estimateNewlines(table);
+    forgetCachedPiece(table);
+}
+
+/* Symbol: dropBytes
+**   Take the first [len] bytes of [piece], which are being
+**   removed, out of the newlines of the piece and of the
+**   table. Those of a piece that wasn't counted are counted
+**   and taken out of the estimate, so that the line count
+**   changes by exactly the lines that were removed.
+*/
+static void dropBytes(PieceTable *table, Piece *piece, size_t len)
+{
+    Source *src = &table->sources[piece->source];
+
+    if (piece->newlines == UNKNOWN_NEWLINES) {
+        size_t count = Newline_count(src->data + piece->offset, len);
+        table->uncounted -= len;
+        table->estimate  -= MIN(count, table->estimate);
+        if (table->uncounted == 0)
+            table->estimate = 0;
+        return;
+    }
+
+    size_t count = piece->newlines;
+    if (len < piece->length)
+        count = countSourceNewlines(src, piece->offset, piece->offset + len);
+    piece->newlines -= count;
+    table->newlines -= count;
+}
+
+PRIVATE bool insertBytes(PieceTable *table, size_t offset, const char *str, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    Source *added = &table->sources[SOURCE_ADDED];
+    size_t added_offset = added->size;
+
+    if (!reservePieces(table, 2) || !appendToSource(added, str, len))
+        return false;
+
+    size_t newlines = Newline_count(str, len);
+
+    size_t start;
+    size_t i = findPiece(table, offset, &start);
+
+    if (offset == start && i > 0) {
+        // Consecutive insertions (typing) grow the piece
+        // that was appended to the add buffer last.
+        Piece *prev = &table->pieces[i-1];
+        if (prev->source == SOURCE_ADDED && prev->offset + prev->length == added_offset
+            && prev->newlines != UNKNOWN_NEWLINES) {
+            PieceSums old = getPieceSums(prev);
+            prev->length += len;
+            prev->newlines += newlines;
+            changedPiece(table, i-1, old);
+            goto done;
+        }
+    }
+
+    if (offset > start) {
+        splitPiece(table, i, offset - start);
+        i++;
+    }
+
+    memmove(table->pieces + i + 1, table->pieces + i, (table->num_pieces - i) * sizeof(Piece));
+    table->pieces[i] = (Piece) {
+        .source = SOURCE_ADDED,
+        .offset = added_offset,
+        .length = len,
+        .newlines = newlines,
+    };
+    table->num_pieces++;
+    invalidateSums(table, i);
+
+done:
+    table->size += len;
+    table->newlines += newlines;
+    forgetCachedPiece(table);
+    return true;
+}
+
+PRIVATE bool removeBytes(PieceTable *table, size_t offset, size_t len)
+{
+    assert(offset + len <= table->size);
+
+    if (len == 0)
+        return true;
+
+    if (!reservePieces(table, 1))
+        return false;
+
+    size_t start;
+    size_t i = findPiece(table, offset, &start);
+
+    // Make the removed range start at a piece boundary
+    if (offset > start) {
+        splitPiece(table, i, offset - start);
+        start = offset;
+        i++;
+    }
+
+    // Drop the pieces that are completely removed and
+    // trim the first bytes of the last one.
+    size_t end = offset + len;
+    size_t j = i;
+    while (j < table->num_pieces && start + table->pieces[j].length <= end) {
+        dropBytes(table, &table->pieces[j], table->pieces[j].length);
+        start += table->pieces[j].length;
+        j++;
+    }
+    if (j < table->num_pieces && start < end) {
+        Piece *piece = &table->pieces[j];
+        dropBytes(table, piece, end - start);
+        piece->offset += end - start;
+        piece->length -= end - start;
+    }
+
+    memmove(table->pieces + i, table->pieces + j, (table->num_pieces - j) * sizeof(Piece));
+    table->num_pieces -= j - i;
+    table->size -= len;
+    invalidateSums(table, i);
+    forgetCachedPiece(table);
+    return true;
+}
+
+// Store in [dst] the pieces describing the logical range
+// [lo, hi) of the text and return how many they are. The
+// search starts from the [*i]-th piece, which begins at
+// the logical offset [*start], and both are left at the
+// piece containing [hi] so that consecutive ranges can be
+// copied with a single walk of the pieces.
+static size_t copyPieces(PieceTable *table, Piece *dst, size_t lo, size_t hi,
+                         size_t *i, size_t *start)
+{
+    size_t num = 0;
+    while (lo < hi) {
+        Piece *piece = &table->pieces[*i];
+        size_t end = *start + piece->length;
+        if (end <= lo) {
+            *start = end;
+            (*i)++;
+            continue;
+        }
+        size_t skip = lo - *start;
+        size_t take = MIN(hi, end) - lo;
+        dst[num] = *piece;
+        dst[num].offset += skip;
+        dst[num].length  = take;
+        if (take != piece->length && piece->newlines != UNKNOWN_NEWLINES) {
+            Source *src = &table->sources[piece->source];
+            dst[num].newlines = countSourceNewlines(src, dst[num].offset, dst[num].offset + take);
+        }
+        num++;
+        lo += take;
+    }
+    return num;
+}
+
+// Returns the newlines in the logical range [lo, hi) that
+// are in pieces that weren't counted. The pieces are walked
+// like copyPieces does.
+static size_t countUncounted(PieceTable *table, size_t lo, size_t hi,
+                             size_t *i, size_t *start)
+{
+    size_t count = 0;
+    while (lo < hi) {
+        Piece *piece = &table->pieces[*i];
+        size_t end = *start + piece->length;
+        if (end <= lo) {
+            *start = end;
+            (*i)++;
+            continue;
+        }
+        size_t take = MIN(hi, end) - lo;
+        if (piece->newlines == UNKNOWN_NEWLINES) {
+            const char *data = getPieceData(table, piece) + (lo - *start);
+            count += Newline_count(data, take);
+        }
+        lo += take;
+    }
+    return count;
+}
+
+/* Symbol: PieceTable_applyEdits
+**
+**   Apply a batch of edits (see GapBuffer_applyEdits) by
+**   building the new list of pieces in one walk of the old
+**   one, instead of searching the pieces once per edit.
+**
+**   The cursor isn't moved. It's up to the caller to map
+**   it to its position in the new text.
+*/
+bool PieceTable_applyEdits(PieceTable *table, const GapBufferEdit *edits, size_t count)
+{
+    Source *added = &table->sources[SOURCE_ADDED];
+    size_t added_offset = added->size;
+
+    // Each edit adds a piece and splits at most one more
+    size_t max_pieces = table->num_pieces + 2 * count;
+    Piece *pieces = malloc(MAX(max_pieces, 1) * sizeof(Piece));
+    if (pieces == NULL)
+        return false;
+
+    PieceSums *sums = realloc(table->sums, (MAX(max_pieces, 1) + 1) * sizeof(PieceSums));
+    if (sums == NULL) {
+        free(pieces);
+        return false;
+    }
+    table->sums = sums;
+
+    for (size_t k = 0; k < count; k++)
+        if (!appendToSource(added, edits[k].insert, edits[k].insert_len)) {
+            // The bytes that were appended aren't referenced
+            // by any piece, so they can be dropped.
+            added->size = added_offset;
+            free(pieces);
+            return false;
+        }
+
+    size_t size = table->size;
+    size_t num = 0;
+    size_t i = 0;
+    size_t start = 0;
+    size_t prev = 0;
+    size_t dropped = 0; // Newlines removed from pieces that weren't counted
+    for (size_t k = 0; k < count; k++) {
+
+        const GapBufferEdit *edit = &edits[k];
+        num += copyPieces(table, pieces + num, prev, edit->offset, &i, &start);
+        dropped += countUncounted(table, edit->offset, edit->offset + edit->delete_len, &i, &start);
+
+        if (edit->insert_len > 0) {
+            pieces[num++] = (Piece) {
+                .source = SOURCE_ADDED,
+                .offset = added_offset,
+                .length = edit->insert_len,
+                .newlines = Newline_count(edit->insert, edit->insert_len),
+            };
+            added_offset += edit->insert_len;
+        }
+
+        prev = edit->offset + edit->delete_len;
+        size = size + edit->insert_len - edit->delete_len;
+    }
+    num += copyPieces(table, pieces + num, prev, table->size, &i, &start);
+    assert(num <= max_pieces);
+
+    free(table->pieces);
+    table->pieces = pieces;
+    table->num_pieces = num;
+    table->max_pieces = MAX(max_pieces, 1);
+    table->size = size;
+    invalidateSums(table, 0);
+    forgetCachedPiece(table);
+
+    table->newlines = 0;
+    table->uncounted = 0;
+    for (size_t k = 0; k < num; k++) {
+        if (pieces[k].newlines == UNKNOWN_NEWLINES)
+            table->uncounted += pieces[k].length;
+        else
+            table->newlines += pieces[k].newlines;
+    }
+    table->estimate -= MIN(dropped, table->estimate);
+    if (table->uncounted == 0)
+        table->estimate = 0;
+    return true;
+}
+
+/* Symbol: PieceTable_getSlice
+**   Returns the bytes starting at [offset] up to the end of
+**   the piece containing it and stores their count in [len].
+**   The text can be walked by calling this repeatedly.
+*/
+const char *PieceTable_getSlice(PieceTable *table, size_t offset, size_t *len)
+{
+    size_t start;
+    size_t i = findPiece(table, offset, &start);
+    if (i == table->num_pieces) {
+        *len = 0;
+        return NULL;
+    }
+    Piece *piece = &table->pieces[i];
+    *len = piece->length - (offset - start);
+    return getPieceData(table, piece) + (offset - start);
+}
+
+static void copyRange(PieceTable *table, size_t lo, size_t hi, char *dst)
+{
+    while (lo < hi) {
+        size_t len;
+        const char *str = PieceTable_getSlice(table, lo, &len);
+        len = MIN(len, hi - lo);
+        memcpy(dst, str, len);
+        dst += len;
+        lo += len;
+    }
+}
+
+static char getByte(PieceTable *table, size_t offset)
+{
+    size_t len;
+    return *PieceTable_getSlice(table, offset, &len);
+}
+
+/////////////////////////////////////////////////////////////////
+// Lines and symbols                                           //
+/////////////////////////////////////////////////////////////////
+
+// Returns the offset of the first newline after [offset],
+// or the end of the text.
+static size_t findLineEnd(PieceTable *table, size_t offset)
+{
+    while (offset < table->size) {
+        size_t len;
+        const char *str = PieceTable_getSlice(table, offset, &len);
+        size_t i = Newline_find(str, len);
+        if (i < len)
+            return offset + i;
+        offset += len;
+    }
+    return table->size;
+}
+
+// Returns the offset of the line containing the byte
+// before [offset].
+static size_t findLineStart(PieceTable *table, size_t offset)
+{
+    while (offset > 0) {
+        size_t start;
+        size_t i = findPiece(table, offset-1, &start);
+        const char *str = getPieceData(table, &table->pieces[i]);
+        size_t len = offset - start;
+        size_t k = Newline_findLast(str, len);
+        if (k < len)
+            return start + k + 1;
+        offset = start;
+    }
+    return 0;
+}
+
+static size_t countRunes(PieceTable *table, size_t lo, size_t hi)
+{
+    size_t count = 0;
+    while (lo < hi) {
+        size_t len;
+        const char *str = PieceTable_getSlice(table, lo, &len);
+        len = MIN(len, hi - lo);
+        count += UTF8_countRunes(str, len);
+        lo += len;
+    }
+    return count;
+}
+
+// Returns the offset after the first [num] symbols
+// following [offset], without going past [limit].
+static size_t skipRunesForwards(PieceTable *table, size_t offset, size_t limit, size_t num)
+{
+    if (num == 0)
+        return offset;
+
+    while (num > 0 && offset < limit) {
+        size_t len;
+        const char *str = PieceTable_getSlice(table, offset, &len);
+        len = MIN(len, limit - offset);
+        size_t count = UTF8_countRunes(str, len);
+        if (count > num)
+            return offset + UTF8_skipRunes(str, len, num);
+        num -= count;
+        offset += len;
+    }
+    // Auxiliary bytes of the last skipped symbol
+    while (offset < limit && (getByte(table, offset) & 0xC0) == 0x80)
+        offset++;
+    return offset;
+}
+
+// Returns the offset of the [num]-th symbol preceding [offset]
+static size_t skipRunesBackwards(PieceTable *table, size_t offset, size_t num)
+{
+    while (num > 0 && offset > 0) {
+        // Consume the auxiliary bytes (10xxxxxx)
+        // and then the leading byte.
+        do
+            offset--;
+        while (offset > 0 && (getByte(table, offset) & 0xC0) == 0x80);
+        num--;
+    }
+    return offset;
+}
+
+/* Symbol: PieceTable_skipForwards
+**   Returns the offset after the first [num] symbols
+**   following [offset], or the end of the text.
+*/
+size_t PieceTable_skipForwards(PieceTable *table, size_t offset, size_t num)
+{
+    return skipRunesForwards(table, offset, table->size, num);
+}
+
+/* Symbol: PieceTable_skipBackwards
+**   Returns the offset of the [num]-th symbol preceding
+**   [offset], or 0.
+*/
+size_t PieceTable_skipBackwards(PieceTable *table, size_t offset, size_t num)
+{
+    return skipRunesBackwards(table, offset, num);
+}
+
+static void recalculateColumn(PieceTable *table)
+{
+    size_t start = findLineStart(table, table->cursor);
+    table->column_current = countRunes(table, start, table->cursor);
+}
+
+/* Symbol: PieceTable_getLineCount
+**   Returns the number of lines. It's exact once all of the
+**   text was counted, otherwise the lines of what wasn't
+**   are estimated (see estimateNewlines) and the count may
+**   change when looking up lines or offsets counts them.
+*/
+size_t PieceTable_getLineCount(PieceTable *table)
+{
+    return table->newlines + table->estimate + 1;
+}
+
+size_t PieceTable_getLineOffset(PieceTable *table, size_t line)
+{
+    if (line == 0)
+        return 0;
+
+    for (;;) {
+        // The piece with the newline, if the pieces that
+        // weren't counted don't come before it.
+        PieceSums before;
+        size_t i = searchSums(table, SUM_NEWLINES, line, &before);
+        size_t u = searchSums(table, SUM_UNCOUNTED, 1, NULL);
+
+        if (i < u) {
+            Piece *piece = &table->pieces[i];
+            Source *src = &table->sources[piece->source];
+            size_t nth = line - before.newlines;
+            size_t k = findSourceNewline(src, piece->offset, piece->offset + piece->length, &nth);
+            assert(k < piece->offset + piece->length);
+            return before.bytes + (k - piece->offset) + 1;
+        }
+
+        if (u == table->num_pieces)
+            return table->size;
+
+        // Look for the newline in the first piece that wasn't
+        // counted and count the bytes that were searched.
+        before = sumPieces(table, u);
+        Piece *piece = &table->pieces[u];
+        Source *src = &table->sources[piece->source];
+        size_t want = line - before.newlines;
+        size_t nth = want;
+        size_t k = findSourceNewline(src, piece->offset, piece->offset + piece->length, &nth);
+        if (k < piece->offset + piece->length) {
+            size_t len = k - piece->offset + 1;
+            countPrefix(table, u, len, want);
+            return before.bytes + len;
+        }
+        setPieceNewlines(table, u, want - nth);
+    }
+}
+
+size_t PieceTable_getLineIndex(PieceTable *table, size_t offset)
+{
+    offset = MIN(offset, table->size);
+
+    size_t start;
+    size_t i = findPiece(table, offset, &start);
+
+    // Count the pieces before the one containing
+    // [offset], so that their sum is exact.
+    size_t u;
+    while ((u = searchSums(table, SUM_UNCOUNTED, 1, NULL)) < i)
+        countPiece(table, u);
+
+    size_t line = sumPieces(table, i).newlines;
+    if (i < table->num_pieces && offset > start) {
+        Piece *piece = &table->pieces[i];
+        Source *src = &table->sources[piece->source];
+        size_t count = countSourceNewlines(src, piece->offset, piece->offset + offset - start);
+        if (piece->newlines == UNKNOWN_NEWLINES)
+            // So that the line count is more than the index
+            countPrefix(table, i, offset - start, count);
+        line += count;
+    }
+    return line;
+}
+
+/* Symbol: PieceTable_nextLine
+**
+**   Get the line starting at [offset] and move [offset] to
+**   the start of the following one. Returns false if there
+**   are no more lines.
+**
+**   Lines contained by a single piece are returned in place.
+**   Lines spanning multiple pieces are copied in the memory
+**   pointed by [mem], which is grown as needed and must be
+**   released with PieceTable_freeLine.
+*/
+bool PieceTable_nextLine(PieceTable *table, size_t *offset,
+                         const char **str, size_t *len, void **mem)
+{
+    size_t lo = *offset;
+    if (lo >= table->size)
+        return false;
+
+    size_t hi = findLineEnd(table, lo);
+
+    size_t slice_len;
+    const char *slice = PieceTable_getSlice(table, lo, &slice_len);
+
+    if (hi - lo <= slice_len) {
+        *str = slice;
+        *len = hi - lo;
+    } else {
+        char *copy = realloc(*mem, hi - lo);
+        if (copy == NULL) {
+            // Return the part of the line that's
+            // in the first piece.
+            *str = slice;
+            *len = slice_len;
+        } else {
+            copyRange(table, lo, hi, copy);
+            *mem = copy;
+            *str = copy;
+            *len = hi - lo;
+        }
+    }
+
+    if (hi < table->size)
+        hi++; // Consume "\n"
+    *offset = hi;
+    return true;
+}
+
+void PieceTable_freeLine(void *mem)
+{
+    free(mem);
+}
+
+/////////////////////////////////////////////////////////////////
+// Cursor                                                      //
+/////////////////////////////////////////////////////////////////
+
+bool PieceTable_insertString(PieceTable *table, const char *str, size_t len)
+{
+    if (!UTF8_isValid(str, len))
+        return false;
+
+    if (!insertBytes(table, table->cursor, str, len))
+        return false;
+    table->cursor += len;
+
+    // Update column index
+    size_t last = Newline_findLast(str, len);
+    if (last < len)
+        table->column_current = UTF8_countRunes(str + last + 1, len - last - 1);
+    else
+        table->column_current += UTF8_countRunes(str, len);
+    table->column_target = table->column_current;
+    return true;
+}
+
+size_t PieceTable_removeForwards(PieceTable *table, size_t num)
+{
+    size_t end = skipRunesForwards(table, table->cursor, table->size, num);
+    if (!removeBytes(table, table->cursor, end - table->cursor))
+        return 0;
+    return end - table->cursor;
+}
+
+void PieceTable_removeForwardsRaw(PieceTable *table, size_t num)
+{
+    num = MIN(num, table->size - table->cursor);
+    removeBytes(table, table->cursor, num);
+}
+
+size_t PieceTable_removeBackwards(PieceTable *table, size_t num)
+{
+    size_t start = skipRunesBackwards(table, table->cursor, num);
+    size_t removed = table->cursor - start;
+    if (!removeBytes(table, start, removed))
+        return 0;
+    table->cursor = start;
+
+    if (num > table->column_current)
+        recalculateColumn(table);
+    else
+        table->column_current -= num;
+    table->column_target = table->column_current;
+    return removed;
+}
+
+size_t PieceTable_moveRelative(PieceTable *table, int off)
+{
+    if (off < 0)
+        table->cursor = skipRunesBackwards(table, table->cursor, -off);
+    else
+        table->cursor = skipRunesForwards(table, table->cursor, table->size, off);
+    recalculateColumn(table);
+    table->column_target = table->column_current;
+    return table->cursor;
+}
+
+size_t PieceTable_moveAbsolute(PieceTable *table, size_t num)
+{
+    table->cursor = skipRunesForwards(table, 0, table->size, num);
+    recalculateColumn(table);
+    table->column_target = table->column_current;
+    return table->cursor;
+}
+
+void PieceTable_moveAbsoluteRaw(PieceTable *table, size_t num)
+{
+    table->cursor = MIN(num, table->size);
+    recalculateColumn(table);
+    table->column_target = table->column_current;
+}
+
+void PieceTable_moveRelativeVertically(PieceTable *table, bool up)
+{
+    // Lines are found by scanning around the cursor
+    // so that the line index isn't built just to move
+    // between neighbouring lines.
+    size_t start;
+    if (up) {
+        size_t current = findLineStart(table, table->cursor);
+        if (current == 0)
+            // There's no previous line, so we can't move up
+            return;
+        start = findLineStart(table, current - 1);
+    } else {
+        size_t end = findLineEnd(table, table->cursor);
+        if (end == table->size)
+            // It's the last line. Can't move down
+            return;
+        start = end + 1;
+    }
+
+    // Find the byte offset of the character at the given column,
+    // or the end of the line if it's shorter than that.
+    size_t end = findLineEnd(table, start);
+    table->cursor = skipRunesForwards(table, start, end, table->column_target);
+    table->column_current = countRunes(table, start, table->cursor);
+}
+
+void PieceTable_copyDataOut(PieceTable *table, char *dst, size_t max)
+{
+    if (max == 0)
+        return;
+    size_t copied = MIN(table->size, max - 1);
+    copyRange(table, 0, copied, dst);
+    dst[copied] = '\0';
+}
+
+/////////////////////////////////////////////////////////////////
+// Snapshots                                                   //
+/////////////////////////////////////////////////////////////////
+
+struct PieceTableSnapshot {
+    SaveSlice  *slices;
+    size_t      num_slices;
+    char       *added;    // Copy of the add buffer
+    SharedData *original;
+};
+
+/* Symbol: PieceTable_snapshot
+**
+**   Take an immutable copy of the text that can be read
+**   by other threads while the table is edited.
+**
+**   The original file isn't copied, since its bytes never
+**   change: the snapshot shares it with the table. The add
+**   buffer is copied because it's moved when it grows, but
+**   it only holds the text that was inserted.
+**
+**   The snapshot must be freed by the thread that uses the
+**   table, since they share a reference count.
+*/
+PieceTableSnapshot *PieceTable_snapshot(PieceTable *table)
+{
+    Source *original = &table->sources[SOURCE_ORIGINAL];
+    Source *added    = &table->sources[SOURCE_ADDED];
+
+    PieceTableSnapshot *snap = malloc(sizeof(PieceTableSnapshot));
+    if (snap == NULL)
+        return NULL;
+    snap->slices = malloc(MAX(table->num_pieces, 1) * sizeof(SaveSlice));
+    snap->added  = malloc(MAX(added->size, 1));
+    if (snap->slices == NULL || snap->added == NULL)
+        goto oopsie;
+
+    if (original->data && original->shared == NULL) {
+        SharedData *shared = malloc(sizeof(SharedData));
+        if (shared == NULL)
+            goto oopsie;
+        shared->data = original->data;
+        shared->size = original->size;
+        shared->mapped = original->mapped;
+        shared->refs = 1;
+        original->shared = shared;
+    }
+    snap->original = original->shared;
+    if (snap->original)
+        snap->original->refs++;
+
+    if (added->size > 0)
+        memcpy(snap->added, added->data, added->size);
+
+    for (size_t i = 0; i < table->num_pieces; i++) {
+        Piece *piece = &table->pieces[i];
+        const char *base = (piece->source == SOURCE_ORIGINAL) ? original->data : snap->added;
+        snap->slices[i] = (SaveSlice) {
+            .data = base + piece->offset,
+            .size = piece->length,
+        };
+    }
+    snap->num_slices = table->num_pieces;
+    return snap;
+
+oopsie:
+    free(snap->slices);
+    free(snap->added);
+    free(snap);
+    return NULL;
+}
+
+void PieceTableSnapshot_free(PieceTableSnapshot *snap)
+{
+    if (snap->original)
+        dropSharedData(snap->original);
+    free(snap->slices);
+    free(snap->added);
+    free(snap);
+}
+
+/////////////////////////////////////////////////////////////////
+// Files                                                       //
+/////////////////////////////////////////////////////////////////
+
+#ifndef GAPBUFFER_NOIO
+#include <stdio.h>
+
+/* Symbol: loadOriginal
+**   Make the contents of [file] the original source of an
+**   empty table. Where possible the file is mapped in memory
+**   instead of being read, which makes loading constant time.
+*/
+static bool loadOriginal(PieceTable *table, const char *file)
+{
+    Source *src = &table->sources[SOURCE_ORIGINAL];
+    assert(src->data == NULL);
+
+#ifdef PIECETABLE_MMAP
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size_t size = info.st_size;
+
+    if (size > 0) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        src->data = data;
+        src->mapped = true;
+    }
+    close(fd);
+#else
+    FILE *stream = fopen(file, "rb");
+    if (stream == NULL)
+        return false;
+
+    long size = -1;
+    if (!fseek(stream, 0, SEEK_END)) {
+        size = ftell(stream);
+        if (fseek(stream, 0, SEEK_SET))
+            size = -1;
+    }
+
+    char *data = size < 0 ? NULL : malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, stream) != (size_t) size) {
+        free(data);
+        fclose(stream);
+        return false;
+    }
+    fclose(stream);
+    src->data = data;
+#endif
+
+    src->size = size;
+    src->capacity = size;
+    return true;
+}
+
+/* Symbol: PieceTable_insertFile
+**
+**   Insert the contents of [file] at the cursor, then move
+**   the cursor to the start of the text.
+**
+**   If the table is empty the file becomes its original
+**   source, otherwise it's copied in the add buffer. Only
+**   copied files are validated as UTF-8: validating the
+**   original source would read all of it, which is what
+**   mapping it avoids. Its invalid bytes are shown as '?'.
+*/
+bool PieceTable_insertFile(PieceTable *table, const char *file)
+{
+    if (table->size == 0 && table->sources[SOURCE_ORIGINAL].data == NULL) {
+
+        if (!loadOriginal(table, file))
+            return false;
+
+        Source *src = &table->sources[SOURCE_ORIGINAL];
+        if (src->size > 0) {
+            if (!reservePieces(table, 1)) {
+                releaseSource(src);
+                return false;
+            }
+            table->pieces[0] = (Piece) {
+                .source = SOURCE_ORIGINAL,
+                .offset = 0,
+                .length = src->size,
+                .newlines = UNKNOWN_NEWLINES,
+            };
+            table->num_pieces = 1;
+            table->size = src->size;
+            table->uncounted = src->size;
+
+            // Small files are counted right away. The lines of
+            // larger ones are estimated from their first chunks.
+            indexChunks(src, INDEX_SAMPLE_CHUNKS);
+            if (src->size <= INDEX_SAMPLE_CHUNKS * INDEX_CHUNK_SIZE)
+                setPieceNewlines(table, 0, countSourceNewlines(src, 0, src->size));
+            else
+                estimateNewlines(table);
+        }
+
+    } else {
+
+        FILE *stream = fopen(file, "rb");
+        if (stream == NULL)
+            return false;
+
+        // The last symbol of a read may be cut, so it's kept
+        // and validated along with the bytes of the next one.
+        char buffer[1 << 16];
+        size_t offset = table->cursor;
+        size_t kept = 0;
+        size_t num;
+        bool failed = false;
+        while (!failed && (num = fread(buffer + kept, 1, sizeof(buffer) - kept, stream)) > 0) {
+            num += kept;
+
+            size_t end = num - 1;
+            while (end > 0 && num - end < 4 && (buffer[end] & 0xC0) == 0x80)
+                end--;
+            if ((buffer[end] & 0xC0) == 0x80)
+                end = num; // Not valid anyway
+
+            failed = !UTF8_isValid(buffer, end) || !insertBytes(table, offset, buffer, end);
+            if (!failed) {
+                offset += end;
+                kept = num - end;
+                memmove(buffer, buffer + end, kept);
+            }
+        }
+        if (!failed && kept > 0) {
+            failed = !UTF8_isValid(buffer, kept) || !insertBytes(table, offset, buffer, kept);
+            if (!failed)
+                offset += kept;
+        }
+        failed = failed || ferror(stream);
+        fclose(stream);
+
+        if (failed) {
+            removeBytes(table, table->cursor, offset - table->cursor);
+            return false;
+        }
+    }
+
+    PieceTable_moveAbsolute(table, 0);
+    return true;
+}
+
+bool PieceTable_saveTo(PieceTable *table, const char *file)
+{
+    SaveSlice *slices = malloc(MAX(table->num_pieces, 1) * sizeof(SaveSlice));
+    if (slices == NULL)
+        return false;
+
+    for (size_t i = 0; i < table->num_pieces; i++) {
+        Piece *piece = &table->pieces[i];
+        slices[i] = (SaveSlice) {
+            .data = getPieceData(table, piece),
+            .size = piece->length,
+        };
+    }
+    bool ok = Save_writeSlices(file, slices, table->num_pieces);
+    free(slices);
+    return ok;
+}
+
+bool PieceTableSnapshot_saveTo(PieceTableSnapshot *snap, const char *file)
+{
+    return Save_writeSlices(file, snap->slices, snap->num_slices);
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gap_buffer.h"
+
+typedef struct PieceTable PieceTable;
+typedef struct PieceTableSnapshot PieceTableSnapshot;
+
+PieceTable *PieceTable_create(void);
+void        PieceTable_destroy(PieceTable *table);
+void        PieceTable_whipeClean(PieceTable *table);
+void        PieceTable_copyDataOut(PieceTable *table, char *dst, size_t max);
+const char *PieceTable_getSlice(PieceTable *table, size_t offset, size_t *len);
+bool        PieceTable_insertString(PieceTable *table, const char *str, size_t len);
+void        PieceTable_moveRelativeVertically(PieceTable *table, bool up);
+size_t      PieceTable_moveRelative(PieceTable *table, int off);
+size_t      PieceTable_moveAbsolute(PieceTable *table, size_t num);
+void        PieceTable_moveAbsoluteRaw(PieceTable *table, size_t num);
+size_t      PieceTable_removeForwards(PieceTable *table, size_t num);
+void        PieceTable_removeForwardsRaw(PieceTable *table, size_t num);
+size_t      PieceTable_removeBackwards(PieceTable *table, size_t num);
+bool        PieceTable_applyEdits(PieceTable *table, const GapBufferEdit *edits, size_t count);
+size_t      PieceTable_getByteCount(PieceTable *table);
+size_t      PieceTable_getColumn(PieceTable *table);
+size_t      PieceTable_getTargetColumn(PieceTable *table);
+size_t      PieceTable_getCursor(PieceTable *table);
+size_t      PieceTable_getLineCount(PieceTable *table);
+size_t      PieceTable_getLineOffset(PieceTable *table, size_t line);
+size_t      PieceTable_getLineIndex(PieceTable *table, size_t offset);
+size_t      PieceTable_skipForwards(PieceTable *table, size_t offset, size_t num);
+size_t      PieceTable_skipBackwards(PieceTable *table, size_t offset, size_t num);
+bool        PieceTable_nextLine(PieceTable *table, size_t *offset, const char **str, size_t *len, void **mem);
+void        PieceTable_freeLine(void *mem);
+PieceTableSnapshot *PieceTable_snapshot(PieceTable *table);
+void                PieceTableSnapshot_free(PieceTableSnapshot *snap);
+
+#ifndef GAPBUFFER_NOIO
+bool PieceTable_insertFile(PieceTable *table, const char *file);
+bool PieceTable_saveTo(PieceTable *table, const char *file);
+bool PieceTableSnapshot_saveTo(PieceTableSnapshot *snap, const char *file);
+#endif
+
+#endif
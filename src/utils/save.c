@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include "save.h"
+
+/* Saving
+**
+**   Files are saved by writing the text to a temporary file
+**   in the same directory as the target, flushing it to the
+**   disk and renaming it over the target. The rename is atomic,
+**   so readers of the file (and the editor itself, which may
+**   have the old file mapped in memory) see either the old or
+**   the new version, never a partially written one, and a crash
+**   halfway through leaves the old version intact.
+**
+**   Big files take a while to write, so saves can run on a
+**   worker thread that writes a snapshot of the buffer while
+**   it's still being edited (see Save_start).
+*/
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#endif
+
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+
+#ifndef _WIN32
+
+// Slices are handed to writev in groups of this size
+#ifdef IOV_MAX
+#define SAVE_MAX_IOVECS MIN(IOV_MAX, 1024)
+#else
+#define SAVE_MAX_IOVECS 16
+#endif
+
+// Write all the [slices] to [fd] with as few calls as possible
+static bool writeSlices(int fd, const SaveSlice *slices, size_t num)
+{
+    size_t i = 0;    // First slice that wasn't completely written
+    size_t skip = 0; // Bytes of the [i]-th slice that were written
+
+    while (i < num) {
+
+        struct iovec iov[SAVE_MAX_IOVECS];
+        size_t count = 0;
+        for (size_t k = i; k < num && count < SAVE_MAX_IOVECS; k++) {
+            size_t offset = (k == i) ? skip : 0;
+            if (slices[k].size > offset)
+                iov[count++] = (struct iovec) {
+                    .iov_base = (char*) slices[k].data + offset,
+                    .iov_len  = slices[k].size - offset,
+                };
+        }
+        if (count == 0)
+            break;
+
+        ssize_t written = writev(fd, iov, count);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // Skip what was written, which may end in
+        // the middle of a slice.
+        size_t left = written;
+        while (i < num && slices[i].size - skip <= left) {
+            left -= slices[i].size - skip;
+            skip = 0;
+            i++;
+        }
+        skip += left;
+    }
+    return true;
+}
+
+// Flush the directory containing [file], so that the
+// rename that replaced it survives a crash.
+static void syncDirectory(const char *file)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(file, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == file)
+        strcpy(dir, "/");
+    else {
+        size_t len = slash - file;
+        if (len >= sizeof(dir))
+            return;
+        memcpy(dir, file, len);
+        dir[len] = '\0';
+    }
+
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0)
+        return;
+    fsync(fd); // Not all file systems support this, so errors are ignored
+    close(fd);
+}
+
+static mode_t file_mask;
+static pthread_once_t file_mask_once = PTHREAD_ONCE_INIT;
+
+static void readFileMask(void)
+{
+    // The mask can only be read by setting it
+    file_mask = umask(0);
+    umask(file_mask);
+}
+
+/* Symbol: getFileMask
+**   Returns the umask of the process. It's read once, by
+**   Save_start before it starts any worker, since other
+**   threads creating files while it's changed would get
+**   the wrong permissions.
+*/
+static mode_t getFileMask(void)
+{
+    pthread_once(&file_mask_once, readFileMask);
+    return file_mask;
+}
+
+/* Symbol: Save_writeSlices
+**
+**   Replace [file] with the concatenation of the [slices],
+**   atomically. Returns false if the file couldn't be
+**   written, in which case it's left untouched.
+**
+**   The new file keeps the permissions of the old one, or
+**   gets those fopen would give it if there was none.
+*/
+bool Save_writeSlices(const char *file, const SaveSlice *slices, size_t num)
+{
+    char temp[PATH_MAX];
+    if ((size_t) snprintf(temp, sizeof(temp), "%s.XXXXXX", file) >= sizeof(temp))
+        return false;
+
+    int fd = mkstemp(temp);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    mode_t mode = 0666 & ~getFileMask();
+    if (stat(file, &info) == 0)
+        mode = info.st_mode & 07777;
+
+    bool ok = fchmod(fd, mode) == 0
+           && writeSlices(fd, slices, num)
+           && fsync(fd) == 0;
+
+    if (close(fd))
+        ok = false;
+
+    if (ok && rename(temp, file) == 0) {
+        syncDirectory(file);
+        return true;
+    }
+    unlink(temp);
+    return false;
+}
+
+#else
+
+bool Save_writeSlices(const char *file, const SaveSlice *slices, size_t num)
+{
+    char temp[MAX_PATH];
+    if ((size_t) snprintf(temp, sizeof(temp), "%s.tmp", file) >= sizeof(temp))
+        return false;
+
+    FILE *stream = fopen(temp, "wb");
+    if (stream == NULL)
+        return false;
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < num; i++)
+        ok = fwrite(slices[i].data, 1, slices[i].size, stream) == slices[i].size;
+    ok = ok && fflush(stream) == 0 && _commit(_fileno(stream)) == 0;
+    if (fclose(stream))
+        ok = false;
+
+    if (ok && MoveFileExA(temp, file, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        return true;
+    remove(temp);
+    return false;
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////
+// Background saves                                            //
+/////////////////////////////////////////////////////////////////
+
+struct SaveJob {
+    GapBufferSnapshot *snap;
+    char *file;
+    bool  ok;
+#ifndef _WIN32
+    pthread_t   thread;
+    atomic_bool done;
+#endif
+};
+
+#ifndef _WIN32
+static void *runJob(void *arg)
+{
+    SaveJob *job = arg;
+    job->ok = GapBufferSnapshot_saveTo(job->snap, job->file);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+#endif
+
+/* Symbol: Save_start
+**
+**   Start writing [snap] to [file] on a worker thread. The job
+**   takes ownership of the snapshot, which is freed by
+**   Save_finish. Returns NULL if the job couldn't be started.
+**
+**   On Windows the file is written before returning.
+*/
+SaveJob *Save_start(GapBufferSnapshot *snap, const char *file)
+{
+    SaveJob *job = malloc(sizeof(SaveJob));
+    if (job == NULL)
+        return NULL;
+
+    size_t len = strlen(file);
+    job->file = malloc(len+1);
+    if (job->file == NULL) {
+        free(job);
+        return NULL;
+    }
+    memcpy(job->file, file, len+1);
+    job->snap = snap;
+    job->ok = false;
+
+#ifdef _WIN32
+    job->ok = GapBufferSnapshot_saveTo(snap, file);
+#else
+    getFileMask();
+    atomic_init(&job->done, false);
+    if (pthread_create(&job->thread, NULL, runJob, job)) {
+        free(job->file);
+        free(job);
+        return NULL;
+    }
+#endif
+    return job;
+}
+
+/* Symbol: Save_poll
+**   Returns true if the job is over, in which case
+**   Save_finish returns without waiting.
+*/
+bool Save_poll(SaveJob *job)
+{
+#ifdef _WIN32
+    (void) job;
+    return true;
+#else
+    return atomic_load(&job->done);
+#endif
+}
+
+/* Symbol: Save_finish
+**   Wait for the job to be over and free it along with its
+**   snapshot. Returns true if the file was saved.
+**
+**   Snapshots must be freed by the thread that edits the
+**   buffer they were taken from, so this must be called
+**   by it too.
+*/
+bool Save_finish(SaveJob *job)
+{
+#ifndef _WIN32
+    pthread_join(job->thread, NULL);
+#endif
+    bool ok = job->ok;
+    GapBufferSnapshot_free(job->snap);
+    free(job->file);
+    free(job);
+    return ok;
+}
@@ -0,0 +1,20 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gap_buffer.h"
+
+typedef struct {
+    const char *data;
+    size_t      size;
+} SaveSlice;
+
+typedef struct SaveJob SaveJob;
+
+bool     Save_writeSlices(const char *file, const SaveSlice *slices, size_t num);
+SaveJob *Save_start(GapBufferSnapshot *snap, const char *file);
+bool     Save_poll(SaveJob *job);
+bool     Save_finish(SaveJob *job);
+
+#endif
@@ -0,0 +1,21 @@
+#include "simd.h"
+
+bool cpuHasSSE2(void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+bool cpuHasAVX2(void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,20 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+
+// Vectorized kernels are compiled for specific instruction
+// sets using function attributes, so that the rest of the
+// program doesn't need to be built with -mavx2 and the best
+// kernel can be chosen at runtime.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#endif
+
+bool cpuHasSSE2(void);
+bool cpuHasAVX2(void);
+
+#endif
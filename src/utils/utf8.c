@@ -0,0 +1,759 @@
+#include <string.h>
+#include "simd.h"
+#include "utf8.h"
+
+// Returns true if and only if the [byte] is in the form 10xxxxxx
+static bool isAuxiliaryByte(uint8_t byte)
+{
+    return (byte & 0xC0) == 0x80;
+}
+
+/* Symbol: UTF8_decodeRune
+**
+**   Decode the first unicode symbol of [str] into [rune].
+**
+**   Returns the number of bytes of the symbol, 0 if [len]
+**   is 0 or -1 if the symbol isn't valid UTF-8. Overlong
+**   encodings, surrogates and code points over U+10FFFF
+**   are considered invalid.
+*/
+int UTF8_decodeRune(const char *str, size_t len, uint32_t *rune)
+{
+    if (len == 0)
+        return 0;
+
+    const uint8_t *sym = (const uint8_t*) str;
+
+    if (sym[0] < 0x80) {
+        // It's ASCII
+        // 0xxxxxxx
+        *rune = sym[0];
+        return 1;
+    }
+
+    if (sym[0] >= 0xF8)
+        // No symbol starts with 11111xxx
+        return -1;
+
+    if (sym[0] >= 0xF0) {
+
+        // 4 bytes.
+        // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
+
+        if (len < 4 || !isAuxiliaryByte(sym[1])
+                    || !isAuxiliaryByte(sym[2])
+                    || !isAuxiliaryByte(sym[3]))
+            return -1;
+
+        uint32_t temp
+            = (((uint32_t) sym[0] & 0x07) << 18)
+            | (((uint32_t) sym[1] & 0x3f) << 12)
+            | (((uint32_t) sym[2] & 0x3f) <<  6)
+            | (((uint32_t) sym[3] & 0x3f));
+
+        if (temp < 0x010000 || temp > 0x10ffff)
+            return -1;
+
+        *rune = temp;
+        return 4;
+    }
+
+    if (sym[0] >= 0xE0) {
+
+        // 3 bytes.
+        // 1110xxxx 10xxxxxx 10xxxxxx
+
+        if (len < 3 || !isAuxiliaryByte(sym[1])
+                    || !isAuxiliaryByte(sym[2]))
+            return -1;
+
+        uint32_t temp
+            = (((uint32_t) sym[0] & 0x0f) << 12)
+            | (((uint32_t) sym[1] & 0x3f) <<  6)
+            | (((uint32_t) sym[2] & 0x3f));
+
+        if (temp < 0x0800 || (temp >= 0xd800 && temp <= 0xdfff))
+            return -1;
+
+        *rune = temp;
+        return 3;
+    }
+
+    if (sym[0] >= 0xC0) {
+
+        // 2 bytes.
+        // 110xxxxx 10xxxxxx
+
+        if (len < 2 || !isAuxiliaryByte(sym[1]))
+            return -1;
+
+        uint32_t temp
+            = (((uint32_t) sym[0] & 0x1f) << 6)
+            | (((uint32_t) sym[1] & 0x3f));
+
+        if (temp < 0x80)
+            return -1;
+
+        *rune = temp;
+        return 2;
+    }
+
+    // Auxiliary byte with no leading byte
+    return -1;
+}
+
+size_t UTF8_encodedLength(uint32_t rune)
+{
+    if (rune <= 0x7F)     return 1;
+    if (rune <= 0x7FF)    return 2;
+    if (rune <= 0xFFFF)   return 3;
+    if (rune <= 0x10FFFF) return 4;
+    return 0;
+}
+
+// https://stackoverflow.com/questions/42012563/convert-unicode-code-points-to-utf-8-and-utf-32
+size_t UTF8_encodeRune(char *dst, uint32_t rune)
+{
+    unsigned char *buffer = (unsigned char*) dst;
+
+    if (rune <= 0x7F) {
+        buffer[0] = rune;
+        return 1;
+    }
+    if (rune <= 0x7FF) {
+        buffer[0] = 0xC0 | (rune >> 6);            /* 110xxxxx */
+        buffer[1] = 0x80 | (rune & 0x3F);          /* 10xxxxxx */
+        return 2;
+    }
+    if (rune <= 0xFFFF) {
+        buffer[0] = 0xE0 | (rune >> 12);           /* 1110xxxx */
+        buffer[1] = 0x80 | ((rune >> 6) & 0x3F);   /* 10xxxxxx */
+        buffer[2] = 0x80 | (rune & 0x3F);          /* 10xxxxxx */
+        return 3;
+    }
+    if (rune <= 0x10FFFF) {
+        buffer[0] = 0xF0 | (rune >> 18);           /* 11110xxx */
+        buffer[1] = 0x80 | ((rune >> 12) & 0x3F);  /* 10xxxxxx */
+        buffer[2] = 0x80 | ((rune >> 6) & 0x3F);   /* 10xxxxxx */
+        buffer[3] = 0x80 | (rune & 0x3F);          /* 10xxxxxx */
+        return 4;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} RuneRange;
+
+// Combining marks and other symbols that are drawn over the
+// previous one instead of taking a column of their own
+static const RuneRange zero_width[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A},
+    {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+    {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+};
+
+// East asian wide and fullwidth symbols, which take two columns
+static const RuneRange double_width[] = {
+    {0x1100, 0x115F}, {0x2329, 0x232A}, {0x2E80, 0x303E}, {0x3041, 0x33FF},
+    {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F},
+    {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F}, {0x1F900, 0x1F9FF},
+    {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+static bool inRanges(uint32_t rune, const RuneRange *ranges, size_t num)
+{
+    if (rune < ranges[0].first || rune > ranges[num-1].last)
+        return false;
+
+    size_t lo = 0;
+    size_t hi = num;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (rune < ranges[mid].first)
+            hi = mid;
+        else if (rune > ranges[mid].last)
+            lo = mid + 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+/* Symbol: UTF8_runeWidth
+**   Returns the number of columns [rune] takes when drawn
+**   with a monospace font, which is 0, 1 or 2.
+*/
+int UTF8_runeWidth(uint32_t rune)
+{
+    if (rune < 0x300)
+        return 1;
+    if (inRanges(rune, zero_width, sizeof(zero_width) / sizeof(zero_width[0])))
+        return 0;
+    if (inRanges(rune, double_width, sizeof(double_width) / sizeof(double_width[0])))
+        return 2;
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+// Scalar kernels                                              //
+/////////////////////////////////////////////////////////////////
+
+static bool isValidScalar(const char *str, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+
+        // Skip ASCII 8 bytes at the time
+        if (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, str + i, sizeof(word));
+            if ((word & 0x8080808080808080) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        uint32_t rune; // Unused
+        int n = UTF8_decodeRune(str + i, len - i, &rune);
+        if (n < 0)
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+static size_t skipASCIIScalar(const char *str, size_t len)
+{
+    size_t i = 0;
+    while (i + 8 <= len) {
+        uint64_t word;
+        memcpy(&word, str + i, sizeof(word));
+        if (word & 0x8080808080808080)
+            break;
+        i += 8;
+    }
+    while (i < len && (unsigned char) str[i] < 0x80)
+        i++;
+    return i;
+}
+
+static size_t countRunesScalar(const char *str, size_t len)
+{
+    // Every byte that isn't in the form 10xxxxxx
+    // is the start of a new symbol.
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        if (!isAuxiliaryByte(str[i]))
+            count++;
+    return count;
+}
+
+static size_t skipRunesScalar(const char *str, size_t len, size_t num)
+{
+    // Look for the leading byte of the symbol after
+    // the first [num] symbols.
+    size_t nth = num + 1;
+    for (size_t i = 0; i < len; i++)
+        if (!isAuxiliaryByte(str[i]) && --nth == 0)
+            return i;
+    return len;
+}
+
+// Returns the position of the [nth] bit set in [mask],
+// which is assumed to have at least [nth] bits set.
+static int nthBitSet(uint32_t mask, size_t nth)
+{
+    while (--nth > 0)
+        mask &= mask - 1; // Drop the lowest set bit
+    return __builtin_ctz(mask);
+}
+
+// Decode a single rune, decoding invalid bytes as '?'
+static size_t decodeOne(const char *str, size_t len, uint32_t *rune)
+{
+    int n = UTF8_decodeRune(str, len, rune);
+    if (n < 1) {
+        *rune = '?';
+        n = 1;
+    }
+    return n;
+}
+
+static size_t decodeScalar(const char *str, size_t len, uint32_t *dst,
+                           size_t max, size_t *consumed)
+{
+    size_t i = 0;
+    size_t n = 0;
+    while (i < len && n < max)
+        i += decodeOne(str + i, len - i, &dst[n++]);
+    *consumed = i;
+    return n;
+}
+
+#ifdef SIMD_X86
+
+/////////////////////////////////////////////////////////////////
+// SSE2 kernels                                                //
+/////////////////////////////////////////////////////////////////
+//
+// SSE2 has no byte shuffle, so validation and decoding skip
+// runs of ASCII 16 bytes at the time and fall back to scalar
+// code for the 16-byte blocks containing multi-byte symbols.
+
+TARGET_SSE2 static bool isValidSSE2(const char *str, size_t len)
+{
+    size_t i = 0;
+    while (i + 16 <= len) {
+
+        __m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+        if (_mm_movemask_epi8(block) == 0) {
+            i += 16;
+            continue;
+        }
+
+        // Validate symbol by symbol until the end of the block.
+        // The last symbol may end in the following block.
+        size_t end = i + 16;
+        while (i < end) {
+            uint32_t rune; // Unused
+            int n = UTF8_decodeRune(str + i, len - i, &rune);
+            if (n < 0)
+                return false;
+            i += n;
+        }
+    }
+    return isValidScalar(str + i, len - i);
+}
+
+TARGET_SSE2 static size_t skipASCIISSE2(const char *str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+        int mask = _mm_movemask_epi8(block);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + skipASCIIScalar(str + i, len - i);
+}
+
+TARGET_SSE2 static size_t countRunesSSE2(const char *str, size_t len)
+{
+    // Bytes in the form 10xxxxxx are the only ones
+    // less or equal than 0xBF (-65) when signed.
+    __m128i limit = _mm_set1_epi8(-65);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+        int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(block, limit));
+        count += __builtin_popcount(mask);
+    }
+    return count + countRunesScalar(str + i, len - i);
+}
+
+TARGET_SSE2 static size_t skipRunesSSE2(const char *str, size_t len, size_t num)
+{
+    __m128i limit = _mm_set1_epi8(-65);
+
+    size_t nth = num + 1;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpgt_epi8(block, limit));
+        size_t count = __builtin_popcount(mask);
+        if (count >= nth)
+            return i + nthBitSet(mask, nth);
+        nth -= count;
+    }
+    return i + skipRunesScalar(str + i, len - i, nth - 1);
+}
+
+TARGET_SSE2 static size_t decodeSSE2(const char *str, size_t len, uint32_t *dst,
+                                     size_t max, size_t *consumed)
+{
+    __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    size_t n = 0;
+    while (i + 16 <= len && n + 16 <= max) {
+
+        __m128i block = _mm_loadu_si128((const __m128i*) (str + i));
+
+        if (_mm_movemask_epi8(block) == 0) {
+            // Widen the 16 ASCII bytes to 16 runes
+            __m128i lo = _mm_unpacklo_epi8(block, zero);
+            __m128i hi = _mm_unpackhi_epi8(block, zero);
+            _mm_storeu_si128((__m128i*) (dst + n +  0), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*) (dst + n +  4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*) (dst + n +  8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i*) (dst + n + 12), _mm_unpackhi_epi16(hi, zero));
+            i += 16;
+            n += 16;
+        } else {
+            size_t end = i + 16;
+            while (i < end && n < max)
+                i += decodeOne(str + i, len - i, &dst[n++]);
+        }
+    }
+
+    size_t tail;
+    n += decodeScalar(str + i, len - i, dst + n, max - n, &tail);
+    *consumed = i + tail;
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+// AVX2 kernels                                                //
+/////////////////////////////////////////////////////////////////
+//
+// The validation is the lookup algorithm by Keiser and Lemire
+// ("Validating UTF-8 In Less Than One Instruction Per Byte").
+// Every pair of consecutive bytes is classified by looking up
+// the high and low nibble of the first byte and the high nibble
+// of the second byte in three tables of error flags. The error
+// flags common to all three lookups are the errors that pair
+// of bytes contains. Continuation bytes that are the third or
+// fourth of a symbol are then checked using the bytes that
+// precede them by 2 and 3 positions.
+
+#define TOO_SHORT      (1 << 0) // 11______ 0_______ or 11______ 11______
+#define TOO_LONG       (1 << 1) // 0_______ 10______
+#define OVERLONG_3     (1 << 2) // 11100000 100_____
+#define TOO_LARGE      (1 << 3) // 11110100 1001____ or greater
+#define SURROGATE      (1 << 4) // 11101101 101_____
+#define OVERLONG_2     (1 << 5) // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101 1000____ or greater
+#define OVERLONG_4     (1 << 6) // 11110000 1000____
+#define TWO_CONTS      (1 << 7) // 10______ 10______
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define B(X) ((char) (X))
+#define TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// Returns the bytes of [input] shifted by [N] positions,
+// taking the first [N] bytes from the end of [prev].
+#define PREV(input, prev, N) \
+    _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - (N))
+
+typedef struct {
+    __m256i error;
+    __m256i prev_input;
+    __m256i prev_incomplete;
+} ValidatorAVX2;
+
+TARGET_AVX2 static void validateBlockAVX2(ValidatorAVX2 *state, __m256i input)
+{
+    if (_mm256_movemask_epi8(input) == 0) {
+        // All ASCII. It's only an error if the
+        // previous block ended with a truncated
+        // symbol.
+        state->error = _mm256_or_si256(state->error, state->prev_incomplete);
+        state->prev_incomplete = _mm256_setzero_si256();
+        state->prev_input = input;
+        return;
+    }
+
+    const __m256i byte_1_high_table = TABLE(
+        // 0_______ ________ <ASCII in byte 1>
+        B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+        B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+        // 10______ ________ <continuation in byte 1>
+        B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS),
+        // 1100____ ________ <two byte lead in byte 1>
+        B(TOO_SHORT | OVERLONG_2),
+        // 1101____ ________ <two byte lead in byte 1>
+        B(TOO_SHORT),
+        // 1110____ ________ <three byte lead in byte 1>
+        B(TOO_SHORT | OVERLONG_3 | SURROGATE),
+        // 1111____ ________ <four+ byte lead in byte 1>
+        B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+    );
+
+    const __m256i byte_1_low_table = TABLE(
+        // ____0000 ________
+        B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        // ____0001 ________
+        B(CARRY | OVERLONG_2),
+        // ____001_ ________
+        B(CARRY),
+        B(CARRY),
+        // ____0100 ________
+        B(CARRY | TOO_LARGE),
+        // ____0101 ________
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____011_ ________
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____1___ ________
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____1101 ________
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        B(CARRY | TOO_LARGE | TOO_LARGE_1000)
+    );
+
+    const __m256i byte_2_high_table = TABLE(
+        // ________ 0_______ <ASCII in byte 2>
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+        // ________ 1000____
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+        // ________ 1001____
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        // ________ 101_____
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+        B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+        // ________ 11______
+        B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT)
+    );
+
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i prev1 = PREV(input, state->prev_input, 1);
+    __m256i prev2 = PREV(input, state->prev_input, 2);
+    __m256i prev3 = PREV(input, state->prev_input, 3);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte_1_low  = _mm256_shuffle_epi8(byte_1_low_table,  _mm256_and_si256(prev1, nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // Only 111_____ and 1111____ lead bytes will be >= 0x80
+    __m256i is_third_byte  = _mm256_subs_epu8(prev2, _mm256_set1_epi8(B(0xE0 - 0x80)));
+    __m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(B(0xF0 - 0x80)));
+    __m256i must_be_2_3_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8(B(0x80)));
+
+    __m256i error = _mm256_xor_si256(must_be_2_3_continuation, special_cases);
+    state->error = _mm256_or_si256(state->error, error);
+
+    // If one of the last 3 bytes is a leading byte
+    // requiring more bytes than what's left in the
+    // block, the symbol continues in the next block.
+    const __m256i max_value = _mm256_setr_epi8(
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+        B(255), B(255), B(255), B(255), B(255), B(0xF0 - 1), B(0xE0 - 1), B(0xC0 - 1)
+    );
+    state->prev_incomplete = _mm256_subs_epu8(input, max_value);
+    state->prev_input = input;
+}
+
+TARGET_AVX2 static bool isValidAVX2(const char *str, size_t len)
+{
+    ValidatorAVX2 state;
+    state.error = _mm256_setzero_si256();
+    state.prev_input = _mm256_setzero_si256();
+    state.prev_incomplete = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+        validateBlockAVX2(&state, _mm256_loadu_si256((const __m256i*) (str + i)));
+
+    if (i < len) {
+        // Pad the last block with zeros, which are ASCII
+        // and make truncated symbols at the end an error.
+        char tail[32] = {0};
+        memcpy(tail, str + i, len - i);
+        validateBlockAVX2(&state, _mm256_loadu_si256((const __m256i*) tail));
+    }
+
+    __m256i error = _mm256_or_si256(state.error, state.prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+TARGET_AVX2 static size_t skipASCIIAVX2(const char *str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+        uint32_t mask = _mm256_movemask_epi8(block);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + skipASCIIScalar(str + i, len - i);
+}
+
+TARGET_AVX2 static size_t countRunesAVX2(const char *str, size_t len)
+{
+    __m256i limit = _mm256_set1_epi8(-65);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, limit));
+        count += __builtin_popcount(mask);
+    }
+    return count + countRunesScalar(str + i, len - i);
+}
+
+TARGET_AVX2 static size_t skipRunesAVX2(const char *str, size_t len, size_t num)
+{
+    __m256i limit = _mm256_set1_epi8(-65);
+
+    size_t nth = num + 1;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, limit));
+        size_t count = __builtin_popcount(mask);
+        if (count >= nth)
+            return i + nthBitSet(mask, nth);
+        nth -= count;
+    }
+    return i + skipRunesScalar(str + i, len - i, nth - 1);
+}
+
+TARGET_AVX2 static size_t decodeAVX2(const char *str, size_t len, uint32_t *dst,
+                                     size_t max, size_t *consumed)
+{
+    size_t i = 0;
+    size_t n = 0;
+    while (i + 32 <= len && n + 32 <= max) {
+
+        __m256i block = _mm256_loadu_si256((const __m256i*) (str + i));
+
+        if (_mm256_movemask_epi8(block) == 0) {
+            // Widen the 32 ASCII bytes to 32 runes
+            __m128i lo = _mm256_castsi256_si128(block);
+            __m128i hi = _mm256_extracti128_si256(block, 1);
+            _mm256_storeu_si256((__m256i*) (dst + n +  0), _mm256_cvtepu8_epi32(lo));
+            _mm256_storeu_si256((__m256i*) (dst + n +  8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+            _mm256_storeu_si256((__m256i*) (dst + n + 16), _mm256_cvtepu8_epi32(hi));
+            _mm256_storeu_si256((__m256i*) (dst + n + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+            i += 32;
+            n += 32;
+        } else {
+            size_t end = i + 32;
+            while (i < end && n < max)
+                i += decodeOne(str + i, len - i, &dst[n++]);
+        }
+    }
+
+    size_t tail;
+    n += decodeScalar(str + i, len - i, dst + n, max - n, &tail);
+    *consumed = i + tail;
+    return n;
+}
+
+#endif /* SIMD_X86 */
+
+/////////////////////////////////////////////////////////////////
+// Runtime dispatch                                            //
+/////////////////////////////////////////////////////////////////
+
+typedef struct {
+    bool   (*isValid)(const char *str, size_t len);
+    size_t (*skipASCII)(const char *str, size_t len);
+    size_t (*countRunes)(const char *str, size_t len);
+    size_t (*skipRunes)(const char *str, size_t len, size_t num);
+    size_t (*decode)(const char *str, size_t len, uint32_t *dst, size_t max, size_t *consumed);
+} Kernels;
+
+static Kernels kernels;
+static bool kernels_selected = false;
+
+static void selectKernels(void)
+{
+    kernels.isValid    = isValidScalar;
+    kernels.skipASCII  = skipASCIIScalar;
+    kernels.countRunes = countRunesScalar;
+    kernels.skipRunes  = skipRunesScalar;
+    kernels.decode     = decodeScalar;
+
+#ifdef SIMD_X86
+    if (cpuHasAVX2()) {
+        kernels.isValid    = isValidAVX2;
+        kernels.skipASCII  = skipASCIIAVX2;
+        kernels.countRunes = countRunesAVX2;
+        kernels.skipRunes  = skipRunesAVX2;
+        kernels.decode     = decodeAVX2;
+    } else if (cpuHasSSE2()) {
+        kernels.isValid    = isValidSSE2;
+        kernels.skipASCII  = skipASCIISSE2;
+        kernels.countRunes = countRunesSSE2;
+        kernels.skipRunes  = skipRunesSSE2;
+        kernels.decode     = decodeSSE2;
+    }
+#endif
+
+    kernels_selected = true;
+}
+
+/* Symbol: UTF8_isValid
+**   Returns true if and only if [str] only contains
+**   complete and valid UTF-8 symbols.
+*/
+bool UTF8_isValid(const char *str, size_t len)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.isValid(str, len);
+}
+
+/* Symbol: UTF8_skipASCII
+**   Returns the offset of the first byte of [str]
+**   that isn't ASCII, or [len] if they all are.
+*/
+size_t UTF8_skipASCII(const char *str, size_t len)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.skipASCII(str, len);
+}
+
+/* Symbol: UTF8_countRunes
+**   Returns the number of symbols in [str], which is
+**   assumed to be valid UTF-8.
+*/
+size_t UTF8_countRunes(const char *str, size_t len)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.countRunes(str, len);
+}
+
+/* Symbol: UTF8_skipRunes
+**   Returns the byte offset of the symbol following the
+**   first [num] symbols of [str], or [len] if there aren't
+**   that many. [str] is assumed to be valid UTF-8.
+*/
+size_t UTF8_skipRunes(const char *str, size_t len, size_t num)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.skipRunes(str, len, num);
+}
+
+/* Symbol: UTF8_decode
+**
+**   Decode the symbols of [str] into [dst] until the end
+**   of the string or until [max] runes were written.
+**
+**   Returns the number of runes written and stores in
+**   [consumed] the number of bytes that were decoded.
+**   Bytes that aren't valid UTF-8 are decoded as '?' one
+**   at the time, so every rune decodes from exactly
+**   UTF8_encodedLength(rune) bytes.
+*/
+size_t UTF8_decode(const char *str, size_t len, uint32_t *dst,
+                   size_t max, size_t *consumed)
+{
+    if (!kernels_selected)
+        selectKernels();
+    return kernels.decode(str, len, dst, max, consumed);
+}
@@ -0,0 +1,18 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+int    UTF8_decodeRune(const char *str, size_t len, uint32_t *rune);
+size_t UTF8_encodeRune(char *dst, uint32_t rune);
+size_t UTF8_encodedLength(uint32_t rune);
+int    UTF8_runeWidth(uint32_t rune);
+bool   UTF8_isValid(const char *str, size_t len);
+size_t UTF8_skipASCII(const char *str, size_t len);
+size_t UTF8_countRunes(const char *str, size_t len);
+size_t UTF8_skipRunes(const char *str, size_t len, size_t num);
+size_t UTF8_decode(const char *str, size_t len, uint32_t *dst, size_t max, size_t *consumed);
+
+#endif
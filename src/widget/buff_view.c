@@ -7,173 +7,12 @@
 #include "../spawn_dialog.h"
 #include "buff_view.h"
 
-int UTF8ToUTF32(const char *utf8_data, int nbytes, uint32_t *utf32_code)
-{
-    assert(utf8_data != NULL);
-    assert(utf32_code != NULL);
-    assert(nbytes >= 0);
-
-    if(nbytes == 0)
-        return -1;
-
-    if(utf8_data[0] & 0x80) {
-
-        // May be UTF-8.
-            
-        if((unsigned char) utf8_data[0] >= 0xF0) {
-            // 4 bytes.
-            // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-
-            if(nbytes < 4)
-                return -1;
-                    
-            uint32_t temp 
-                = (((uint32_t) utf8_data[0] & 0x07) << 18) 
-                | (((uint32_t) utf8_data[1] & 0x3f) << 12)
-                | (((uint32_t) utf8_data[2] & 0x3f) <<  6)
-                | (((uint32_t) utf8_data[3] & 0x3f));
-
-            if(temp > 0x10ffff)
-                return -1;
-
-            *utf32_code = temp;
-            return 4;
-        }
-            
-        if((unsigned char) utf8_data[0] >= 0xE0) {
-            // 3 bytes.
-            // 1110xxxx 10xxxxxx 10xxxxxx
-
-            if(nbytes < 3)
-                return -1;
-
-            uint32_t temp
-                = (((uint32_t) utf8_data[0] & 0x0f) << 12)
-                | (((uint32_t) utf8_data[1] & 0x3f) <<  6)
-                | (((uint32_t) utf8_data[2] & 0x3f));
-                    
-            if(temp > 0x10ffff)
-                return -1;
-
-            *utf32_code = temp;
-            return 3;
-        }
-            
-        if((unsigned char) utf8_data[0] >= 0xC0) {
-            // 2 bytes.
-            // 110xxxxx 10xxxxxx
-
-            if(nbytes < 2)
-                return -1;
-
-            *utf32_code 
-                = (((uint32_t) utf8_data[0] & 0x1f) << 6)
-                | (((uint32_t) utf8_data[1] & 0x3f));
-                    
-            assert(*utf32_code <= 0x10ffff);
-            return 2;
-        }
-        
-        return -1;
-    }
-
-    // It's ASCII
-    // 0xxxxxxx
-
-    *utf32_code = (uint32_t) utf8_data[0];
-    return 1;
-}
-
-static float 
-renderString(Font font, const char *str, size_t len,
-             int off_x, int off_y, float font_size, 
-             Color tint)
-{
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    int   y = off_y;
-    float x = off_x; // Offset X to next character to draw
-
-    float spacing = 0;
-    float scale = (float) font_size / font.baseSize; // Character quad scaling factor
-
-    size_t i = 0;
-    while (i < len) {
-
-        uint32_t codepoint;
-        int consumed = UTF8ToUTF32(str + i, len - i, &codepoint);
-
-        if (consumed < 1) {
-            codepoint = '?';
-            consumed = 1;
-        }
-
-        assert(consumed > 0);
-        int glyph_index = GetGlyphIndex(font, codepoint);
-
-        assert(codepoint != '\n');
-
-        if (codepoint != ' ' && codepoint != '\t') {
-            Vector2 position = {x, y};
-            DrawTextCodepoint(font, codepoint, position, 
-                              font_size, tint);
-        }
-
-        float delta;
-        int advance_x = font.glyphs[glyph_index].advanceX;
-        if (advance_x == 0)
-            delta = (float) font.recs[glyph_index].width * scale + spacing;
-        else 
-            delta = (float) advance_x * scale + spacing;
-
-        x += delta;
-        i += consumed;
-    }
-    float w = x - (float) off_x;
-    return w;
-}
-
-static float 
-stringRenderWidth(Font font, int font_size, const char *str, size_t len)
-{
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    float scale = (float) font_size / font.baseSize;
-    float  w = 0;
-    size_t i = 0;
-    while (i < len) {
-
-        int consumed;
-        int letter = GetCodepoint(str + i, &consumed);
-        assert(letter != '\n');
-
-        int glyph_index = GetGlyphIndex(font, letter);
-
-        if (letter == 0x3f)
-            i++;
-        else
-            i += consumed;
-
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
-
-        w += delta;
-    }
-    return w;
-}
-
 #define MAX_BUFFERS 32
 
 static void handleEvent(Widget *widget, Event event);
 static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area);
 static void free_(Widget *widget);
+static void checkSaveProgress(BufferView *bufview);
 
 static bool initialized = false;
 static BufferView buffers[MAX_BUFFERS];
@@ -205,63 +44,149 @@ static void freeStructMemory(BufferView *bufview)
     used_buffers[i] = false;
 }
 
-BufferView *createBufferView(WidgetStyle *base_style, BufferViewStyle *style)
+static void changedLines(void *data, size_t first, size_t removed, size_t inserted);
+
+static void attachDocument(BufferView *bufview, Document *doc)
 {
-    BufferView *bufview = allocStructMemory();
+    bufview->doc = doc;
+    Document_addAnchor(doc, &bufview->cursor, 0);
+    Document_addAnchor(doc, &bufview->select_first,  0);
+    Document_addAnchor(doc, &bufview->select_second, 0);
+    Document_addListener(doc, &bufview->listener);
+}
 
-    GapBuffer *gap;
-    {
-        size_t len = 1 << 16;
-        void  *mem = malloc(len);
-        if (mem == NULL) {
-            freeStructMemory(bufview);
-            return NULL;
-        }
-        gap = GapBuffer_createUsingMemory(mem, len, free);
-        if (gap == NULL) {
+static void detachDocument(BufferView *bufview)
+{
+    Document *doc = bufview->doc;
+    Document_removeListener(doc, &bufview->listener);
+    Document_removeAnchor(doc, &bufview->select_second);
+    Document_removeAnchor(doc, &bufview->select_first);
+    Document_removeAnchor(doc, &bufview->cursor);
+    Document_release(doc);
+    bufview->doc = NULL;
+}
+
+/* Symbol: createBufferView
+**
+**   Returns a view on [doc], or on a new empty document if
+**   [doc] is NULL. Views on the same document share its text,
+**   so any number of them costs about as much memory as one.
+**   Returns NULL if there's no memory.
+*/
+BufferView *createBufferView(WidgetStyle *base_style, BufferViewStyle *style, Document *doc)
+{
+    BufferView *bufview = allocStructMemory();
+    if (bufview == NULL)
+        return NULL;
+
+    if (doc)
+        doc = Document_acquire(doc);
+    else {
+        doc = Document_create();
+        if (doc == NULL) {
             freeStructMemory(bufview);
-            free(mem);
             return NULL;
         }
     }
 
+    GlyphTable *glyphs = FontCache_acquire(NULL, 14, false);
+    if (glyphs == NULL) {
+        Document_release(doc);
+        freeStructMemory(bufview);
+        return NULL;
+    }
+
+    LineCache *lines = LineCache_create();
+    if (lines == NULL) {
+        FontCache_release(glyphs);
+        Document_release(doc);
+        freeStructMemory(bufview);
+        return NULL;
+    }
+
+    LineWidths *widths = LineWidths_create();
+    if (widths == NULL || !LineWidths_reset(widths, Document_getLineCount(doc))) {
+        LineWidths_destroy(widths);
+        LineCache_destroy(lines);
+        FontCache_release(glyphs);
+        Document_release(doc);
+        freeStructMemory(bufview);
+        return NULL;
+    }
+
     initWidget(&bufview->base, base_style, draw, free_, handleEvent);
     bufview->style = style;
     bufview->loaded_font_file = NULL;
     bufview->loaded_font_size = 14;
-    bufview->loaded_font = GetFontDefault();
+    bufview->loaded_font_sdf  = false;
+    bufview->glyphs = glyphs;
+    bufview->lines = lines;
     bufview->selecting = false;
-    bufview->select_first  = 0;
-    bufview->select_second = 0;
-    bufview->gap = gap;
-    bufview->file[0] = '\0';
+    bufview->listener.data = bufview;
+    bufview->listener.changedLines = changedLines;
+    bufview->widths = widths;
+    attachDocument(bufview, doc);
 
     return bufview;
 }
 
+/* Symbol: getBufferViewDocument
+**   Returns the document shown by [widget], or NULL if it's
+**   not a buffer view.
+*/
+Document *getBufferViewDocument(Widget *widget)
+{
+    if (widget == NULL || widget->free != free_)
+        return NULL;
+    return ((BufferView*) widget)->doc;
+}
+
 static void free_(Widget *widget)
 {
     BufferView *bufview = (BufferView*) widget;
-    UnloadFont(bufview->loaded_font);
-    GapBuffer_destroy(bufview->gap);
+    detachDocument(bufview);
+    LineWidths_destroy(bufview->widths);
+    LineCache_destroy(bufview->lines);
+    FontCache_release(bufview->glyphs);
     freeStructMemory(bufview);
 }
 
+// Lines are measured again as they are drawn
+static void forgetLineWidths(BufferView *bufview)
+{
+    if (!LineWidths_reset(bufview->widths, bufview->doc->line_count))
+        fprintf(stderr, "Couldn't reset line widths\n");
+}
+
+// Called by the document when an edit made through any of
+// the views on it replaced [removed] lines from [first] with
+// [inserted] lines, which are measured again when drawn.
+static void changedLines(void *data, size_t first, size_t removed, size_t inserted)
+{
+    BufferView *bufview = data;
+    if (!LineWidths_splice(bufview->widths, first, removed, inserted))
+        forgetLineWidths(bufview);
+    requestRedraw();
+}
+
 static void reloadFont(BufferView *bufview)
 {
     const char *font_file = bufview->style->font_file;
     float       font_size = bufview->style->font_size;
-
-    Font font;
-    if (bufview->style->font_file)
-        font = LoadFontEx(font_file, font_size, NULL, 250);
-    else
-        font = GetFontDefault();
-
-    UnloadFont(bufview->loaded_font); // FIXME: Is it okay to unload the default font?
-    bufview->loaded_font = font;
+    bool        font_sdf  = bufview->style->font_sdf;
+
+    // Fonts are shared with the other widgets using them.
+    // Distance field fonts are also shared between sizes,
+    // so changing size with them doesn't load anything.
+    GlyphTable *glyphs = FontCache_acquire(font_file, font_size, font_sdf);
+    if (glyphs) {
+        FontCache_release(bufview->glyphs);
+        bufview->glyphs = glyphs;
+        forgetLineWidths(bufview);
+    }
     bufview->loaded_font_file = font_file;
     bufview->loaded_font_size = font_size;
+    bufview->loaded_font_sdf  = font_sdf;
 }
 
 static void reloadStyleIfChanged(BufferView *bufview)
@@ -269,27 +194,35 @@ static void reloadStyleIfChanged(BufferView *bufview)
     if (bufview->style) {
         bool changed_font_file = (bufview->style->font_file != bufview->loaded_font_file);
         bool changed_font_size = (bufview->style->font_size != bufview->loaded_font_size);
-        if (changed_font_file || changed_font_size)
+        bool changed_font_sdf  = (bufview->style->font_sdf  != bufview->loaded_font_sdf);
+        if (changed_font_file || changed_font_size || changed_font_sdf)
             reloadFont(bufview);
     }
 }
 
-static void drawRuler(float x, float y, float h, Font font, int font_size, int ruler_width, Color color) 
+static void drawRuler(float x, float y, float h, GlyphTable *glyphs, int ruler_width, Color color) 
 {
-    float font_width = MeasureTextEx(font, "A", font_size, 0).x;
+    float font_width = GlyphTable_lookup(glyphs, 'A').advance;
     int offset = ruler_width * font_width;
     DrawLine(x + offset, y, x + offset, y + h, color);
 }
 
 static bool somethingSelected(BufferView *bufview)
 {
-    return bufview->select_first != bufview->select_second;
+    return bufview->select_first.offset != bufview->select_second.offset;
 }
 
 static void dropSelection(BufferView *bufview)
 {
-    bufview->select_first  = 0;
-    bufview->select_second = 0;
+    bufview->select_first.offset  = 0;
+    bufview->select_second.offset = 0;
+}
+
+// Lines are found in the line cache by where they start
+// in the current version of the document.
+static LineCacheKey lineKey(BufferView *bufview, size_t line_offset)
+{
+    return (LineCacheKey) {.offset=line_offset, .version=bufview->doc->version};
 }
 
 static void drawSelection(BufferView *bufview, GapBufferLine line, 
@@ -299,10 +232,11 @@ static void drawSelection(BufferView *bufview, GapBufferLine line,
     if (!somethingSelected(bufview))
         return;
         
-    size_t select_start = MIN(bufview->select_first, bufview->select_second);
-    size_t select_end   = MAX(bufview->select_first, bufview->select_second);
+    size_t select_start = MIN(bufview->select_first.offset, bufview->select_second.offset);
+    size_t select_end   = MAX(bufview->select_first.offset, bufview->select_second.offset);
+    size_t line_len     = line.len[0] + line.len[1];
 
-    if (select_start >= line_offset + line.len || select_end < line_offset)
+    if (select_start >= line_offset + line_len || select_end < line_offset)
         return;
 
     size_t select_in_line_start;
@@ -313,18 +247,22 @@ static void drawSelection(BufferView *bufview, GapBufferLine line,
     else
         select_in_line_start = select_start - line_offset;
 
-    if (select_end < line_offset + line.len)
+    if (select_end < line_offset + line_len)
         select_in_line_end = select_end - line_offset;
     else
-        select_in_line_end = line.len;
+        select_in_line_end = line_len;
 
-    Font       font = bufview->loaded_font;
-    float font_size = bufview->loaded_font_size;
+    GlyphTable *glyphs = bufview->glyphs;
+    LineCache  *lines  = bufview->lines;
+
+    LineCacheKey key = lineKey(bufview, line_offset);
+    float start_x = LineCache_measure(lines, glyphs, line, key, select_in_line_start);
+    float   end_x = LineCache_measure(lines, glyphs, line, key, select_in_line_end);
 
     Rectangle selection_rect = {
-        .x = line_x + stringRenderWidth(font, font_size, line.str, select_in_line_start),
+        .x = line_x + start_x,
         .y = line_y,
-        .width  = stringRenderWidth(font, font_size, line.str + select_in_line_start, select_in_line_end - select_in_line_start),
+        .width  = end_x - start_x,
         .height = line_h,
     };
     DrawRectangleRec(selection_rect, (Color) {0x34, 0x37, 0x45, 0xff});
@@ -332,10 +270,9 @@ static void drawSelection(BufferView *bufview, GapBufferLine line,
 
 static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
 {
-    (void) area;
-
     BufferView *bufview = (BufferView*) widget;
     reloadStyleIfChanged(bufview);
+    checkSaveProgress(bufview);
 
     float font_size    = bufview->style->font_size;
     float line_h       = bufview->style->line_h * font_size;
@@ -350,147 +287,114 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
     if (getFocus() != widget)
         cursor_color = GRAY;
 
-    Font      font = bufview->loaded_font;
-    GapBuffer *gap = bufview->gap;
+    GlyphTable *glyphs = bufview->glyphs;
+    GapBuffer *gap = bufview->doc->gap;
     
-    size_t cursor = GapBuffer_rawCursorPosition(gap);
+    size_t cursor = bufview->cursor.offset;
+
+    drawRuler(offset.x, offset.y, bufview->base.last_logic_area.y, glyphs, ruler_x, ruler_color);
+
+    // Only the lines that intersect the viewport are
+    // drawn, so the cost of a frame doesn't depend on
+    // the size of the file.
+    size_t line_count = Document_getLineCount(bufview->doc);
+    float  scroll_y = bufview->base.scroll.y;
+    size_t first_line = 0;
+    if (scroll_y > pad_v)
+        first_line = MIN((scroll_y - pad_v) / line_h, line_count);
+    size_t end_line = MIN(first_line + area.y / line_h + 2, line_count);
 
-    drawRuler(offset.x, offset.y, bufview->base.last_logic_area.y, font, font_size, ruler_x, ruler_color);
+    // Same for the part of the lines that's visible,
+    // which is what matters for long lines.
+    float visible_x0 = bufview->base.scroll.x - pad_h;
+    float visible_x1 = visible_x0 + area.x;
+
+    size_t cursor_line = GapBuffer_getLineIndex(gap, cursor);
 
     GapBufferLine line;
     GapBufferIter iter;
-    GapBufferIter_init(&iter, gap);
-
-    Vector2 logic_area = {0, 0};
+    GapBufferIter_initAtLine(&iter, gap, first_line);
 
     int line_x = offset.x + pad_h;
-    int line_y = offset.y + pad_v;
-    bool   drew_cursor = false;
-    size_t line_offset = 0;
-    size_t  line_count = 0;
-    while (GapBufferIter_next(&iter, &line)) {
+    int line_y = offset.y + pad_v + first_line * line_h;
+    size_t line_offset = GapBuffer_getLineOffset(gap, first_line);
+    size_t  line_index = first_line;
+    while (line_index < end_line && GapBufferIter_next(&iter, &line)) {
 
         drawSelection(bufview, line, line_x, line_y, line_h, line_offset);
         
-        float line_w = renderString(font, line.str, line.len, 
-                                    line_x, line_y, font_size, 
-                                    font_color);
-        
-        logic_area.x = MAX(logic_area.x, 2*pad_h + line_w);
+        float line_w = LineCache_render(bufview->lines, glyphs, line, lineKey(bufview, line_offset),
+                                        (Vector2) {line_x, line_y},
+                                        visible_x0, visible_x1,
+                                        font_color);
 
-        if (cursor >= line_offset && cursor <= line_offset + line.len) {
-            int relative_cursor_x = stringRenderWidth(font, font_size, line.str, cursor - line_offset);
+        if (line_index == cursor_line) {
+            int relative_cursor_x = LineCache_measure(bufview->lines, glyphs, line, lineKey(bufview, line_offset), cursor - line_offset);
             DrawRectangle(line_x + relative_cursor_x, line_y, cursor_w, line_h, cursor_color);
-            drew_cursor = true;
             line_w += cursor_w;
         }
+        LineWidths_set(bufview->widths, line_index, line_w);
 
         line_y += line_h;
-        line_offset += line.len + 1; // line.len doesn't count the \n
-        line_count++;
+        line_offset += line.len[0] + line.len[1] + 1; // The lengths don't count the \n
+        line_index++;
     }
     GapBufferIter_free(&iter);
 
-    if (!drew_cursor) {
+    // The iterator doesn't return the empty line
+    // after a trailing newline.
+    if (cursor_line >= line_index && cursor_line < end_line)
         DrawRectangle(line_x, line_y, cursor_w, line_h, cursor_color);
-        line_y += line_h;
-        line_count++;
-    }
 
+    // Lines that were never drawn don't contribute to the
+    // width, which grows as the text is scrolled.
+    Vector2 logic_area;
+    logic_area.x = 2*pad_h + LineWidths_max(bufview->widths);
     logic_area.y = 2*pad_v + line_count * line_h;
     return logic_area;
 }
 
-static size_t 
-longestSubstringThatRendersInLessPixelsThan(Font font, int font_size,
-                                            const char *str, size_t len, 
-                                            float max_px_len)
-{
-    if (str == NULL)
-        str = "";
-
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    float scale = (float) font_size / font.baseSize;
-
-    float  w = 0;
-    size_t i = 0;
-    while (i < len) {
-
-        uint32_t codepoint;
-        int consumed = UTF8ToUTF32(str + i, len - i, &codepoint);
-
-        if (consumed < 0) {
-            codepoint = '?';
-            consumed = 1;
-        }
-        i += consumed;
-        int glyph_index = GetGlyphIndex(font, codepoint);
-
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
-        
-        assert(delta >= 0);
-        if (w + delta > max_px_len)
-            break;
-
-        w += delta;
-    }
-    assert(i <= len);
-    return i;
-}
-
 static size_t 
 getOffsetAssociatedToCoordinates(BufferView *bufview, 
                                  Vector2 point)
 {
-    GapBuffer *gap = bufview->gap;
+    GapBuffer *gap = bufview->doc->gap;
 
     float font_size = bufview->loaded_font_size;
     float pad_h     = bufview->style->pad_h;
     float pad_v     = bufview->style->pad_v;
 
     int line_index = (point.y - pad_v) / (bufview->style->line_h * font_size);
+    line_index = MAX(line_index, 0);
+
+    // Jump straight to the clicked line using the
+    // line index of the buffer.
+    size_t line_offset = GapBuffer_getLineOffset(gap, line_index);
 
     GapBufferLine line;
     GapBufferIter iter;
-    GapBufferIter_init(&iter, gap);
-    bool not_last = true;
-    int  index = 0;
-    size_t line_offset = 0;
-    while (index < line_index && (not_last = GapBufferIter_next(&iter, &line))) {
-        index++;
-        line_offset += line.len + 1;
-    }
+    GapBufferIter_initAtLine(&iter, gap, line_index);
 
     size_t cursor;
-    if (not_last && GapBufferIter_next(&iter, &line))
-        cursor = line_offset + longestSubstringThatRendersInLessPixelsThan(bufview->loaded_font, font_size, // This function name is too long..
-                                                                           line.str, line.len, point.x - pad_h);
+    if ((size_t) line_index < GapBuffer_getLineCount(gap) && GapBufferIter_next(&iter, &line))
+        cursor = line_offset + LineCache_fit(bufview->lines, bufview->glyphs, line, lineKey(bufview, line_offset), point.x - pad_h);
     else
         // If the line index is out of bounds, then the line offset
         // will be the number of bytes in the file, which is an out
         // of bounds index.
         cursor = MIN(line_offset, GapBuffer_getByteCount(gap));
+    GapBufferIter_free(&iter);
     return cursor;
 }
 
 static void manageClick(BufferView *bufview, Vector2 mouse)
 {
-    GapBuffer *gap = bufview->gap;
-
     size_t cursor = getOffsetAssociatedToCoordinates(bufview, mouse);
-    GapBuffer_moveAbsoluteRaw(gap, cursor);
 
+    bufview->cursor.offset = cursor;
     bufview->selecting = true;
-    bufview->select_first  = cursor;
-    bufview->select_second = cursor;
+    bufview->select_first.offset  = cursor;
+    bufview->select_second.offset = cursor;
     setMouseFocus((Widget*) bufview);
 }
 
@@ -498,14 +402,24 @@ static void removeSelectionAndMoveCursorThere(BufferView *bufview)
 {
     if (somethingSelected(bufview)) {
 
-        GapBuffer *gap = bufview->gap;
-
-        size_t select_start = MIN(bufview->select_first, bufview->select_second);
-        size_t select_end   = MAX(bufview->select_first, bufview->select_second);
-                
-        size_t num_selected_bytes = select_end - select_start;
-        GapBuffer_moveAbsolute(gap, bufview->select_first);
-        GapBuffer_removeForwardsRaw(gap, num_selected_bytes);
+        size_t select_start = MIN(bufview->select_first.offset, bufview->select_second.offset);
+        size_t select_end   = MAX(bufview->select_first.offset, bufview->select_second.offset);
+
+        // With the cursor at the end of the selection,
+        // the edit leaves it where the selection started
+        // and the text between the two is what changed.
+        bufview->cursor.offset = select_end;
+        GapBufferEdit edit = {
+            .offset = select_start,
+            .delete_len = select_end - select_start,
+            .insert = "",
+            .insert_len = 0,
+        };
+        Document *doc = bufview->doc;
+        DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+        if (!GapBuffer_applyEdits(doc->gap, &edit, 1))
+            fprintf(stderr, "Couldn't remove selection\n");
+        Document_endEdit(doc, &bufview->cursor, before);
 
         dropSelection(bufview);
         bufview->selecting = false;
@@ -516,7 +430,7 @@ static void removeSelectionAndMoveCursorThere(BufferView *bufview)
 
 static void insertTab(BufferView *bufview)
 {
-    GapBuffer *gap = bufview->gap;
+    Document *doc = bufview->doc;
     
     int spaces_per_tab = bufview->style->spaces_per_tab;
     spaces_per_tab = MAX(spaces_per_tab, 0);
@@ -524,57 +438,81 @@ static void insertTab(BufferView *bufview)
 
     char spaces[MAX_SPACES_PER_TAB];
 
-    int num = spaces_per_tab - GapBuffer_getColumn(gap) % spaces_per_tab;
+    DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+
+    int num = spaces_per_tab - GapBuffer_getColumn(doc->gap) % spaces_per_tab;
     memset(spaces, ' ', num);
 
-    if (!GapBuffer_insertString(gap, spaces, num))
+    if (!GapBuffer_insertString(doc->gap, spaces, num))
         fprintf(stderr, "Couldn't insert tab\n");
+    Document_endEdit(doc, &bufview->cursor, before);
+}
+
+// Called after the buffer's cursor was moved for the view
+// (see Document_useCursor) to keep where it is now.
+static void keepCursor(BufferView *bufview)
+{
+    bufview->cursor.offset = GapBuffer_rawCursorPosition(bufview->doc->gap);
 }
 
 static void manageKey(BufferView *bufview, int key)
 {
-    GapBuffer *gap = bufview->gap;
+    Document *doc = bufview->doc;
 
     switch (key) {
         
         case KEY_UP:
         dropSelection(bufview);
-        GapBuffer_moveRelativeVertically(gap, true);
+        GapBuffer_moveRelativeVertically(Document_useCursor(doc, &bufview->cursor), true);
+        keepCursor(bufview);
         break;
         
         case KEY_DOWN:
         dropSelection(bufview);
-        GapBuffer_moveRelativeVertically(gap, false);
+        GapBuffer_moveRelativeVertically(Document_useCursor(doc, &bufview->cursor), false);
+        keepCursor(bufview);
         break;
         
         case KEY_LEFT:
         dropSelection(bufview);
-        GapBuffer_moveRelative(gap, -1); 
+        GapBuffer_moveRelative(Document_useCursor(doc, &bufview->cursor), -1);
+        keepCursor(bufview);
         break;
         
         case KEY_RIGHT: 
         dropSelection(bufview);
-        GapBuffer_moveRelative(gap, +1); 
+        GapBuffer_moveRelative(Document_useCursor(doc, &bufview->cursor), +1);
+        keepCursor(bufview);
         break;
 
         case KEY_ENTER:
-        removeSelectionAndMoveCursorThere(bufview);
-        if (!GapBuffer_insertString(gap, "\n", 1))
-            fprintf(stderr, "Couldn't insert string\n");
+        {
+            removeSelectionAndMoveCursorThere(bufview);
+            DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+            if (!GapBuffer_insertString(doc->gap, "\n", 1))
+                fprintf(stderr, "Couldn't insert string\n");
+            Document_endEdit(doc, &bufview->cursor, before);
+        }
         break;
         
         case KEY_BACKSPACE:
         if (somethingSelected(bufview))
             removeSelectionAndMoveCursorThere(bufview);
-        else
-            GapBuffer_removeBackwards(gap, 1); 
+        else {
+            DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+            GapBuffer_removeBackwards(doc->gap, 1); 
+            Document_endEdit(doc, &bufview->cursor, before);
+        }
         break;
         
         case KEY_DELETE:
         if (somethingSelected(bufview))
             removeSelectionAndMoveCursorThere(bufview);
-        else
-            GapBuffer_removeForwards(gap, 1);
+        else {
+            DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+            GapBuffer_removeForwards(doc->gap, 1);
+            Document_endEdit(doc, &bufview->cursor, before);
+        }
         break;
 
         case KEY_TAB:
@@ -589,8 +527,8 @@ static void manageKey(BufferView *bufview, int key)
 static void changeWindowTitle(BufferView *bufview)
 {
     const char *file;
-    if (bufview->file[0])
-        file = bufview->file;
+    if (bufview->doc->file[0])
+        file = bufview->doc->file;
     else
         file = "(unnamed)";
 
@@ -605,97 +543,92 @@ static void changeWindowTitleIfFocused(BufferView *bufview)
         changeWindowTitle(bufview);
 }
 
+// The view stops showing the document it was showing, which
+// is left to the other views on it, if any.
 static void openFile(BufferView *bufview, const char *filename)
 {
     assert(filename);
-    
-    size_t filename_len = strlen(filename);
 
-    if (filename_len >= sizeof(bufview->file)) {
-        fprintf(stderr, "File path is too long (longer than the buffer file path limit)\n");
+    Document *doc = Document_open(filename);
+    if (doc == NULL)
         return;
-    }
 
-    // Try and open the file into a new gap buffer
-    size_t mem_len = 1 << 16; 
-    void *mem = malloc(mem_len);
-    if (mem == NULL) {
-        fprintf(stderr, "Failed to allocate gap buffer memory to load file\n");
+    // The file may be open in another view already, or
+    // even in this one.
+    if (doc == bufview->doc) {
+        Document_release(doc);
         return;
     }
-    GapBuffer *gap = GapBuffer_createUsingMemory(mem, mem_len, free);
-    if (gap == NULL) {
-        fprintf(stderr, "Failed to initialize gap buffer to load file\n");
-        free(mem);
-        return;
-    }
-
-    if (!GapBuffer_insertFile(gap, filename)) {
-        
-        fprintf(stderr, "Failed to load '%s' into gap buffer (file too big or not valid utf-8)\n", filename);
-        
-        // Free the new gap buffer
-        GapBuffer_destroy(gap);
+    fprintf(stderr, "Opened '%s'\n", filename);
 
-    } else {
-
-        strcpy(bufview->file, filename);
-        changeWindowTitleIfFocused(bufview);
+    detachDocument(bufview);
+    attachDocument(bufview, doc);
+    bufview->selecting = false;
+    changeWindowTitleIfFocused(bufview);
+    forgetLineWidths(bufview);
+    requestRedraw();
+}
 
-        fprintf(stderr, "Loaded '%s'\n", filename);
+static void saveFile(BufferView *bufview)
+{
+    Document *doc = bufview->doc;
 
-        // Swap the old gap buffer with the new one
-        GapBuffer_destroy(bufview->gap);
-        bufview->gap = gap;
+    if (doc->saving) {
+        fprintf(stderr, "A save is already in progress\n");
+        return;
     }
-}
 
-static bool generateRandomFilename(char *dst, size_t max)
-{
-    size_t len = MIN(16, max);
+    if (doc->file[0] == '\0') {
+        char file[sizeof(doc->file)];
+        int n = chooseFileToSave(file, sizeof(file));
+        if (n <= 0 || !Document_setFile(doc, file))
+            return;
+    }
 
-    char table[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890";
-    
-    for (size_t i = 0; i < len-1; i++) {
-        int k = rand() % (sizeof(table)-1);
-        dst[i] = table[k];
+    // The file is written by a worker thread from a
+    // snapshot of the buffer, so editing can go on
+    // while it's saved (see checkSaveProgress).
+    GapBufferSnapshot *snap = GapBuffer_snapshot(doc->gap);
+    if (snap == NULL) {
+        fprintf(stderr, "Couldn't take a snapshot of the buffer to save it\n");
+        return;
     }
-    dst[len-1] = '\0';
 
-    // TODO: Make sure this file doesn't exist
-    return true;
+    doc->saving = Save_start(snap, doc->file);
+    if (doc->saving == NULL) {
+        fprintf(stderr, "Couldn't start saving '%s'\n", doc->file);
+        GapBufferSnapshot_free(snap);
+        return;
+    }
 }
 
-static void saveFile(BufferView *bufview)
+// Called every frame to find out whether the background
+// save of the document is over. Until it is, the view asks
+// to be drawn again so that it's checked again. Any of the
+// views on the document can be the one that finds out.
+static void checkSaveProgress(BufferView *bufview)
 {
-    if (bufview->file[0] == '\0') {
-        int n = chooseFileToSave(bufview->file, sizeof(bufview->file));
-        if (n <= 0)
-            return;
-    }
-
-    // Save to a secondary file
-    char second[1024];
-    if (!generateRandomFilename(second, sizeof(second)))
+    Document *doc = bufview->doc;
+    if (doc->saving == NULL)
         return;
 
-    if (!GapBuffer_saveTo(bufview->gap, second)) {
-        fprintf(stderr, "Couldn't save data to file '%s'\n", second);
+    if (!Save_poll(doc->saving)) {
+        requestRedraw();
         return;
     }
 
-    // Data was written succesfully to the secondary
-    // file so now we can swap it with the actual
-    // target file.
-    remove(bufview->file);
-    rename(second, bufview->file);
-    changeWindowTitleIfFocused(bufview);
+    if (Save_finish(doc->saving)) {
+        fprintf(stderr, "Saved '%s'\n", doc->file);
+        changeWindowTitleIfFocused(bufview);
+    } else
+        fprintf(stderr, "Couldn't save data to file '%s'\n", doc->file);
+    doc->saving = NULL;
 }
 
 static void handleEvent(Widget *widget, Event event)
 {
     BufferView *bufview = (BufferView*) widget;
-    GapBuffer *gap = bufview->gap;
+    Document *doc = bufview->doc;
 
     switch (event.type) {
 
@@ -714,18 +647,32 @@ static void handleEvent(Widget *widget, Event event)
 
         case EVENT_MOUSE_MOVE:
         if (bufview->selecting) {
-            bufview->select_second = getOffsetAssociatedToCoordinates(bufview, event.mouse);
-            GapBuffer_moveAbsoluteRaw(gap, bufview->select_second);
+            bufview->select_second.offset = getOffsetAssociatedToCoordinates(bufview, event.mouse);
+            bufview->cursor.offset = bufview->select_second.offset;
         }
         break;
 
         case EVENT_OPEN: openFile(bufview, event.path); break;
         case EVENT_SAVE: saveFile(bufview); break;
 
+        case EVENT_UNDO:
+        case EVENT_REDO:
+        {
+            // The document tells all views on it which
+            // lines the changes replaced.
+            dropSelection(bufview);
+            Document_undo(doc, &bufview->cursor, event.type == EVENT_REDO);
+        }
+        break;
+
         case EVENT_TEXT:
-        removeSelectionAndMoveCursorThere(bufview);
-        if (!GapBuffer_insertRune(gap, event.rune)) 
-            fprintf(stderr, "Couldn't insert string\n");
+        {
+            removeSelectionAndMoveCursorThere(bufview);
+            DocumentEdit before = Document_beginEdit(doc, &bufview->cursor);
+            if (!GapBuffer_insertRune(doc->gap, event.rune)) 
+                fprintf(stderr, "Couldn't insert string\n");
+            Document_endEdit(doc, &bufview->cursor, before);
+        }
         break;
 
         case EVENT_KEY:
@@ -735,4 +682,5 @@ static void handleEvent(Widget *widget, Event event)
         default:
         break;
     }
+    requestRedraw();
 }
@@ -1,6 +1,9 @@
 #include <raylib.h>
 #include "widget.h"
-#include "../utils/gap_buffer.h"
+#include "font_cache.h"
+#include "line_cache.h"
+#include "line_widths.h"
+#include "../utils/document.h"
 
 typedef struct {
     float line_h;
@@ -14,6 +17,7 @@ typedef struct {
     Color color_ruler;
     const char *font_file;
     float       font_size;
+    bool        font_sdf;
 } BufferViewStyle;
 
 typedef struct {
@@ -21,12 +25,17 @@ typedef struct {
     BufferViewStyle *style;
     const char *loaded_font_file;
     float       loaded_font_size;
-    Font        loaded_font;
+    bool        loaded_font_sdf;
+    GlyphTable *glyphs;
+    LineCache  *lines; // Glyphs placed by previous frames
     bool        selecting;
-    size_t      select_first;
-    size_t      select_second;
-    GapBuffer *gap;
-    char file[1024];
+    DocumentAnchor cursor;
+    DocumentAnchor select_first;
+    DocumentAnchor select_second;
+    Document  *doc;
+    DocumentListener listener; // Told which lines the edits replaced
+    LineWidths *widths; // Of the lines that were drawn
 } BufferView;
 
-BufferView *createBufferView(WidgetStyle *base_style, BufferViewStyle *style);
\ No newline at end of file
+BufferView *createBufferView(WidgetStyle *base_style, BufferViewStyle *style, Document *doc);
+Document   *getBufferViewDocument(Widget *widget);
\ No newline at end of file
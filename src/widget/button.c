@@ -15,14 +15,12 @@ static void reloadFont(Button *button)
     const char *font_file = button->style->font_file;
     float       font_size = button->style->font_size;
 
-    Font font;
-    if (button->style->font_file)
-        font = LoadFontEx(font_file, font_size, NULL, 250);
-    else
-        font = GetFontDefault();
-
-    UnloadFont(button->loaded_font); // FIXME: Is it okay to unload the default font?
-    button->loaded_font = font;
+    // Fonts are shared with the other widgets using them
+    GlyphTable *glyphs = FontCache_acquire(font_file, font_size, false);
+    if (glyphs) {
+        FontCache_release(button->glyphs);
+        button->glyphs = glyphs;
+    }
     button->loaded_font_file = font_file;
     button->loaded_font_size = font_size;
 }
@@ -44,15 +42,21 @@ Button *createButton(WidgetStyle *base_style, ButtonStyle *style, const char *la
     if (button == NULL)
         return NULL;
 
+    GlyphTable *glyphs = FontCache_acquire(NULL, style->font_size, false);
+    if (glyphs == NULL) {
+        free(button);
+        return NULL;
+    }
+
     initWidget(&button->base, base_style, draw, free_, handleEvent);
 
     button->style = style;
     button->active = false;
     button->context = context;
     button->callback = callback;
-    button->loaded_font = GetFontDefault();
     button->loaded_font_file = NULL;
     button->loaded_font_size = style->font_size;
+    button->glyphs = glyphs;
 
     strncpy(button->label, label, MAX_BUTTON_LABEL);
     button->label[MAX_BUTTON_LABEL-1] = '\0';
@@ -63,7 +67,7 @@ Button *createButton(WidgetStyle *base_style, ButtonStyle *style, const char *la
 static void free_(Widget *widget)
 {
     Button *button = (Button*) widget;
-    UnloadFont(button->loaded_font);
+    FontCache_release(button->glyphs);
     free(button);
 }
 
@@ -86,6 +90,7 @@ static void handleEvent(Widget *widget, Event event)
         default:
         break;
     }
+    requestRedraw();
 }
 
 static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
@@ -126,18 +131,20 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
             color_text = button->style->color_text;
         
         const char *text = button->label;
-        Font        font = button->loaded_font;
+        size_t  text_len = strlen(text);
         float  font_size = button->loaded_font_size;
-        float    spacing = 0;
 
-        Vector2 text_area = MeasureTextEx(font, text, font_size, spacing);
+        Vector2 text_area = {
+            .x = GlyphTable_measure(button->glyphs, text, text_len),
+            .y = font_size,
+        };
 
         Vector2 text_pos  = {
             .x = offset.x + (area.x - text_area.x) / 2,
             .y = offset.y + (area.y - text_area.y) / 2,
         };
         
-        DrawTextEx(font, text, text_pos, font_size, spacing, color_text);
+        GlyphTable_render(button->glyphs, text, text_len, text_pos, color_text);
 
         logic_area = text_area;
     }
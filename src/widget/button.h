@@ -2,6 +2,7 @@
 #define BUTTON_H
 
 #include "widget.h"
+#include "font_cache.h"
 
 #define MAX_BUTTON_LABEL 128
 
@@ -26,7 +27,7 @@ struct Button {
     void *context;
     ButtonCallback callback;
     bool active;
-    Font        loaded_font;
+    GlyphTable *glyphs;
     const char *loaded_font_file;
     float       loaded_font_size;
     char label[MAX_BUTTON_LABEL];
@@ -8,6 +8,8 @@ typedef enum {
     EVENT_TEXT,
     EVENT_OPEN,
     EVENT_SAVE,
+    EVENT_UNDO,
+    EVENT_REDO,
     EVENT_MOUSE_WHEEL,
     EVENT_MOUSE_MOVE,
     EVENT_MOUSE_LEFT_UP,
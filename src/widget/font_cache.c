@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include "font_cache.h"
+
+/* Font Cache
+**
+**   Fonts are loaded once per process for each file, size
+**   and glyph set, and shared by all the widgets that use
+**   them along with their glyph table. Entries are counted
+**   references and are unloaded when the last widget using
+**   them releases them.
+**
+**   Signed distance field fonts are loaded once per file,
+**   at FONT_SDF_SIZE, and any number of glyph tables can be
+**   built on them, one per size. Changing the size of one
+**   doesn't rasterize anything or upload any texture: it
+**   only builds a table scaled to the new size.
+**
+**   Widgets are only drawn by the main thread, so there's
+**   no locking.
+*/
+
+// Number of codepoints rasterized when loading a font,
+// starting from 32.
+#define FONT_GLYPH_SET 250
+
+// Size signed distance field fonts are rasterized at,
+// and the padding of their glyphs in the font texture.
+#define FONT_SDF_SIZE    32
+#define FONT_SDF_PADDING 4
+
+typedef struct LoadedFont LoadedFont;
+struct LoadedFont {
+    LoadedFont *next;
+    char       *file; // NULL for raylib's default font
+    float       size;
+    bool        sdf;
+    int         glyph_set;
+    int         refs; // Glyph tables built on the font
+    Font        font;
+    GlyphAtlas *atlas;
+};
+
+typedef struct CachedFont CachedFont;
+struct CachedFont {
+    CachedFont *next;
+    LoadedFont *loaded;
+    float       size;
+    int         refs;
+    GlyphTable  glyphs;
+};
+
+static LoadedFont *loaded_fonts = NULL;
+static CachedFont *cached_fonts = NULL;
+
+static bool sameFile(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    return !strcmp(a, b);
+}
+
+static LoadedFont *findLoadedFont(const char *file, float size, bool sdf, int glyph_set)
+{
+    for (LoadedFont *font = loaded_fonts; font; font = font->next)
+        if (font->size == size && font->sdf == sdf && font->glyph_set == glyph_set && sameFile(font->file, file))
+            return font;
+    return NULL;
+}
+
+static CachedFont *findFont(LoadedFont *loaded, float size)
+{
+    for (CachedFont *font = cached_fonts; font; font = font->next)
+        if (font->loaded == loaded && font->size == size)
+            return font;
+    return NULL;
+}
+
+static Font loadFontSDF(const unsigned char *file_data, int file_size)
+{
+    Font font = {0};
+    font.baseSize = FONT_SDF_SIZE;
+    font.glyphCount = FONT_GLYPH_SET;
+    font.glyphPadding = FONT_SDF_PADDING;
+    font.glyphs = LoadFontData(file_data, file_size, FONT_SDF_SIZE, NULL, FONT_GLYPH_SET, FONT_SDF);
+    if (font.glyphs == NULL)
+        return (Font) {0};
+
+    Image image = GenImageFontAtlas(font.glyphs, &font.recs, FONT_GLYPH_SET, FONT_SDF_SIZE, FONT_SDF_PADDING, 0);
+    font.texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+
+    if (font.texture.id == 0) {
+        UnloadFont(font);
+        return (Font) {0};
+    }
+
+    // The distance is interpolated between texels
+    SetTextureFilter(font.texture, TEXTURE_FILTER_BILINEAR);
+    return font;
+}
+
+// Load the font in [file], keeping the file for the glyphs
+// that aren't in the glyph set. If the font can't be loaded,
+// the default font is used instead.
+static LoadedFont *loadFont(const char *file, float size, bool sdf)
+{
+    LoadedFont *font = malloc(sizeof(LoadedFont));
+    if (font == NULL)
+        return NULL;
+
+    font->file = NULL;
+    if (file) {
+        size_t len = strlen(file);
+        font->file = malloc(len+1);
+        if (font->file == NULL) {
+            free(font);
+            return NULL;
+        }
+        memcpy(font->file, file, len+1);
+    }
+
+    Font loaded = {0};
+    unsigned char *file_data = NULL;
+    unsigned int   file_size = 0;
+    if (file) {
+        file_data = LoadFileData(file, &file_size);
+        if (file_data) {
+            if (sdf)
+                loaded = loadFontSDF(file_data, file_size);
+            else
+                loaded = LoadFontFromMemory(GetFileExtension(file), file_data, file_size, size, NULL, FONT_GLYPH_SET);
+        }
+    }
+
+    // The atlas keeps the file to rasterize the
+    // codepoints that aren't in the glyph set.
+    GlyphAtlas *atlas = NULL;
+    if (loaded.texture.id == 0)
+        loaded = GetFontDefault();
+    else
+        atlas = GlyphAtlas_create(loaded, sdf, file_data, file_size);
+
+    if (atlas == NULL)
+        UnloadFileData(file_data);
+
+    // The cache entry keeps the key it was looked up with
+    // even if the default font was used, so that the file
+    // isn't loaded again.
+    font->size = size;
+    font->sdf = sdf;
+    font->glyph_set = FONT_GLYPH_SET;
+    font->refs = 0;
+    font->font = loaded;
+    font->atlas = atlas;
+
+    font->next = loaded_fonts;
+    loaded_fonts = font;
+    return font;
+}
+
+static void unloadFont(LoadedFont *font)
+{
+    LoadedFont **prev = &loaded_fonts;
+    while (*prev && *prev != font)
+        prev = &(*prev)->next;
+    if (*prev)
+        *prev = font->next;
+
+    // UnloadFont leaves the default font alone
+    GlyphAtlas_free(font->atlas);
+    UnloadFont(font->font);
+    free(font->file);
+    free(font);
+}
+
+static bool isDefaultFont(Font font)
+{
+    return font.texture.id == GetFontDefault().texture.id;
+}
+
+/* Symbol: FontCache_acquire
+**
+**   Returns the glyph table of the font in [file] drawn at
+**   [size], loading it if no widget is using it already.
+**   If [file] is NULL, raylib's default font is used. If the
+**   font can't be loaded, the default font is used instead.
+**
+**   When [sdf] is true the font is loaded as signed distance
+**   fields, once for all sizes.
+**
+**   Returns NULL if there's no memory. The table must be
+**   given back with FontCache_release.
+*/
+GlyphTable *FontCache_acquire(const char *file, float size, bool sdf)
+{
+    // The default font is a bitmap font
+    if (file == NULL)
+        sdf = false;
+
+    float load_size = sdf ? FONT_SDF_SIZE : size;
+    LoadedFont *loaded = findLoadedFont(file, load_size, sdf, FONT_GLYPH_SET);
+    if (loaded == NULL) {
+        loaded = loadFont(file, load_size, sdf);
+        if (loaded == NULL)
+            return NULL;
+    }
+
+    CachedFont *font = findFont(loaded, size);
+    if (font) {
+        font->refs++;
+        return &font->glyphs;
+    }
+
+    font = malloc(sizeof(CachedFont));
+    if (font == NULL) {
+        if (loaded->refs == 0)
+            unloadFont(loaded);
+        return NULL;
+    }
+
+    // The fallback to the default font isn't drawn as
+    // distance fields.
+    bool draw_sdf = loaded->sdf && !isDefaultFont(loaded->font);
+
+    loaded->refs++;
+    font->loaded = loaded;
+    font->size = size;
+    font->refs = 1;
+    GlyphTable_init(&font->glyphs, loaded->font, size, draw_sdf, loaded->atlas);
+
+    font->next = cached_fonts;
+    cached_fonts = font;
+    return &font->glyphs;
+}
+
+void FontCache_release(GlyphTable *glyphs)
+{
+    if (glyphs == NULL)
+        return;
+
+    CachedFont **prev = &cached_fonts;
+    while (*prev && &(*prev)->glyphs != glyphs)
+        prev = &(*prev)->next;
+
+    CachedFont *font = *prev;
+    if (font == NULL || --font->refs > 0)
+        return;
+    *prev = font->next;
+
+    GlyphTable_free(&font->glyphs);
+    if (--font->loaded->refs == 0)
+        unloadFont(font->loaded);
+    free(font);
+}
@@ -0,0 +1,9 @@
+#ifndef FONT_CACHE_H
+#define FONT_CACHE_H
+
+#include "glyphs.h"
+
+GlyphTable *FontCache_acquire(const char *file, float size, bool sdf);
+void        FontCache_release(GlyphTable *glyphs);
+
+#endif
@@ -0,0 +1,1030 @@
+#include <math.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../utils/basic.h"
+#include "../utils/utf8.h"
+#include "glyphs.h"
+#include <rlgl.h> // After raylib.h, which defines the types it shares
+
+/* Glyph Tables
+**
+**   Raylib looks up the glyph of a codepoint by scanning all
+**   the glyphs of the font, which makes laying out text cost
+**   a linear search per character. A glyph table maps each
+**   codepoint of a font to the index of its glyph and to its
+**   advance at a given size once, when the font is loaded, so
+**   that laying out a character costs a table load.
+**
+**   Codepoints up to Latin-1 index an array directly, the
+**   others go through an open addressing hash table keyed by
+**   codepoint. Since all codepoints in the hash table are
+**   above Latin-1, zero marks the empty slots.
+**
+**   Only a small set of codepoints is rasterized when a font
+**   is loaded. If the table was given the font file, the other
+**   codepoints are rasterized the first time they're looked
+**   up and added to the hash table as glyphs of a glyph atlas
+**   (see below).
+**
+**   When the font is monospace, text is laid out on a grid
+**   instead: a symbol is placed at its column times the width
+**   of a cell, and symbols take zero, one or two columns as
+**   told by UTF8_runeWidth. Runs of ASCII take a column per
+**   byte, so measuring them doesn't require looking at the
+**   glyphs at all.
+*/
+
+// Number of runes decoded at the time while measuring
+// and drawing strings
+#define RUNE_BATCH 256
+
+/* Glyph Atlas
+**
+**   Glyphs rasterized on demand are stored in the slots of
+**   a few textures, the pages of the atlas, which are only
+**   created when the previous ones are full. All slots have
+**   the same size, enough for a glyph of the font, so any of
+**   them can hold any glyph. Glyphs bigger than that are cut.
+**
+**   Once all pages are created and full, a new glyph takes
+**   the slot of the glyph that was drawn least recently.
+**   The metrics of evicted glyphs stay in the atlas, so that
+**   laying out text never rasterizes a glyph twice, but their
+**   bitmap is rasterized again when they're drawn.
+**
+**   An atlas belongs to a loaded font and is shared by the
+**   glyph tables built from it, which is why it has its own
+**   index of the codepoints it rasterized. Metrics are kept
+**   at the size the font was loaded at and each table scales
+**   them to its own.
+**
+**   The pages use the pixel format of the font textures, so
+**   the atlas takes at most:
+**
+**     GLYPH_ATLAS_MAX_PAGES * GLYPH_ATLAS_PAGE_SIZE^2 * 2 bytes
+**
+**   of video memory, which is 2MB.
+*/
+
+#define GLYPH_ATLAS_PAGE_SIZE 512
+#define GLYPH_ATLAS_MAX_PAGES 4
+#define GLYPH_ATLAS_PADDING   1
+
+// Raylib pads signed distance field glyphs by
+// this many pixels on each side.
+#define GLYPH_ATLAS_SDF_PADDING 4
+
+typedef struct {
+    uint32_t codepoint;
+    float    advance; // Not scaled
+    int      offset_x;
+    int      offset_y;
+    int      width;  // Of the bitmap, which may have been cut
+    int      height; // to fit a slot
+    int      slot;   // Negative when it's not in the atlas
+    uint64_t last_used;
+} LazyGlyph;
+
+struct GlyphAtlas {
+
+    // Font file the glyphs are rasterized from, at the
+    // size of the font
+    unsigned char *file_data;
+    int            file_size;
+    int            base_size;
+    bool           sdf;
+
+    LazyGlyph *glyphs;
+    int        num_glyphs;
+    int        max_glyphs;
+
+    // Maps codepoints to their glyph, or to -1 if they
+    // couldn't be rasterized.
+    uint32_t *keys;
+    int      *indices;
+    size_t    capacity;
+    size_t    num_keys;
+
+    Texture2D pages[GLYPH_ATLAS_MAX_PAGES];
+    int       num_pages;
+
+    int  slot_size;
+    int  slots_per_row;
+    int  slots_per_page;
+    int  num_slots; // Slots that were ever given to a glyph
+    int *owners;    // Glyph in each slot
+
+    // Incremented each time a glyph is drawn
+    uint64_t clock;
+
+    // Pixels of a slot, used to upload glyphs
+    unsigned char *pixels;
+
+    // Rasterizing a glyph to lay it out also gives its
+    // bitmap, which is kept until it's drawn since it's
+    // likely to be drawn next.
+    GlyphInfo *pending;
+    int        pending_glyph;
+};
+
+// Glyphs of signed distance field fonts are drawn with
+// a shader that turns the distance from the outline into
+// coverage, so they stay sharp at any scale. It's loaded
+// while there are SDF tables.
+static const char sdf_fragment_shader[] =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform vec4 colDiffuse;\n"
+    "out vec4 finalColor;\n"
+    "void main()\n"
+    "{\n"
+    "    float dist  = texture(texture0, fragTexCoord).a - 0.5;\n"
+    "    float width = length(vec2(dFdx(dist), dFdy(dist)));\n"
+    "    float alpha = smoothstep(-width, width, dist);\n"
+    "    finalColor = vec4(fragColor.rgb, fragColor.a * alpha) * colDiffuse;\n"
+    "}\n";
+
+static Shader sdf_shader;
+static int    sdf_tables = 0;
+
+static uint32_t hashCodepoint(uint32_t codepoint)
+{
+    return codepoint * 2654435761u;
+}
+
+static GlyphEntry makeEntry(Font font, float scale, int index)
+{
+    float advance;
+    int advance_x = font.glyphs[index].advanceX;
+    if (advance_x)
+        advance = (float) advance_x * scale;
+    else
+        advance = (float) font.recs[index].width   * scale
+                + (float) font.glyphs[index].offsetX * scale;
+    return (GlyphEntry) {.index=index, .advance=advance};
+}
+
+static void insertEntry(GlyphTable *table, uint32_t codepoint, GlyphEntry entry)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = hashCodepoint(codepoint) & mask;
+    while (table->keys[i] != 0 && table->keys[i] != codepoint)
+        i = (i + 1) & mask;
+    if (table->keys[i] == 0)
+        table->num_keys++;
+    table->keys[i] = codepoint;
+    table->entries[i] = entry;
+}
+
+static bool growHashTable(GlyphTable *table)
+{
+    size_t capacity = MAX(2 * table->capacity, 16);
+    uint32_t   *keys    = calloc(capacity, sizeof(uint32_t));
+    GlyphEntry *entries = malloc(capacity * sizeof(GlyphEntry));
+    if (keys == NULL || entries == NULL) {
+        free(keys);
+        free(entries);
+        return false;
+    }
+
+    uint32_t   *old_keys     = table->keys;
+    GlyphEntry *old_entries  = table->entries;
+    size_t      old_capacity = table->capacity;
+
+    table->keys = keys;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->num_keys = 0;
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old_keys[i] != 0)
+            insertEntry(table, old_keys[i], old_entries[i]);
+
+    free(old_keys);
+    free(old_entries);
+    return true;
+}
+
+static void insertIndex(GlyphAtlas *atlas, uint32_t codepoint, int index)
+{
+    size_t mask = atlas->capacity - 1;
+    size_t i = hashCodepoint(codepoint) & mask;
+    while (atlas->keys[i] != 0 && atlas->keys[i] != codepoint)
+        i = (i + 1) & mask;
+    if (atlas->keys[i] == 0)
+        atlas->num_keys++;
+    atlas->keys[i] = codepoint;
+    atlas->indices[i] = index;
+}
+
+static bool growIndex(GlyphAtlas *atlas)
+{
+    size_t capacity = MAX(2 * atlas->capacity, 64);
+    uint32_t *keys    = calloc(capacity, sizeof(uint32_t));
+    int      *indices = malloc(capacity * sizeof(int));
+    if (keys == NULL || indices == NULL) {
+        free(keys);
+        free(indices);
+        return false;
+    }
+
+    uint32_t *old_keys     = atlas->keys;
+    int      *old_indices  = atlas->indices;
+    size_t    old_capacity = atlas->capacity;
+
+    atlas->keys = keys;
+    atlas->indices = indices;
+    atlas->capacity = capacity;
+    atlas->num_keys = 0;
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old_keys[i] != 0)
+            insertIndex(atlas, old_keys[i], old_indices[i]);
+
+    free(old_keys);
+    free(old_indices);
+    return true;
+}
+
+/* Symbol: GlyphAtlas_create
+**
+**   Create the atlas of the glyphs of [font] that weren't
+**   rasterized when it was loaded from [file_data], which
+**   the atlas owns from now on and unloads with
+**   UnloadFileData. [sdf] tells whether the font is made
+**   of signed distance fields.
+**
+**   Returns NULL if there's no memory or the font is too
+**   big for the pages, in which case the file data is left
+**   to the caller.
+*/
+GlyphAtlas *GlyphAtlas_create(Font font, bool sdf, unsigned char *file_data, int file_size)
+{
+    int slot_size = (int) ceilf(font.baseSize * 1.5f) + 2 * GLYPH_ATLAS_PADDING;
+    if (sdf)
+        slot_size += 2 * GLYPH_ATLAS_SDF_PADDING;
+    if (slot_size > GLYPH_ATLAS_PAGE_SIZE)
+        return NULL;
+
+    int slots_per_row  = GLYPH_ATLAS_PAGE_SIZE / slot_size;
+    int slots_per_page = slots_per_row * slots_per_row;
+
+    GlyphAtlas *atlas = malloc(sizeof(GlyphAtlas));
+    if (atlas == NULL)
+        return NULL;
+
+    atlas->owners = malloc(GLYPH_ATLAS_MAX_PAGES * slots_per_page * sizeof(int));
+    atlas->pixels = malloc(slot_size * slot_size * 2);
+    if (atlas->owners == NULL || atlas->pixels == NULL) {
+        free(atlas->owners);
+        free(atlas->pixels);
+        free(atlas);
+        return NULL;
+    }
+
+    atlas->file_data = file_data;
+    atlas->file_size = file_size;
+    atlas->base_size = font.baseSize;
+    atlas->sdf = sdf;
+    atlas->glyphs = NULL;
+    atlas->num_glyphs = 0;
+    atlas->max_glyphs = 0;
+    atlas->keys = NULL;
+    atlas->indices = NULL;
+    atlas->capacity = 0;
+    atlas->num_keys = 0;
+    atlas->num_pages = 0;
+    atlas->slot_size = slot_size;
+    atlas->slots_per_row = slots_per_row;
+    atlas->slots_per_page = slots_per_page;
+    atlas->num_slots = 0;
+    atlas->clock = 0;
+    atlas->pending = NULL;
+    atlas->pending_glyph = -1;
+    return atlas;
+}
+
+void GlyphAtlas_free(GlyphAtlas *atlas)
+{
+    if (atlas == NULL)
+        return;
+    for (int i = 0; i < atlas->num_pages; i++)
+        UnloadTexture(atlas->pages[i]);
+    if (atlas->pending)
+        UnloadFontData(atlas->pending, 1);
+    UnloadFileData(atlas->file_data);
+    free(atlas->glyphs);
+    free(atlas->keys);
+    free(atlas->indices);
+    free(atlas->owners);
+    free(atlas->pixels);
+    free(atlas);
+}
+
+static GlyphInfo *rasterizeGlyph(const GlyphAtlas *atlas, uint32_t codepoint)
+{
+    int value = codepoint;
+    int type = atlas->sdf ? FONT_SDF : FONT_DEFAULT;
+    GlyphInfo *info = LoadFontData(atlas->file_data, atlas->file_size,
+                                   atlas->base_size, &value, 1, type);
+    if (info && info->image.data == NULL) {
+        info->image.width  = 0;
+        info->image.height = 0;
+    }
+    return info;
+}
+
+// Returns the glyph of a codepoint, rasterizing it if it's
+// new, or -1 if it can't be rasterized. If there's no memory
+// to remember that, -2 is returned.
+static int lookupLazyGlyph(GlyphAtlas *atlas, uint32_t codepoint)
+{
+    if (atlas->capacity > 0) {
+        size_t mask = atlas->capacity - 1;
+        size_t i = hashCodepoint(codepoint) & mask;
+        while (atlas->keys[i] != 0) {
+            if (atlas->keys[i] == codepoint)
+                return atlas->indices[i];
+            i = (i + 1) & mask;
+        }
+    }
+
+    if (2 * (atlas->num_keys + 1) > atlas->capacity && !growIndex(atlas))
+        return -2;
+
+    if (atlas->num_glyphs == atlas->max_glyphs) {
+        int max_glyphs = MAX(2 * atlas->max_glyphs, 64);
+        LazyGlyph *glyphs = realloc(atlas->glyphs, max_glyphs * sizeof(LazyGlyph));
+        if (glyphs == NULL)
+            return -2;
+        atlas->glyphs = glyphs;
+        atlas->max_glyphs = max_glyphs;
+    }
+
+    int k = -1;
+    GlyphInfo *info = rasterizeGlyph(atlas, codepoint);
+    if (info) {
+
+        float advance;
+        if (info->advanceX)
+            advance = info->advanceX;
+        else
+            advance = info->image.width + info->offsetX;
+
+        int max_size = atlas->slot_size - 2 * GLYPH_ATLAS_PADDING;
+        k = atlas->num_glyphs++;
+        atlas->glyphs[k] = (LazyGlyph) {
+            .codepoint = codepoint,
+            .advance   = advance,
+            .offset_x  = info->offsetX,
+            .offset_y  = info->offsetY,
+            .width     = MIN(info->image.width,  max_size),
+            .height    = MIN(info->image.height, max_size),
+            .slot      = -1,
+            .last_used = 0,
+        };
+
+        if (atlas->pending)
+            UnloadFontData(atlas->pending, 1);
+        atlas->pending = info;
+        atlas->pending_glyph = k;
+    }
+    insertIndex(atlas, codepoint, k);
+    return k;
+}
+
+/* Symbol: GlyphTable_init
+**
+**   Build the table of [font] for text drawn at [font_size].
+**   If [font] isn't loaded, the default font is used instead.
+**   [sdf] tells whether [font] is made of signed distance
+**   fields, in which case it can be drawn at any size.
+**
+**   Codepoints that [font] doesn't have are looked up in
+**   [atlas], if it's not NULL, which must have been created
+**   for [font] and must outlive the table.
+**
+**   If there's no memory for the hash table, codepoints above
+**   Latin-1 are looked up with raylib's linear search.
+*/
+void GlyphTable_init(GlyphTable *table, Font font, float font_size,
+                     bool sdf, GlyphAtlas *atlas)
+{
+    if (font.texture.id == 0) {
+        font = GetFontDefault();
+        sdf = false;
+        atlas = NULL;
+    }
+
+    float scale = font_size / font.baseSize;
+    table->font = font;
+    table->font_size = font_size;
+    table->scale = scale;
+    table->keys = NULL;
+    table->entries = NULL;
+    table->capacity = 0;
+    table->num_keys = 0;
+    table->search_font = false;
+    table->atlas = NULL;
+    table->sdf = sdf;
+    table->monospace = false;
+    table->cell_w = 0;
+
+    if (sdf && sdf_tables++ == 0)
+        sdf_shader = LoadShaderFromMemory(NULL, sdf_fragment_shader);
+
+    // Codepoints that aren't in the font are drawn with
+    // the glyph that raylib falls back to. No glyph has a
+    // negative codepoint, so that's what it returns for
+    // one, as long as it's a valid index.
+    int fallback = GetGlyphIndex(font, -1);
+    if (fallback < 0 || fallback >= font.glyphCount)
+        fallback = 0;
+    table->fallback = makeEntry(font, scale, fallback);
+    for (int i = 0; i < GLYPH_TABLE_DIRECT; i++)
+        table->direct[i] = table->fallback;
+
+    size_t num_wide = 0;
+    for (int i = 0; i < font.glyphCount; i++)
+        if (font.glyphs[i].value >= GLYPH_TABLE_DIRECT)
+            num_wide++;
+
+    if (num_wide > 0) {
+        while (table->capacity < 2 * num_wide)
+            if (!growHashTable(table)) {
+                table->search_font = true;
+                break;
+            }
+    }
+
+    // When a codepoint has more than one glyph, raylib
+    // uses the first one. Going backwards lets it
+    // overwrite the others.
+    for (int i = font.glyphCount-1; i >= 0; i--) {
+        int value = font.glyphs[i].value;
+        if (value < 0)
+            continue;
+        GlyphEntry entry = makeEntry(font, scale, i);
+        if (value < GLYPH_TABLE_DIRECT)
+            table->direct[value] = entry;
+        else if (!table->search_font)
+            insertEntry(table, value, entry);
+    }
+
+    if (!table->search_font)
+        table->atlas = atlas;
+
+    // The font is considered monospace when all
+    // printable ASCII symbols have the same advance.
+    float cell_w = table->direct[' '].advance;
+    bool monospace = cell_w > 0;
+    for (int c = ' '; c <= '~' && monospace; c++)
+        if (fabsf(table->direct[c].advance - cell_w) > 0.01f)
+            monospace = false;
+    table->monospace = monospace;
+    table->cell_w = cell_w;
+}
+
+void GlyphTable_free(GlyphTable *table)
+{
+    if (table->sdf && --sdf_tables == 0)
+        UnloadShader(sdf_shader);
+    free(table->keys);
+    free(table->entries);
+    table->atlas = NULL;
+    table->keys = NULL;
+    table->entries = NULL;
+    table->capacity = 0;
+    table->num_keys = 0;
+}
+
+// Look up a codepoint the font didn't have when it was
+// loaded in the atlas and add it to the hash table. If
+// it can't be rasterized, the codepoint is mapped to the
+// fallback glyph.
+static GlyphEntry addAtlasEntry(GlyphTable *table, uint32_t codepoint)
+{
+    if (2 * (table->num_keys + 1) > table->capacity && !growHashTable(table))
+        return table->fallback;
+
+    int k = lookupLazyGlyph(table->atlas, codepoint);
+    if (k == -2)
+        return table->fallback;
+
+    GlyphEntry entry = table->fallback;
+    if (k >= 0)
+        entry = (GlyphEntry) {
+            .index   = -k-1,
+            .advance = table->atlas->glyphs[k].advance * table->scale,
+        };
+    insertEntry(table, codepoint, entry);
+    return entry;
+}
+
+GlyphEntry GlyphTable_lookupSlow(GlyphTable *table, uint32_t codepoint)
+{
+    if (table->search_font && codepoint <= INT32_MAX)
+        return makeEntry(table->font, table->scale, GetGlyphIndex(table->font, codepoint));
+
+    if (table->capacity > 0) {
+        size_t mask = table->capacity - 1;
+        size_t i = hashCodepoint(codepoint) & mask;
+        while (table->keys[i] != 0) {
+            if (table->keys[i] == codepoint)
+                return table->entries[i];
+            i = (i + 1) & mask;
+        }
+    }
+
+    if (table->atlas == NULL || codepoint > 0x10FFFF)
+        return table->fallback;
+    return addAtlasEntry(table, codepoint);
+}
+
+/////////////////////////////////////////////////////////////////
+// Glyph batches                                               //
+/////////////////////////////////////////////////////////////////
+//
+// Strings are drawn by adding the quads of their glyphs to the
+// render batch of rlgl between pairs of rlBegin/rlEnd, with a
+// pair for each run of glyphs that comes from the same texture.
+// DrawTextCodepoint does the same work one glyph at the time,
+// binding the texture, setting up the vertex state and checking
+// the batch for each.
+
+typedef struct {
+    Color        tint;
+    unsigned int texture; // Of the open run, or 0
+    bool         sdf;
+} GlyphBatch;
+
+static void beginGlyphs(const GlyphTable *table, GlyphBatch *batch, Color tint)
+{
+    batch->tint = tint;
+    batch->texture = 0;
+    batch->sdf = table->sdf;
+    if (batch->sdf)
+        BeginShaderMode(sdf_shader);
+}
+
+static void closeRun(GlyphBatch *batch)
+{
+    if (batch->texture) {
+        rlEnd();
+        batch->texture = 0;
+    }
+}
+
+static void bindTexture(GlyphBatch *batch, unsigned int texture)
+{
+    if (batch->texture == texture)
+        return;
+    closeRun(batch);
+    rlSetTexture(texture);
+    rlBegin(RL_QUADS);
+    rlColor4ub(batch->tint.r, batch->tint.g, batch->tint.b, batch->tint.a);
+    rlNormal3f(0, 0, 1);
+    batch->texture = texture;
+}
+
+static void endGlyphs(GlyphBatch *batch)
+{
+    closeRun(batch);
+    rlSetTexture(0);
+    if (batch->sdf)
+        EndShaderMode();
+}
+
+static Rectangle slotRect(const GlyphAtlas *atlas, int slot)
+{
+    int index = slot % atlas->slots_per_page;
+    return (Rectangle) {
+        .x = (index % atlas->slots_per_row) * atlas->slot_size,
+        .y = (index / atlas->slots_per_row) * atlas->slot_size,
+        .width  = atlas->slot_size,
+        .height = atlas->slot_size,
+    };
+}
+
+static bool addPage(GlyphAtlas *atlas)
+{
+    Image image = {
+        .data    = calloc(GLYPH_ATLAS_PAGE_SIZE * GLYPH_ATLAS_PAGE_SIZE, 2),
+        .width   = GLYPH_ATLAS_PAGE_SIZE,
+        .height  = GLYPH_ATLAS_PAGE_SIZE,
+        .mipmaps = 1,
+        .format  = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA,
+    };
+    if (image.data == NULL)
+        return false;
+    Texture2D page = LoadTextureFromImage(image);
+    free(image.data);
+    if (page.id == 0)
+        return false;
+    if (atlas->sdf)
+        SetTextureFilter(page, TEXTURE_FILTER_BILINEAR);
+    atlas->pages[atlas->num_pages++] = page;
+    return true;
+}
+
+// Returns a slot for a new glyph, evicting the glyph
+// that was drawn least recently if there are no free
+// ones, or -1.
+static int allocSlot(GlyphAtlas *atlas, GlyphBatch *batch)
+{
+    if (atlas->num_slots == atlas->num_pages * atlas->slots_per_page
+        && atlas->num_pages < GLYPH_ATLAS_MAX_PAGES)
+        addPage(atlas);
+
+    if (atlas->num_slots < atlas->num_pages * atlas->slots_per_page)
+        return atlas->num_slots++;
+
+    if (atlas->num_slots == 0)
+        return -1;
+
+    int victim = 0;
+    for (int i = 1; i < atlas->num_slots; i++)
+        if (atlas->glyphs[atlas->owners[i]].last_used < atlas->glyphs[atlas->owners[victim]].last_used)
+            victim = i;
+
+    // Quads in the batch may still refer to the
+    // glyph, so they're drawn before it's replaced.
+    closeRun(batch);
+    rlDrawRenderBatchActive();
+
+    atlas->glyphs[atlas->owners[victim]].slot = -1;
+    return victim;
+}
+
+static void uploadGlyph(GlyphAtlas *atlas, int slot, Image image)
+{
+    int size = atlas->slot_size;
+    int pad  = GLYPH_ATLAS_PADDING;
+    unsigned char *pixels = atlas->pixels;
+
+    // Clear what the previous glyph left
+    for (int i = 0; i < size * size; i++) {
+        pixels[2*i+0] = 255;
+        pixels[2*i+1] = 0;
+    }
+
+    const unsigned char *gray = image.data;
+    int w = MIN(image.width,  size - 2 * pad);
+    int h = MIN(image.height, size - 2 * pad);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            pixels[2 * ((y + pad) * size + x + pad) + 1] = gray[y * image.width + x];
+
+    Texture2D page = atlas->pages[slot / atlas->slots_per_page];
+    UpdateTextureRec(page, slotRect(atlas, slot), pixels);
+}
+
+static bool makeResident(GlyphTable *table, GlyphBatch *batch, int k)
+{
+    GlyphAtlas *atlas = table->atlas;
+    LazyGlyph *glyph = &atlas->glyphs[k];
+    if (glyph->slot >= 0)
+        return true;
+
+    GlyphInfo *info;
+    if (atlas->pending_glyph == k) {
+        info = atlas->pending;
+        atlas->pending = NULL;
+        atlas->pending_glyph = -1;
+    } else
+        info = rasterizeGlyph(atlas, glyph->codepoint);
+    if (info == NULL)
+        return false;
+
+    int slot = allocSlot(atlas, batch);
+    if (slot >= 0) {
+        uploadGlyph(atlas, slot, info->image);
+        atlas->owners[slot] = k;
+        glyph->slot = slot;
+    }
+    UnloadFontData(info, 1);
+    return slot >= 0;
+}
+
+// Add the quad of a glyph drawn at [x, y] from the
+// area [rec] of [texture], padded by [pad] pixels.
+static void addQuad(Texture2D texture, Rectangle rec, float offset_x, float offset_y,
+                    float pad, float scale, float x, float y)
+{
+    float tex_w = texture.width;
+    float tex_h = texture.height;
+    float u0 = (rec.x - pad) / tex_w;
+    float v0 = (rec.y - pad) / tex_h;
+    float u1 = (rec.x + rec.width  + pad) / tex_w;
+    float v1 = (rec.y + rec.height + pad) / tex_h;
+
+    float x0 = x + (offset_x - pad) * scale;
+    float y0 = y + (offset_y - pad) * scale;
+    float x1 = x0 + (rec.width  + 2 * pad) * scale;
+    float y1 = y0 + (rec.height + 2 * pad) * scale;
+
+    // Flushes the batch if it's full
+    rlCheckRenderBatchLimit(4);
+
+    rlTexCoord2f(u0, v0); rlVertex2f(x0, y0);
+    rlTexCoord2f(u0, v1); rlVertex2f(x0, y1);
+    rlTexCoord2f(u1, v1); rlVertex2f(x1, y1);
+    rlTexCoord2f(u1, v0); rlVertex2f(x1, y0);
+}
+
+// Add a glyph to the batch. It's placed like
+// DrawTextCodepoint would place it.
+static void addGlyph(GlyphTable *table, GlyphBatch *batch, GlyphEntry glyph, float x, float y)
+{
+    if (glyph.index >= 0) {
+        const Font *font = &table->font;
+        bindTexture(batch, font->texture.id);
+        addQuad(font->texture, font->recs[glyph.index],
+                font->glyphs[glyph.index].offsetX,
+                font->glyphs[glyph.index].offsetY,
+                font->glyphPadding, table->scale, x, y);
+        return;
+    }
+
+    GlyphAtlas *atlas = table->atlas;
+    int k = -glyph.index - 1;
+    LazyGlyph *lazy = &atlas->glyphs[k];
+    if (lazy->width == 0 || lazy->height == 0)
+        return;
+    if (!makeResident(table, batch, k))
+        return;
+    lazy->last_used = ++atlas->clock;
+
+    Rectangle rec = slotRect(atlas, lazy->slot);
+    rec.x += GLYPH_ATLAS_PADDING;
+    rec.y += GLYPH_ATLAS_PADDING;
+    rec.width  = lazy->width;
+    rec.height = lazy->height;
+
+    Texture2D page = atlas->pages[lazy->slot / atlas->slots_per_page];
+    bindTexture(batch, page.id);
+    addQuad(page, rec, lazy->offset_x, lazy->offset_y, GLYPH_ATLAS_PADDING, table->scale, x, y);
+}
+
+/////////////////////////////////////////////////////////////////
+// Monospace layout                                            //
+/////////////////////////////////////////////////////////////////
+
+static size_t countColumns(const char *str, size_t len)
+{
+    size_t i = UTF8_skipASCII(str, len);
+    size_t columns = i;
+
+    uint32_t runes[RUNE_BATCH];
+    while (i < len) {
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+        assert(consumed > 0);
+        for (size_t j = 0; j < count; j++)
+            columns += UTF8_runeWidth(runes[j]);
+        i += consumed;
+    }
+    return columns;
+}
+
+static float renderColumns(GlyphTable *table, const char *str, size_t len,
+                           Vector2 position, Color tint)
+{
+    size_t column = 0;
+    uint32_t runes[RUNE_BATCH];
+    size_t i = 0;
+    GlyphBatch batch;
+    beginGlyphs(table, &batch, tint);
+    while (i < len) {
+
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+        assert(consumed > 0);
+
+        for (size_t j = 0; j < count; j++) {
+
+            uint32_t codepoint = runes[j];
+            assert(codepoint != '\n');
+
+            if (codepoint != ' ' && codepoint != '\t') {
+                float x = position.x + column * table->cell_w;
+                addGlyph(table, &batch, GlyphTable_lookup(table, codepoint), x, position.y);
+            }
+            column += UTF8_runeWidth(codepoint);
+        }
+        i += consumed;
+    }
+    endGlyphs(&batch);
+    return column * table->cell_w;
+}
+
+static size_t fitColumns(GlyphTable *table, const char *str, size_t len, float max_w)
+{
+    // Number of columns up to the one drawn
+    // across [max_w], included.
+    size_t target = 1;
+    if (max_w >= 0)
+        target = MIN(max_w / table->cell_w, (float) len) + 1;
+
+    // A run of ASCII takes a column per byte
+    size_t i = UTF8_skipASCII(str, MIN(len, target));
+    if (i == MIN(len, target))
+        return i;
+
+    size_t columns = i;
+    uint32_t runes[RUNE_BATCH];
+    while (i < len) {
+
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+
+        for (size_t j = 0; j < count; j++) {
+            i += UTF8_encodedLength(runes[j]);
+            columns += UTF8_runeWidth(runes[j]);
+            if (columns >= target)
+                return i;
+        }
+    }
+    assert(i == len);
+    return i;
+}
+
+/* Symbol: GlyphTable_measure
+**   Returns the width of [str] when drawn on a single
+**   line. The string must not contain newlines.
+*/
+float GlyphTable_measure(GlyphTable *table, const char *str, size_t len)
+{
+    if (table->monospace)
+        return countColumns(str, len) * table->cell_w;
+
+    float w = 0;
+    uint32_t runes[RUNE_BATCH];
+    size_t i = 0;
+    while (i < len) {
+
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+        assert(consumed > 0);
+
+        for (size_t j = 0; j < count; j++) {
+            assert(runes[j] != '\n');
+            w += GlyphTable_lookup(table, runes[j]).advance;
+        }
+        i += consumed;
+    }
+    return w;
+}
+
+/* Symbol: GlyphTable_render
+**   Draw [str] on a single line starting from [position]
+**   and return its width, which is what GlyphTable_measure
+**   would return.
+*/
+float GlyphTable_render(GlyphTable *table, const char *str, size_t len,
+                        Vector2 position, Color tint)
+{
+    if (table->monospace)
+        return renderColumns(table, str, len, position, tint);
+
+    float x = position.x;
+    uint32_t runes[RUNE_BATCH];
+    size_t i = 0;
+    GlyphBatch batch;
+    beginGlyphs(table, &batch, tint);
+    while (i < len) {
+
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+        assert(consumed > 0);
+
+        for (size_t j = 0; j < count; j++) {
+
+            uint32_t codepoint = runes[j];
+            assert(codepoint != '\n');
+
+            GlyphEntry glyph = GlyphTable_lookup(table, codepoint);
+            if (codepoint != ' ' && codepoint != '\t')
+                addGlyph(table, &batch, glyph, x, position.y);
+            x += glyph.advance;
+        }
+        i += consumed;
+    }
+    endGlyphs(&batch);
+    return x - position.x;
+}
+
+/* Symbol: GlyphTable_fit
+**   Returns the length of the prefix of [str] that ends with
+**   the symbol drawn across [max_w] pixels from its start, or
+**   [len] if the string is narrower than that.
+*/
+size_t GlyphTable_fit(GlyphTable *table, const char *str, size_t len, float max_w)
+{
+    if (table->monospace)
+        return fitColumns(table, str, len, max_w);
+
+    float w = 0;
+    uint32_t runes[RUNE_BATCH];
+    size_t i = 0;
+    while (i < len) {
+
+        size_t consumed;
+        size_t count = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+
+        for (size_t j = 0; j < count; j++) {
+
+            uint32_t codepoint = runes[j];
+
+            // Every rune was decoded from as many bytes
+            // as its encoding, invalid bytes included.
+            i += UTF8_encodedLength(codepoint);
+
+            float delta = GlyphTable_lookup(table, codepoint).advance;
+            assert(delta >= 0);
+            if (w + delta > max_w)
+                goto done;
+
+            w += delta;
+        }
+    }
+done:
+    assert(i <= len);
+    return i;
+}
+
+/* Symbol: GlyphTable_layout
+**
+**   Place the glyphs of [str] on a single line, as
+**   GlyphTable_render would, so that they can be drawn
+**   again with GlyphTable_renderLayout without decoding
+**   and looking up the string.
+**
+**   [dst] must have room for [len] glyphs. Returns how
+**   many were placed, which doesn't count whitespace,
+**   and stores the width of the string in [width].
+**
+**   [xs] must have room for [len]+1 positions. Each byte
+**   gets the x of the symbol it's part of, which for the
+**   first byte of a symbol is what GlyphTable_measure
+**   returns for the prefix before it. The last position
+**   is the width of the string.
+*/
+size_t GlyphTable_layout(GlyphTable *table, const char *str, size_t len,
+                         PlacedGlyph *dst, float *xs, float *width)
+{
+    size_t count = 0;
+    size_t column = 0;
+    size_t byte = 0;
+    float x = 0;
+    uint32_t runes[RUNE_BATCH];
+    size_t i = 0;
+    while (i < len) {
+
+        size_t consumed;
+        size_t num = UTF8_decode(str + i, len - i, runes, RUNE_BATCH, &consumed);
+        assert(consumed > 0);
+
+        for (size_t j = 0; j < num; j++) {
+
+            uint32_t codepoint = runes[j];
+            assert(codepoint != '\n');
+
+            GlyphEntry glyph = GlyphTable_lookup(table, codepoint);
+            if (table->monospace)
+                x = column * table->cell_w;
+
+            if (codepoint != ' ' && codepoint != '\t')
+                dst[count++] = (PlacedGlyph) {.glyph=glyph, .x=x};
+
+            size_t end = byte + UTF8_encodedLength(codepoint);
+            while (byte < end)
+                xs[byte++] = x;
+
+            if (table->monospace)
+                column += UTF8_runeWidth(codepoint);
+            else
+                x += glyph.advance;
+        }
+        i += consumed;
+    }
+    assert(count <= len);
+    assert(byte == len);
+
+    if (table->monospace)
+        x = column * table->cell_w;
+    xs[len] = x;
+    *width = x;
+    return count;
+}
+
+void GlyphTable_renderLayout(GlyphTable *table, const PlacedGlyph *glyphs, size_t count,
+                             Vector2 position, Color tint)
+{
+    GlyphBatch batch;
+    beginGlyphs(table, &batch, tint);
+    for (size_t i = 0; i < count; i++)
+        addGlyph(table, &batch, glyphs[i].glyph, position.x + glyphs[i].x, position.y);
+    endGlyphs(&batch);
+}
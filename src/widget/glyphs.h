@@ -0,0 +1,69 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <raylib.h>
+
+#define GLYPH_TABLE_DIRECT 256
+
+typedef struct {
+    int   index;   // In the glyphs of the font, or negative for glyphs of the atlas
+    float advance; // Already scaled to the size of the table
+} GlyphEntry;
+
+typedef struct {
+    GlyphEntry glyph;
+    float      x; // From the start of the string
+} PlacedGlyph;
+
+typedef struct GlyphAtlas GlyphAtlas;
+
+typedef struct {
+    Font  font;
+    float font_size;
+    float scale;
+
+    // Codepoints up to Latin-1 are looked up directly,
+    // the others in an open addressing hash table. Those
+    // that aren't in the font map to [fallback].
+    GlyphEntry  direct[GLYPH_TABLE_DIRECT];
+    GlyphEntry  fallback;
+    uint32_t   *keys;
+    GlyphEntry *entries;
+    size_t      capacity; // Zero or a power of 2
+    size_t      num_keys;
+    bool        search_font; // The hash table couldn't be allocated
+
+    // Glyphs rasterized on demand, or NULL
+    GlyphAtlas *atlas;
+
+    // The glyphs are signed distance fields
+    bool sdf;
+
+    // Monospace fonts are laid out in columns of [cell_w]
+    bool  monospace;
+    float cell_w;
+} GlyphTable;
+
+GlyphAtlas *GlyphAtlas_create(Font font, bool sdf, unsigned char *file_data, int file_size);
+void        GlyphAtlas_free(GlyphAtlas *atlas);
+
+void       GlyphTable_init(GlyphTable *table, Font font, float font_size, bool sdf, GlyphAtlas *atlas);
+void       GlyphTable_free(GlyphTable *table);
+GlyphEntry GlyphTable_lookupSlow(GlyphTable *table, uint32_t codepoint);
+float      GlyphTable_measure(GlyphTable *table, const char *str, size_t len);
+float      GlyphTable_render(GlyphTable *table, const char *str, size_t len, Vector2 position, Color tint);
+size_t     GlyphTable_fit(GlyphTable *table, const char *str, size_t len, float max_w);
+size_t     GlyphTable_layout(GlyphTable *table, const char *str, size_t len, PlacedGlyph *dst, float *xs, float *width);
+void       GlyphTable_renderLayout(GlyphTable *table, const PlacedGlyph *glyphs, size_t count, Vector2 position, Color tint);
+
+static inline GlyphEntry GlyphTable_lookup(GlyphTable *table, uint32_t codepoint)
+{
+    if (codepoint < GLYPH_TABLE_DIRECT)
+        return table->direct[codepoint];
+    return GlyphTable_lookupSlow(table, codepoint);
+}
+
+#endif
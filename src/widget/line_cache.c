@@ -0,0 +1,487 @@
+#include <math.h> // roundf
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../utils/basic.h"
+#include "line_cache.h"
+
+/* Line Cache
+**
+**   Most frames draw the same lines as the previous one, so
+**   the glyphs of the lines are placed once and kept here.
+**   Drawing a line that's in the cache doesn't decode its
+**   text or look up its glyphs.
+**
+**   Lines are identified by their text: a hash of the text
+**   picks a set of entries and the text is compared with
+**   the one of each entry. This way an edit only places the
+**   glyphs of the lines whose text it changed, while the
+**   lines that were only moved by it, because lines were
+**   added or removed before them, are still found.
+**
+**   Entries also keep the x of every byte of their line, so
+**   that the cursor, the selection and the offset under the
+**   mouse are found without measuring the line again.
+**
+**   Long lines, like the ones of minified files, would take
+**   a lot of memory to lay out and most of their glyphs are
+**   out of view, so they are kept as an index of the x of a
+**   byte every LINE_CACHE_CHECKPOINT. Positions in them are
+**   found by measuring from the closest checkpoint, and only
+**   the part of them that's visible is drawn.
+**
+**   Comparing long lines at every lookup would cost as much
+**   as measuring them, so they are also identified by where
+**   they start in which version of the text, when the text
+**   has versions. Their text is only compared again when
+**   the version changed, and if it's the same the entry is
+**   given the new key instead of being indexed again.
+**
+**   Entries are placed with a glyph table, so the cache is
+**   cleared when it's used with a different one.
+*/
+
+#define LINE_CACHE_SETS 64
+#define LINE_CACHE_WAYS 4
+
+// Longer lines don't go into the sets but into a few
+// entries of their own, which are indexed instead of
+// laid out.
+#define LINE_CACHE_MAX_LEN    4096
+#define LINE_CACHE_LONG_WAYS  2
+#define LINE_CACHE_CHECKPOINT 1024
+
+typedef struct {
+    size_t offset;
+    float  x;
+} Checkpoint;
+
+typedef struct {
+    char        *text;
+    size_t       len;
+    size_t       cap;  // Of [text], and [placed] or [checkpoints]
+    uint64_t     last_used; // 0 if the entry is empty
+    float        width;
+
+    // Lines up to LINE_CACHE_MAX_LEN
+    PlacedGlyph *placed;
+    size_t       num_placed;
+    float       *xs; // Of each byte, and the end of the line
+
+    // Longer lines
+    Checkpoint  *checkpoints;
+    size_t       num_checkpoints;
+    LineCacheKey key; // Of the last lookup that found the line
+} LineCacheEntry;
+
+struct LineCache {
+    GlyphTable     *glyphs;
+    uint64_t        clock;
+    LineCacheEntry *last; // Returned by the last lookup, or NULL
+    LineCacheEntry  entries[LINE_CACHE_SETS][LINE_CACHE_WAYS];
+    LineCacheEntry  long_lines[LINE_CACHE_LONG_WAYS];
+};
+
+LineCache *LineCache_create(void)
+{
+    return calloc(1, sizeof(LineCache));
+}
+
+static void freeEntry(LineCacheEntry *entry)
+{
+    free(entry->text);
+    free(entry->placed);
+    free(entry->xs);
+    free(entry->checkpoints);
+}
+
+void LineCache_destroy(LineCache *cache)
+{
+    if (cache == NULL)
+        return;
+    for (int i = 0; i < LINE_CACHE_SETS; i++)
+        for (int j = 0; j < LINE_CACHE_WAYS; j++)
+            freeEntry(&cache->entries[i][j]);
+    for (int i = 0; i < LINE_CACHE_LONG_WAYS; i++)
+        freeEntry(&cache->long_lines[i]);
+    free(cache);
+}
+
+static size_t lineLength(GapBufferLine line)
+{
+    return line.len[0] + line.len[1];
+}
+
+static uint64_t hashLine(GapBufferLine line)
+{
+    uint64_t hash = 14695981039346656037u; // FNV-1a
+    for (int k = 0; k < 2; k++)
+        for (size_t i = 0; i < line.len[k]; i++) {
+            hash ^= (unsigned char) line.str[k][i];
+            hash *= 1099511628211u;
+        }
+    return hash;
+}
+
+// Entries that were never used are empty. The buffers
+// of the entries are kept to be reused.
+static void clear(LineCache *cache)
+{
+    for (int i = 0; i < LINE_CACHE_SETS; i++)
+        for (int j = 0; j < LINE_CACHE_WAYS; j++)
+            cache->entries[i][j].last_used = 0;
+    for (int i = 0; i < LINE_CACHE_LONG_WAYS; i++)
+        cache->long_lines[i].last_used = 0;
+    cache->last = NULL;
+}
+
+// Symbols are up to 4 bytes long, and invalid bytes
+// are symbols of their own.
+static bool continuesSymbol(const char *str, size_t len, size_t i)
+{
+    return i < len && ((unsigned char) str[i] & 0xC0) == 0x80;
+}
+
+static size_t maxCheckpoints(size_t len)
+{
+    return len / LINE_CACHE_CHECKPOINT + 2;
+}
+
+// Store in [dst] the x of the start of the line and of a
+// byte every LINE_CACHE_CHECKPOINT, moved to the start of
+// the symbol after it, and of the end of the line.
+static size_t indexLine(GlyphTable *glyphs, const char *str, size_t len,
+                        Checkpoint *dst, float *width)
+{
+    size_t count = 0;
+    size_t offset = 0;
+    size_t columns = 0;
+    double x = 0; // Many small advances are added to it
+    dst[count++] = (Checkpoint) {.offset=0, .x=0};
+    while (offset < len) {
+        size_t end = MIN(offset + LINE_CACHE_CHECKPOINT, len);
+        for (int i = 0; i < 3 && continuesSymbol(str, len, end); i++)
+            end++;
+
+        // Monospace lines are counted in columns, so that the
+        // checkpoints stay on the edges of the cells.
+        float w = GlyphTable_measure(glyphs, str + offset, end - offset);
+        if (glyphs->monospace) {
+            columns += roundf(w / glyphs->cell_w);
+            x = columns * glyphs->cell_w;
+        } else
+            x += w;
+        offset = end;
+        dst[count++] = (Checkpoint) {.offset=offset, .x=x};
+    }
+    assert(count <= maxCheckpoints(len));
+    *width = x;
+    return count;
+}
+
+// Returns the last checkpoint at or before [offset]
+static Checkpoint checkpointBeforeOffset(LineCacheEntry *entry, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = entry->num_checkpoints - 1;
+    while (lo < hi) {
+        size_t mid = hi - (hi - lo) / 2;
+        if (entry->checkpoints[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return entry->checkpoints[lo];
+}
+
+// Returns the last checkpoint at or before [x], or
+// the first one if they are all after it.
+static Checkpoint checkpointBeforeX(LineCacheEntry *entry, float x)
+{
+    size_t lo = 0;
+    size_t hi = entry->num_checkpoints - 1;
+    while (lo < hi) {
+        size_t mid = hi - (hi - lo) / 2;
+        if (entry->checkpoints[mid].x <= x)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return entry->checkpoints[lo];
+}
+
+// Make room in [entry] for a line of [len] bytes. Lines
+// have at most a glyph per byte.
+static bool reserve(LineCacheEntry *entry, size_t len)
+{
+    bool indexed = len > LINE_CACHE_MAX_LEN;
+    if (entry->text && entry->cap >= len && indexed == (entry->checkpoints != NULL))
+        return true;
+
+    size_t cap = len > 0 ? len : 1;
+    char        *text = malloc(cap);
+    PlacedGlyph *placed = NULL;
+    float       *xs = NULL;
+    Checkpoint  *checkpoints = NULL;
+    bool ok;
+    if (indexed) {
+        checkpoints = malloc(maxCheckpoints(cap) * sizeof(Checkpoint));
+        ok = text && checkpoints;
+    } else {
+        placed = malloc(cap * sizeof(PlacedGlyph));
+        xs     = malloc((cap + 1) * sizeof(float));
+        ok = text && placed && xs;
+    }
+
+    if (!ok) {
+        free(text);
+        free(placed);
+        free(xs);
+        free(checkpoints);
+        return false;
+    }
+
+    freeEntry(entry);
+    entry->text = text;
+    entry->placed = placed;
+    entry->xs = xs;
+    entry->checkpoints = checkpoints;
+    entry->cap = cap;
+    return true;
+}
+
+static bool holds(LineCacheEntry *entry, GapBufferLine line, LineCacheKey key)
+{
+    if (entry->last_used == 0 || entry->len != lineLength(line))
+        return false;
+
+    if (entry->checkpoints && key.version != 0
+        && entry->key.version == key.version
+        && entry->key.offset  == key.offset)
+        return true;
+
+    bool same = !memcmp(entry->text, line.str[0], line.len[0])
+             && (line.len[1] == 0 || !memcmp(entry->text + line.len[0], line.str[1], line.len[1]));
+    if (same)
+        entry->key = key;
+    return same;
+}
+
+// Returns the entry of a line, placing its glyphs if
+// they aren't cached, or NULL if there's no memory.
+static LineCacheEntry *lookup(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key)
+{
+    if (cache->glyphs != glyphs) {
+        clear(cache);
+        cache->glyphs = glyphs;
+    }
+
+    // The cursor, selection and text of a line are
+    // usually looked up one after the other.
+    if (cache->last && holds(cache->last, line, key)) {
+        cache->last->last_used = ++cache->clock;
+        return cache->last;
+    }
+
+    size_t len = lineLength(line);
+
+    LineCacheEntry *set;
+    int ways;
+    if (len > LINE_CACHE_MAX_LEN) {
+        set = cache->long_lines;
+        ways = LINE_CACHE_LONG_WAYS;
+    } else {
+        set = cache->entries[hashLine(line) % LINE_CACHE_SETS];
+        ways = LINE_CACHE_WAYS;
+    }
+
+    LineCacheEntry *found = NULL;
+    LineCacheEntry *victim = &set[0];
+    for (int i = 0; i < ways && found == NULL; i++) {
+        LineCacheEntry *entry = &set[i];
+        if (holds(entry, line, key))
+            found = entry;
+        else if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+
+    if (found == NULL) {
+        if (!reserve(victim, len))
+            return NULL;
+        // The copy is the key of the entry, and the
+        // line is placed from it in one piece.
+        char *text = victim->text;
+        memcpy(text, line.str[0], line.len[0]);
+        if (line.len[1] > 0)
+            memcpy(text + line.len[0], line.str[1], line.len[1]);
+        victim->len = len;
+        victim->key = key;
+        if (len > LINE_CACHE_MAX_LEN)
+            victim->num_checkpoints = indexLine(glyphs, text, len, victim->checkpoints, &victim->width);
+        else
+            victim->num_placed = GlyphTable_layout(glyphs, text, len, victim->placed, victim->xs, &victim->width);
+        found = victim;
+    }
+
+    found->last_used = ++cache->clock;
+    cache->last = found;
+    return found;
+}
+
+// The line is measured and drawn one slice after
+// the other when it can't be cached.
+
+static float renderSlices(GlyphTable *glyphs, GapBufferLine line, Vector2 position, Color tint)
+{
+    float w = GlyphTable_render(glyphs, line.str[0], line.len[0], position, tint);
+    if (line.len[1] > 0) {
+        position.x += w;
+        w += GlyphTable_render(glyphs, line.str[1], line.len[1], position, tint);
+    }
+    return w;
+}
+
+static float measureSlices(GlyphTable *glyphs, GapBufferLine line, size_t offset)
+{
+    if (offset <= line.len[0])
+        return GlyphTable_measure(glyphs, line.str[0], offset);
+    return GlyphTable_measure(glyphs, line.str[0], line.len[0])
+         + GlyphTable_measure(glyphs, line.str[1], offset - line.len[0]);
+}
+
+static size_t fitSlices(GlyphTable *glyphs, GapBufferLine line, float max_w)
+{
+    if (line.len[1] == 0)
+        return GlyphTable_fit(glyphs, line.str[0], line.len[0], max_w);
+
+    float w = GlyphTable_measure(glyphs, line.str[0], line.len[0]);
+    if (w > max_w)
+        return GlyphTable_fit(glyphs, line.str[0], line.len[0], max_w);
+    return line.len[0] + GlyphTable_fit(glyphs, line.str[1], line.len[1], max_w - w);
+}
+
+// Returns the index of the first placed glyph at or after [x]
+static size_t firstPlacedFrom(LineCacheEntry *entry, float x)
+{
+    size_t lo = 0;
+    size_t hi = entry->num_placed;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry->placed[mid].x < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Symbol: LineCache_render
+**
+**   Draw a line like GlyphTable_render does, reusing the
+**   glyphs placed the last time the same text was drawn
+**   with the same glyph table.
+**
+**   Only the glyphs between [min_x] and [max_x] from the
+**   start of the line are drawn, so the cost of drawing a
+**   line doesn't depend on its length. The width of the
+**   whole line is returned.
+**
+**   [key] tells where the line starts in which version of
+**   the text, so that long lines aren't compared with the
+**   cached ones while the text doesn't change.
+*/
+float LineCache_render(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key,
+                       Vector2 position, float min_x, float max_x, Color tint)
+{
+    LineCacheEntry *entry = lookup(cache, glyphs, line, key);
+    if (entry == NULL)
+        return renderSlices(glyphs, line, position, tint);
+
+    // Glyphs may be drawn a little before they are placed
+    min_x -= glyphs->font_size;
+
+    if (entry->checkpoints) {
+        Checkpoint start = checkpointBeforeX(entry, min_x);
+        const char *visible = entry->text + start.offset;
+        size_t visible_len = GlyphTable_fit(glyphs, visible, entry->len - start.offset, max_x - start.x);
+        position.x += start.x;
+        GlyphTable_render(glyphs, visible, visible_len, position, tint);
+    } else {
+        size_t first = firstPlacedFrom(entry, min_x);
+        size_t end   = firstPlacedFrom(entry, max_x);
+        GlyphTable_renderLayout(glyphs, entry->placed + first, end - first, position, tint);
+    }
+    return entry->width;
+}
+
+/* Symbol: LineCache_measure
+**
+**   Returns the width of the first [offset] bytes of a
+**   line, like GlyphTable_measure, with the positions
+**   found when its glyphs were placed.
+*/
+float LineCache_measure(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key, size_t offset)
+{
+    assert(offset <= lineLength(line));
+
+    LineCacheEntry *entry = lookup(cache, glyphs, line, key);
+    if (entry == NULL)
+        return measureSlices(glyphs, line, offset);
+
+    if (entry->checkpoints) {
+        Checkpoint start = checkpointBeforeOffset(entry, offset);
+        return start.x + GlyphTable_measure(glyphs, entry->text + start.offset, offset - start.offset);
+    }
+    return entry->xs[offset];
+}
+
+// Monospace positions are compared in columns, like
+// GlyphTable_fit does, so that they agree at the edges
+// of the cells.
+static bool pastWidth(GlyphTable *glyphs, float x, float max_w)
+{
+    if (glyphs->monospace)
+        return roundf(x / glyphs->cell_w) >= (size_t) (max_w / glyphs->cell_w) + 1;
+    return x > max_w;
+}
+
+/* Symbol: LineCache_fit
+**
+**   Returns what GlyphTable_fit would for a line, with
+**   a binary search on the positions of its bytes.
+*/
+size_t LineCache_fit(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key, float max_w)
+{
+    // Before the line, the first symbol that takes space
+    // is picked, which only needs to look at the start.
+    if (max_w < 0)
+        return fitSlices(glyphs, line, max_w);
+
+    LineCacheEntry *entry = lookup(cache, glyphs, line, key);
+    if (entry == NULL)
+        return fitSlices(glyphs, line, max_w);
+
+    // The symbols before the checkpoint end
+    // before [max_w], so it's after it.
+    size_t len = entry->len;
+    if (entry->checkpoints) {
+        Checkpoint start = checkpointBeforeX(entry, max_w);
+        return start.offset + GlyphTable_fit(glyphs, entry->text + start.offset, len - start.offset, max_w - start.x);
+    }
+
+    // Look for the first byte placed past [max_w]. All
+    // bytes of a symbol have its position, so it's the
+    // first byte of the symbol after the one across
+    // [max_w], which is where that one ends.
+    size_t lo = 0;
+    size_t hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pastWidth(glyphs, entry->xs[mid], max_w))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
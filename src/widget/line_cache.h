@@ -0,0 +1,22 @@
+#ifndef LINE_CACHE_H
+#define LINE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "glyphs.h"
+#include "../utils/gap_buffer.h"
+
+typedef struct LineCache LineCache;
+
+typedef struct {
+    size_t   offset;  // Of the start of the line
+    uint64_t version; // Of the text, or 0 if it has none
+} LineCacheKey;
+
+LineCache *LineCache_create(void);
+void       LineCache_destroy(LineCache *cache);
+float      LineCache_render(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key, Vector2 position, float min_x, float max_x, Color tint);
+float      LineCache_measure(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key, size_t offset);
+size_t     LineCache_fit(LineCache *cache, GlyphTable *glyphs, GapBufferLine line, LineCacheKey key, float max_w);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../utils/basic.h"
+#include "line_widths.h"
+
+/* Line Widths
+**
+**   Keeps the width of each line of a buffer and the widest
+**   of them, so that a view knows how far its text can be
+**   scrolled without measuring all of its lines.
+**
+**   The widths are stored like the text of a gap buffer: an
+**   array with a gap where lines were last inserted or
+**   removed, so that editing lines near the previous edit
+**   only moves the widths between the two. The gap and the
+**   lines that weren't measured yet have a width of 0.
+**
+**   The array is split in blocks of LINE_WIDTHS_BLOCK lines
+**   and a segment tree over them keeps the widest of each
+**   block and of each range of blocks. Changing a width only
+**   updates its block and the nodes above it, and the width
+**   of the widest line is the root of the tree.
+*/
+
+#define LINE_WIDTHS_BLOCK 64
+
+struct LineWidths {
+    float  *widths;    // Of [capacity] lines, gap included
+    size_t  capacity;  // A multiple of LINE_WIDTHS_BLOCK
+    size_t  count;     // Lines in the array
+    size_t  gap_start; // Lines before the gap
+    float  *tree;      // Nodes from 1, leaves from [leaves]
+    size_t  leaves;    // Power of 2 not less than the blocks
+};
+
+LineWidths *LineWidths_create(void)
+{
+    return calloc(1, sizeof(LineWidths));
+}
+
+void LineWidths_destroy(LineWidths *widths)
+{
+    if (widths == NULL)
+        return;
+    free(widths->widths);
+    free(widths->tree);
+    free(widths);
+}
+
+static size_t gapLength(LineWidths *widths)
+{
+    return widths->capacity - widths->count;
+}
+
+static size_t physicalIndex(LineWidths *widths, size_t line)
+{
+    if (line < widths->gap_start)
+        return line;
+    return line + gapLength(widths);
+}
+
+// Update the leaves of the blocks that contain the lines
+// in the physical range [lo, hi) and the nodes above them.
+static void updateBlocks(LineWidths *widths, size_t lo, size_t hi)
+{
+    if (lo >= hi)
+        return;
+
+    size_t first = lo / LINE_WIDTHS_BLOCK;
+    size_t last  = (hi - 1) / LINE_WIDTHS_BLOCK;
+    for (size_t block = first; block <= last; block++) {
+        float *line = widths->widths + block * LINE_WIDTHS_BLOCK;
+        float widest = 0;
+        for (size_t i = 0; i < LINE_WIDTHS_BLOCK; i++)
+            widest = MAX(widest, line[i]);
+        widths->tree[widths->leaves + block] = widest;
+    }
+
+    first += widths->leaves;
+    last  += widths->leaves;
+    while (first > 1) {
+        first /= 2;
+        last  /= 2;
+        for (size_t node = first; node <= last; node++)
+            widths->tree[node] = MAX(widths->tree[2*node], widths->tree[2*node+1]);
+    }
+}
+
+// Make room for at least [capacity] lines, keeping the
+// lines where they are relative to the gap.
+static bool grow(LineWidths *widths, size_t capacity)
+{
+    capacity = (capacity + LINE_WIDTHS_BLOCK - 1) / LINE_WIDTHS_BLOCK * LINE_WIDTHS_BLOCK;
+    if (capacity <= widths->capacity)
+        return true;
+
+    size_t blocks = capacity / LINE_WIDTHS_BLOCK;
+    size_t leaves = 1;
+    while (leaves < blocks)
+        leaves *= 2;
+
+    float *array = calloc(capacity, sizeof(float));
+    float *tree  = calloc(2 * leaves, sizeof(float));
+    if (array == NULL || tree == NULL) {
+        free(array);
+        free(tree);
+        return false;
+    }
+
+    if (widths->widths) {
+        size_t after = widths->count - widths->gap_start;
+        memcpy(array, widths->widths, widths->gap_start * sizeof(float));
+        memcpy(array + capacity - after, widths->widths + widths->capacity - after, after * sizeof(float));
+    }
+    free(widths->widths);
+    free(widths->tree);
+
+    widths->widths = array;
+    widths->capacity = capacity;
+    widths->tree = tree;
+    widths->leaves = leaves;
+    updateBlocks(widths, 0, capacity);
+    return true;
+}
+
+// Move the gap so that [line] lines are before it
+static void moveGap(LineWidths *widths, size_t line)
+{
+    size_t gap = gapLength(widths);
+    size_t lo, hi;
+    if (line < widths->gap_start) {
+        size_t moved = widths->gap_start - line;
+        memmove(widths->widths + line + gap, widths->widths + line, moved * sizeof(float));
+        memset(widths->widths + line, 0, MIN(moved, gap) * sizeof(float));
+        lo = line;
+        hi = widths->gap_start + gap;
+    } else {
+        size_t moved = line - widths->gap_start;
+        memmove(widths->widths + widths->gap_start, widths->widths + widths->gap_start + gap, moved * sizeof(float));
+        memset(widths->widths + MAX(line, widths->gap_start + gap), 0,
+               (line + gap - MAX(line, widths->gap_start + gap)) * sizeof(float));
+        lo = widths->gap_start;
+        hi = line + gap;
+    }
+    widths->gap_start = line;
+    updateBlocks(widths, lo, hi);
+}
+
+/* Symbol: LineWidths_reset
+**
+**   Forget all widths and make room for [count] lines, all
+**   of width 0. Returns false if there's no memory, in which
+**   case nothing is changed.
+*/
+bool LineWidths_reset(LineWidths *widths, size_t count)
+{
+    if (!grow(widths, count))
+        return false;
+
+    memset(widths->widths, 0, widths->capacity * sizeof(float));
+    memset(widths->tree,   0, 2 * widths->leaves * sizeof(float));
+    widths->count = count;
+    widths->gap_start = count;
+    return true;
+}
+
+/* Symbol: LineWidths_splice
+**
+**   Replace [removed] lines starting from [first] with
+**   [inserted] lines of width 0. Lines past the last one
+**   aren't removed. Returns false if there's no memory, in
+**   which case nothing is changed.
+*/
+bool LineWidths_splice(LineWidths *widths, size_t first, size_t removed, size_t inserted)
+{
+    first   = MIN(first, widths->count);
+    removed = MIN(removed, widths->count - first);
+
+    size_t count = widths->count - removed + inserted;
+    if (count > widths->capacity && !grow(widths, MAX(2 * widths->capacity, count)))
+        return false;
+
+    // Removed lines join the gap, and inserted
+    // lines are taken from it, which is all 0.
+    moveGap(widths, first + removed);
+    memset(widths->widths + first, 0, removed * sizeof(float));
+    widths->gap_start = first + inserted;
+    widths->count = count;
+    updateBlocks(widths, first, first + removed);
+    return true;
+}
+
+void LineWidths_set(LineWidths *widths, size_t line, float width)
+{
+    if (line >= widths->count)
+        return;
+
+    size_t i = physicalIndex(widths, line);
+    if (widths->widths[i] == width)
+        return;
+    widths->widths[i] = width;
+    updateBlocks(widths, i, i+1);
+}
+
+/* Symbol: LineWidths_max
+**   Returns the width of the widest line.
+*/
+float LineWidths_max(LineWidths *widths)
+{
+    if (widths->tree == NULL)
+        return 0;
+    return widths->tree[1];
+}
@@ -0,0 +1,16 @@
+#ifndef LINE_WIDTHS_H
+#define LINE_WIDTHS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct LineWidths LineWidths;
+
+LineWidths *LineWidths_create(void);
+void        LineWidths_destroy(LineWidths *widths);
+bool        LineWidths_reset(LineWidths *widths, size_t count);
+bool        LineWidths_splice(LineWidths *widths, size_t first, size_t removed, size_t inserted);
+void        LineWidths_set(LineWidths *widths, size_t line, float width);
+float       LineWidths_max(LineWidths *widths);
+
+#endif
@@ -8,6 +8,10 @@ static void free_(Widget *widget);
 
 bool initTableView(TableView *table, WidgetStyle *base_style, TableStyle *style, void *context, TableFunctions funcs, TableCallback callback)
 {
+    GlyphTable *glyphs = FontCache_acquire(NULL, 24, false);
+    if (glyphs == NULL)
+        return false;
+
     initWidget(&table->base, base_style, draw, free_, handleEvent);
     table->context = context;
     table->style = style;
@@ -15,9 +19,9 @@ bool initTableView(TableView *table, WidgetStyle *base_style, TableStyle *style,
     table->callback = callback;
     table->num_rows = 0;
     table->num_columns = 0;
-    table->loaded_font = GetFontDefault();
     table->loaded_font_file = NULL;
     table->loaded_font_size = 24;
+    table->glyphs = glyphs;
     return true;
 }
 
@@ -26,14 +30,12 @@ static void reloadFont(TableView *table)
     const char *font_file = table->style->font_file;
     float       font_size = table->style->font_size;
 
-    Font font;
-    if (table->style->font_file)
-        font = LoadFontEx(font_file, font_size, NULL, 250);
-    else
-        font = GetFontDefault();
-
-    UnloadFont(table->loaded_font); // FIXME: Is it okay to unload the default font?
-    table->loaded_font = font;
+    // Fonts are shared with the other widgets using them
+    GlyphTable *glyphs = FontCache_acquire(font_file, font_size, false);
+    if (glyphs) {
+        FontCache_release(table->glyphs);
+        table->glyphs = glyphs;
+    }
     table->loaded_font_file = font_file;
     table->loaded_font_size = font_size;
 }
@@ -73,6 +75,7 @@ void tableViewChanged(TableView *table)
     table->active = -1;
     setScrollX((Widget*) table, 0);
     setScrollY((Widget*) table, 0);
+    requestRedraw();
 }
 
 static void handleEvent(Widget *widget, Event event)
@@ -101,6 +104,7 @@ static void handleEvent(Widget *widget, Event event)
         default:
         break;
     }
+    requestRedraw();
 }
 
 static void startIteration(TableView *table)
@@ -133,7 +137,7 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
     float entry_h = 2 * pad_v + table->style->entry_h;
     float entry_y = offset.y;
 
-    Font  font       = table->loaded_font;
+    GlyphTable *glyphs = table->glyphs;
     float font_size  = table->loaded_font_size;
 
     float current_table_w = 0;
@@ -175,15 +179,18 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
                 label = buffer;
             }
 
-            float spacing = 0;
-            Vector2 text_area = MeasureTextEx(font, label, font_size, spacing);
+            size_t label_len = strlen(label);
+            Vector2 text_area = {
+                .x = GlyphTable_measure(glyphs, label, label_len),
+                .y = font_size,
+            };
             
             Vector2 position = {
                 .x = cell_x + pad_h,
                 .y = cell_y + (entry_h - text_area.y) / 2,
             };
             
-            DrawTextEx(font, label, position, font_size, spacing, font_color);
+            GlyphTable_render(glyphs, label, label_len, position, font_color);
             cell_x += table->column_width[i];
 
             float cell_w = text_area.x + 2 * pad_h;
@@ -240,5 +247,5 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
 static void free_(Widget *widget)
 {
     TableView *table = (TableView*) widget;
-    (void) table;
+    FontCache_release(table->glyphs);
 }
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include "widget.h"
+#include "font_cache.h"
 
 typedef void (*TableIterFuncStart)(void *context);
 typedef void (*TableIterFuncEnd  )(void *context);
@@ -40,7 +41,7 @@ typedef struct {
     TableFunctions funcs;
     TableCallback  callback;
 
-    Font        loaded_font;
+    GlyphTable *glyphs;
     const char *loaded_font_file;
     float       loaded_font_size;
 
@@ -19,168 +19,7 @@ void setTextInputContents(TextInput *input, const char *path)
     GapBuffer *gap = input->gap;
     GapBuffer_whipeClean(gap);
     GapBuffer_insertString(gap, path, strlen(path));
-}
-
-static int UTF8ToUTF32(const char *utf8_data, int nbytes, uint32_t *utf32_code)
-{
-    assert(utf8_data != NULL);
-    assert(utf32_code != NULL);
-    assert(nbytes >= 0);
-
-    if(nbytes == 0)
-        return -1;
-
-    if(utf8_data[0] & 0x80) {
-
-        // May be UTF-8.
-            
-        if((unsigned char) utf8_data[0] >= 0xF0) {
-            // 4 bytes.
-            // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-
-            if(nbytes < 4)
-                return -1;
-                    
-            uint32_t temp 
-                = (((uint32_t) utf8_data[0] & 0x07) << 18) 
-                | (((uint32_t) utf8_data[1] & 0x3f) << 12)
-                | (((uint32_t) utf8_data[2] & 0x3f) <<  6)
-                | (((uint32_t) utf8_data[3] & 0x3f));
-
-            if(temp > 0x10ffff)
-                return -1;
-
-            *utf32_code = temp;
-            return 4;
-        }
-            
-        if((unsigned char) utf8_data[0] >= 0xE0) {
-            // 3 bytes.
-            // 1110xxxx 10xxxxxx 10xxxxxx
-
-            if(nbytes < 3)
-                return -1;
-
-            uint32_t temp
-                = (((uint32_t) utf8_data[0] & 0x0f) << 12)
-                | (((uint32_t) utf8_data[1] & 0x3f) <<  6)
-                | (((uint32_t) utf8_data[2] & 0x3f));
-                    
-            if(temp > 0x10ffff)
-                return -1;
-
-            *utf32_code = temp;
-            return 3;
-        }
-            
-        if((unsigned char) utf8_data[0] >= 0xC0) {
-            // 2 bytes.
-            // 110xxxxx 10xxxxxx
-
-            if(nbytes < 2)
-                return -1;
-
-            *utf32_code 
-                = (((uint32_t) utf8_data[0] & 0x1f) << 6)
-                | (((uint32_t) utf8_data[1] & 0x3f));
-                    
-            assert(*utf32_code <= 0x10ffff);
-            return 2;
-        }
-        
-        return -1;
-    }
-
-    // It's ASCII
-    // 0xxxxxxx
-
-    *utf32_code = (uint32_t) utf8_data[0];
-    return 1;
-}
-
-static float 
-renderString(Font font, const char *str, size_t len,
-             int off_x, int off_y, float font_size, 
-             Color tint)
-{
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    int   y = off_y;
-    float x = off_x; // Offset X to next character to draw
-
-    float spacing = 0;
-    float scale = (float) font_size / font.baseSize; // Character quad scaling factor
-
-    size_t i = 0;
-    while (i < len) {
-
-        uint32_t codepoint;
-        int consumed = UTF8ToUTF32(str + i, len - i, &codepoint);
-
-        if (consumed < 1) {
-            codepoint = '?';
-            consumed = 1;
-        }
-
-        assert(consumed > 0);
-        int glyph_index = GetGlyphIndex(font, codepoint);
-
-        assert(codepoint != '\n');
-
-        if (codepoint != ' ' && codepoint != '\t') {
-            Vector2 position = {x, y};
-            DrawTextCodepoint(font, codepoint, position, 
-                              font_size, tint);
-        }
-
-        float delta;
-        int advance_x = font.glyphs[glyph_index].advanceX;
-        if (advance_x == 0)
-            delta = (float) font.recs[glyph_index].width * scale + spacing;
-        else 
-            delta = (float) advance_x * scale + spacing;
-
-        x += delta;
-        i += consumed;
-    }
-    float w = x - (float) off_x;
-    return w;
-}
-
-static float 
-stringRenderWidth(Font font, int font_size, const char *str, size_t len)
-{
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    float scale = (float) font_size / font.baseSize;
-    float  w = 0;
-    size_t i = 0;
-    while (i < len) {
-
-        int consumed;
-        int letter = GetCodepoint(str + i, &consumed);
-        assert(letter != '\n');
-
-        int glyph_index = GetGlyphIndex(font, letter);
-
-        if (letter == 0x3f)
-            i++;
-        else
-            i += consumed;
-
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
-
-        w += delta;
-    }
-    return w;
+    requestRedraw();
 }
 
 static void handleEvent(Widget *widget, Event event);
@@ -209,11 +48,27 @@ TextInput *createTextInput(WidgetStyle *base_style, TextInputStyle *style)
         }
     }
 
+    GlyphTable *glyphs = FontCache_acquire(NULL, 14, false);
+    if (glyphs == NULL) {
+        GapBuffer_destroy(gap);
+        free(input);
+        return NULL;
+    }
+
+    LineCache *lines = LineCache_create();
+    if (lines == NULL) {
+        FontCache_release(glyphs);
+        GapBuffer_destroy(gap);
+        free(input);
+        return NULL;
+    }
+
     initWidget(&input->base, base_style, draw, free_, handleEvent);
     input->style = style;
     input->loaded_font_file = NULL;
     input->loaded_font_size = 14;
-    input->loaded_font = GetFontDefault();
+    input->glyphs = glyphs;
+    input->lines = lines;
     input->selecting = false;
     input->select_first  = 0;
     input->select_second = 0;
@@ -225,7 +80,8 @@ TextInput *createTextInput(WidgetStyle *base_style, TextInputStyle *style)
 static void free_(Widget *widget)
 {
     TextInput *input = (TextInput*) widget;
-    UnloadFont(input->loaded_font);
+    LineCache_destroy(input->lines);
+    FontCache_release(input->glyphs);
     GapBuffer_destroy(input->gap);
     free(input);
 }
@@ -235,14 +91,12 @@ static void reloadFont(TextInput *input)
     const char *font_file = input->style->font_file;
     float       font_size = input->style->font_size;
 
-    Font font;
-    if (input->style->font_file)
-        font = LoadFontEx(font_file, font_size, NULL, 250);
-    else
-        font = GetFontDefault();
-
-    UnloadFont(input->loaded_font); // FIXME: Is it okay to unload the default font?
-    input->loaded_font = font;
+    // Fonts are shared with the other widgets using them
+    GlyphTable *glyphs = FontCache_acquire(font_file, font_size, false);
+    if (glyphs) {
+        FontCache_release(input->glyphs);
+        input->glyphs = glyphs;
+    }
     input->loaded_font_file = font_file;
     input->loaded_font_size = font_size;
 }
@@ -268,6 +122,10 @@ static void dropSelection(TextInput *input)
     input->select_second = 0;
 }
 
+// The text of an input has no versions, so its lines
+// are found in the line cache by their text.
+static const LineCacheKey no_key = {0};
+
 static void drawSelection(TextInput *input, GapBufferLine line, 
                           float line_x, float line_y, 
                           float line_h, size_t line_offset)
@@ -277,8 +135,9 @@ static void drawSelection(TextInput *input, GapBufferLine line,
         
     size_t select_start = MIN(input->select_first, input->select_second);
     size_t select_end   = MAX(input->select_first, input->select_second);
+    size_t line_len     = line.len[0] + line.len[1];
 
-    if (select_start >= line_offset + line.len || select_end < line_offset)
+    if (select_start >= line_offset + line_len || select_end < line_offset)
         return;
 
     size_t select_in_line_start;
@@ -289,18 +148,21 @@ static void drawSelection(TextInput *input, GapBufferLine line,
     else
         select_in_line_start = select_start - line_offset;
 
-    if (select_end < line_offset + line.len)
+    if (select_end < line_offset + line_len)
         select_in_line_end = select_end - line_offset;
     else
-        select_in_line_end = line.len;
+        select_in_line_end = line_len;
 
-    Font       font = input->loaded_font;
-    float font_size = input->loaded_font_size;
+    GlyphTable *glyphs = input->glyphs;
+    LineCache  *lines  = input->lines;
+
+    float start_x = LineCache_measure(lines, glyphs, line, no_key, select_in_line_start);
+    float   end_x = LineCache_measure(lines, glyphs, line, no_key, select_in_line_end);
 
     Rectangle selection_rect = {
-        .x = line_x + stringRenderWidth(font, font_size, line.str, select_in_line_start),
+        .x = line_x + start_x,
         .y = line_y,
-        .width  = stringRenderWidth(font, font_size, line.str + select_in_line_start, select_in_line_end - select_in_line_start),
+        .width  = end_x - start_x,
         .height = line_h,
     };
     DrawRectangleRec(selection_rect, (Color) {0x34, 0x37, 0x45, 0xff});
@@ -308,8 +170,6 @@ static void drawSelection(TextInput *input, GapBufferLine line,
 
 static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
 {
-    (void) area;
-
     TextInput *input = (TextInput*) widget;
     reloadStyleIfChanged(input);
 
@@ -324,7 +184,7 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
     if (getFocus() != widget)
         cursor_color = GRAY;
 
-    Font      font = input->loaded_font;
+    GlyphTable *glyphs = input->glyphs;
     GapBuffer *gap = input->gap;
     
     size_t cursor = GapBuffer_rawCursorPosition(gap);
@@ -335,6 +195,9 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
 
     Vector2 logic_area = {0, 0};
 
+    float visible_x0 = input->base.scroll.x - pad_h;
+    float visible_x1 = visible_x0 + area.x;
+
     int line_x = offset.x + pad_h;
     int line_y = offset.y + pad_v;
     bool   drew_cursor = false;
@@ -344,21 +207,23 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
 
         drawSelection(input, line, line_x, line_y, line_h, line_offset);
         
-        float line_w = renderString(font, line.str, line.len, 
-                                    line_x, line_y, font_size, 
-                                    font_color);
+        float line_w = LineCache_render(input->lines, glyphs, line, no_key,
+                                        (Vector2) {line_x, line_y},
+                                        visible_x0, visible_x1,
+                                        font_color);
         
         logic_area.x = MAX(logic_area.x, 2*pad_h + line_w);
 
-        if (cursor >= line_offset && cursor <= line_offset + line.len) {
-            int relative_cursor_x = stringRenderWidth(font, font_size, line.str, cursor - line_offset);
+        size_t line_len = line.len[0] + line.len[1];
+        if (cursor >= line_offset && cursor <= line_offset + line_len) {
+            int relative_cursor_x = LineCache_measure(input->lines, glyphs, line, no_key, cursor - line_offset);
             DrawRectangle(line_x + relative_cursor_x, line_y, cursor_w, line_h, cursor_color);
             drew_cursor = true;
             line_w += cursor_w;
         }
 
         line_y += line_h;
-        line_offset += line.len + 1; // line.len doesn't count the \n
+        line_offset += line_len + 1; // [line_len] doesn't count the \n
         line_count++;
     }
     GapBufferIter_free(&iter);
@@ -373,51 +238,6 @@ static Vector2 draw(Widget *widget, Vector2 offset, Vector2 area)
     return logic_area;
 }
 
-static size_t 
-longestSubstringThatRendersInLessPixelsThan(Font font, int font_size,
-                                            const char *str, size_t len, 
-                                            float max_px_len)
-{
-    if (str == NULL)
-        str = "";
-
-    if (font.texture.id == 0) 
-        font = GetFontDefault();
-
-    float scale = (float) font_size / font.baseSize;
-
-    float  w = 0;
-    size_t i = 0;
-    while (i < len) {
-
-        uint32_t codepoint;
-        int consumed = UTF8ToUTF32(str + i, len - i, &codepoint);
-
-        if (consumed < 0) {
-            codepoint = '?';
-            consumed = 1;
-        }
-        i += consumed;
-        int glyph_index = GetGlyphIndex(font, codepoint);
-
-        float delta;
-        int advanceX = font.glyphs[glyph_index].advanceX;
-        if (advanceX)
-            delta = (float) advanceX * scale;
-        else
-            delta = (float) font.recs[glyph_index].width * scale
-                  + (float) font.glyphs[glyph_index].offsetX * scale;
-        
-        assert(delta >= 0);
-        if (w + delta > max_px_len)
-            break;
-
-        w += delta;
-    }
-    assert(i <= len);
-    return i;
-}
-
 static size_t 
 getOffsetAssociatedToCoordinates(TextInput *input, 
                                  Vector2 point)
@@ -429,27 +249,25 @@ getOffsetAssociatedToCoordinates(TextInput *input,
     float pad_v     = input->style->pad_v;
 
     int line_index = (point.y - pad_v) / (input->style->line_h * font_size);
+    line_index = MAX(line_index, 0);
+
+    // Jump straight to the clicked line using the
+    // line index of the buffer.
+    size_t line_offset = GapBuffer_getLineOffset(gap, line_index);
 
     GapBufferLine line;
     GapBufferIter iter;
-    GapBufferIter_init(&iter, gap);
-    bool not_last = true;
-    int  index = 0;
-    size_t line_offset = 0;
-    while (index < line_index && (not_last = GapBufferIter_next(&iter, &line))) {
-        index++;
-        line_offset += line.len + 1;
-    }
+    GapBufferIter_initAtLine(&iter, gap, line_index);
 
     size_t cursor;
-    if (not_last && GapBufferIter_next(&iter, &line))
-        cursor = line_offset + longestSubstringThatRendersInLessPixelsThan(input->loaded_font, font_size, // This function name is too long..
-                                                                           line.str, line.len, point.x - pad_h);
+    if ((size_t) line_index < GapBuffer_getLineCount(gap) && GapBufferIter_next(&iter, &line))
+        cursor = line_offset + LineCache_fit(input->lines, input->glyphs, line, no_key, point.x - pad_h);
     else
         // If the line index is out of bounds, then the line offset
         // will be the number of bytes in the file, which is an out
         // of bounds index.
         cursor = MIN(line_offset, GapBuffer_getByteCount(gap));
+    GapBufferIter_free(&iter);
     return cursor;
 }
 
@@ -474,10 +292,15 @@ static void removeSelectionAndMoveCursorThere(TextInput *input)
 
         size_t select_start = MIN(input->select_first, input->select_second);
         size_t select_end   = MAX(input->select_first, input->select_second);
-                
-        size_t num_selected_bytes = select_end - select_start;
-        GapBuffer_moveAbsolute(gap, input->select_first);
-        GapBuffer_removeForwardsRaw(gap, num_selected_bytes);
+
+        GapBufferEdit edit = {
+            .offset = select_start,
+            .delete_len = select_end - select_start,
+            .insert = "",
+            .insert_len = 0,
+        };
+        if (!GapBuffer_applyEdits(gap, &edit, 1))
+            fprintf(stderr, "Couldn't remove selection\n");
 
         dropSelection(input);
         input->selecting = false;
@@ -595,4 +418,5 @@ static void handleEvent(Widget *widget, Event event)
         default:
         break;
     }
+    requestRedraw();
 }
@@ -2,6 +2,8 @@
 #define TEXT_INPUT_H
 
 #include "widget.h"
+#include "font_cache.h"
+#include "line_cache.h"
 #include "../utils/gap_buffer.h"
 
 typedef struct {
@@ -21,7 +23,8 @@ typedef struct {
     TextInputStyle *style;
     const char *loaded_font_file;
     float       loaded_font_size;
-    Font        loaded_font;
+    GlyphTable *glyphs;
+    LineCache  *lines;
     bool        selecting;
     size_t      select_first;
     size_t      select_second;
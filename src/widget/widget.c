@@ -1,6 +1,9 @@
-#include <math.h> // fabs
+#include <math.h> // floor, ceil
 #include <assert.h>
 #include <stddef.h>
+#include <string.h>
+#include <raylib.h>
+#include <rlgl.h> // After raylib.h, which defines the types it shares
 #include "../utils/basic.h"
 #include "widget.h"
 
@@ -22,10 +25,10 @@ void initWidget(Widget *widget, WidgetStyle *style, WidgetFuncDraw draw,
     widget->scroll.x = 0;
     widget->scroll.y = 0;
     widget->scrolling = false;
-    widget->target.id = 0;
     widget->draw = draw;
     widget->free = free;
     widget->handleEvent = handleEvent;
+    requestRedraw();
 }
 
 void setMarginX(Widget *widget, float x)
@@ -351,55 +354,220 @@ drawBackground(Widget *widget, Vector2 offset, Vector2 area)
     DrawRectangleRounded(rect, roundness, segments, color);
 }
 
-void drawWidget(Widget *widget, Vector2 offset, Vector2 area)
+/* Clipping
+**
+**   Widgets whose content is bigger than their area are
+**   clipped with the scissor test and draw directly into the
+**   window. Clip rectangles nest: each one is cut to the one
+**   of the widget it's drawn into, and the one it replaced is
+**   restored when the widget is done drawing.
+**
+**   The clip stack is MAX_CLIP_DEPTH deep. Widgets nested
+**   deeper than that are drawn into a render texture taken
+**   from a small pool and copied into the window. Pooled
+**   textures are sized in steps of TEXTURE_POOL_STEP pixels
+**   so that resizing a widget doesn't reallocate them at
+**   every frame.
+*/
+
+#define MAX_CLIP_DEPTH    16
+#define TEXTURE_POOL_SIZE 4
+#define TEXTURE_POOL_STEP 64
+
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} ClipRect;
+
+typedef struct {
+    RenderTexture2D target;
+    bool used;
+} PooledTexture;
+
+static ClipRect clip_stack[MAX_CLIP_DEPTH];
+static int      clip_depth = 0;
+
+static PooledTexture texture_pool[TEXTURE_POOL_SIZE];
+
+static void applyClip(void)
 {
-    Vector2 logic_area;
-    if (isBiggerThanViewport(widget)) {
-        
-        Vector2 logic_offset;
-        logic_offset.x = - widget->scroll.x;
-        logic_offset.y = - widget->scroll.y;
-
-        bool area_bigger_than_texture = fabs(widget->target.texture.width  - area.x) >= 1 
-                                     || fabs(widget->target.texture.height - area.y) >= 1;
-        if (area_bigger_than_texture) {
-            UnloadRenderTexture(widget->target);
-            widget->target.id = 0;
-        }
+    if (clip_depth == 0) {
+        EndScissorMode();
+        return;
+    }
+    ClipRect rect = clip_stack[clip_depth-1];
+    BeginScissorMode(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
 
-        int w = ceil(area.x);
-        int h = ceil(area.y);
-        if (widget->target.id == 0 && w > 0 && h > 0)
-            widget->target = LoadRenderTexture(w, h);
-
-        BeginTextureMode(widget->target);
-        drawBackground(widget, (Vector2) {.x=0, .y=0}, area);
-        logic_area = widget->draw(widget, logic_offset, area);
-        drawScrollbars(widget);
-        EndTextureMode();
-
-        Rectangle src, dst;
-        src.x = 0;
-        src.y = 0;
-        src.width  =  area.x;
-        src.height = -area.y;
-        dst.x = offset.x;
-        dst.y = offset.y;
-        dst.width  = area.x;
-        dst.height = area.y;
-        Vector2 org = {0, 0};
-        DrawTexturePro(widget->target.texture, src, dst, org, 0, WHITE);
+// Returns false if the stack is full, in which
+// case the clip rectangle isn't changed.
+static bool pushClip(Vector2 offset, Vector2 area)
+{
+    if (clip_depth == MAX_CLIP_DEPTH)
+        return false;
 
-    } else {
-        
-        drawBackground(widget, offset, area);
-        
-        Vector2 logic_offset;
-        logic_offset.x = offset.x - widget->scroll.x;
-        logic_offset.y = offset.y - widget->scroll.y;
+    ClipRect rect;
+    rect.x0 = floor(offset.x);
+    rect.y0 = floor(offset.y);
+    rect.x1 = ceil(offset.x + area.x);
+    rect.y1 = ceil(offset.y + area.y);
 
-        logic_area = widget->draw(widget, logic_offset, area);
+    if (clip_depth > 0) {
+        ClipRect outer = clip_stack[clip_depth-1];
+        rect.x0 = MAX(rect.x0, outer.x0);
+        rect.y0 = MAX(rect.y0, outer.y0);
+        rect.x1 = MIN(rect.x1, outer.x1);
+        rect.y1 = MIN(rect.y1, outer.y1);
     }
+    rect.x1 = MAX(rect.x0, rect.x1);
+    rect.y1 = MAX(rect.y0, rect.y1);
+
+    clip_stack[clip_depth++] = rect;
+    applyClip();
+    return true;
+}
+
+static void popClip(void)
+{
+    assert(clip_depth > 0);
+    clip_depth--;
+    applyClip();
+}
+
+static int textureArea(RenderTexture2D target)
+{
+    return target.texture.width * target.texture.height;
+}
+
+// Returns a texture of at least [w] by [h] pixels, or one
+// with an id of 0 if all pooled textures are in use or it
+// can't be created.
+static RenderTexture2D borrowTexture(int w, int h)
+{
+    PooledTexture *fit  = NULL; // Smallest texture that's big enough
+    PooledTexture *slot = NULL; // Where to create one if none is
+    for (int i = 0; i < TEXTURE_POOL_SIZE; i++) {
+
+        PooledTexture *pooled = &texture_pool[i];
+        if (pooled->used)
+            continue;
+
+        if (pooled->target.id == 0) {
+            slot = pooled;
+            continue;
+        }
+
+        if (pooled->target.texture.width >= w && pooled->target.texture.height >= h) {
+            if (fit == NULL || textureArea(pooled->target) < textureArea(fit->target))
+                fit = pooled;
+        } else if (slot == NULL)
+            slot = pooled;
+    }
+
+    if (fit == NULL) {
+        if (slot == NULL)
+            return (RenderTexture2D) {0};
+
+        if (slot->target.id != 0)
+            UnloadRenderTexture(slot->target);
+        int step = TEXTURE_POOL_STEP;
+        slot->target = LoadRenderTexture((w + step - 1) / step * step,
+                                         (h + step - 1) / step * step);
+        if (slot->target.id == 0)
+            return (RenderTexture2D) {0};
+        fit = slot;
+    }
+
+    fit->used = true;
+    return fit->target;
+}
+
+static void giveBackTexture(RenderTexture2D target)
+{
+    for (int i = 0; i < TEXTURE_POOL_SIZE; i++)
+        if (texture_pool[i].target.id == target.id)
+            texture_pool[i].used = false;
+}
+
+// Draw the background, contents and scrollbars of [widget]
+// with its top-left corner at [offset].
+static Vector2 drawWidgetContents(Widget *widget, Vector2 offset, Vector2 area)
+{
+    drawBackground(widget, offset, area);
+
+    Vector2 logic_offset;
+    logic_offset.x = offset.x - widget->scroll.x;
+    logic_offset.y = offset.y - widget->scroll.y;
+    Vector2 logic_area = widget->draw(widget, logic_offset, area);
+
+    // The scrollbar regions are relative to the widget
+    rlPushMatrix();
+    rlTranslatef(offset.x, offset.y, 0);
+    drawScrollbars(widget);
+    rlPopMatrix();
+
+    return logic_area;
+}
+
+// Draw [widget] into a pooled render texture and copy it into
+// the current target. The clip stack is emptied while drawing
+// into the texture, so that the widget's children clip with
+// the texture's coordinates.
+static Vector2 drawWidgetOffscreen(Widget *widget, Vector2 offset, Vector2 area)
+{
+    int w = ceil(area.x);
+    int h = ceil(area.y);
+    if (w <= 0 || h <= 0)
+        return widget->last_logic_area;
+
+    RenderTexture2D target = borrowTexture(w, h);
+    if (target.id == 0)
+        // Draw it unclipped
+        return drawWidgetContents(widget, offset, area);
+
+    ClipRect saved_stack[MAX_CLIP_DEPTH];
+    int      saved_depth = clip_depth;
+    memcpy(saved_stack, clip_stack, sizeof(clip_stack));
+    clip_depth = 0;
+    EndScissorMode();
+
+    BeginTextureMode(target);
+    ClearBackground(BLANK);
+    Vector2 logic_area = drawWidgetContents(widget, (Vector2) {0, 0}, area);
+    EndTextureMode();
+
+    memcpy(clip_stack, saved_stack, sizeof(clip_stack));
+    clip_depth = saved_depth;
+    applyClip();
+
+    // Textures are upside down, and the pooled one may
+    // be bigger than the widget, which is at its top.
+    Rectangle src, dst;
+    src.x = 0;
+    src.y = target.texture.height - area.y;
+    src.width  =  area.x;
+    src.height = -area.y;
+    dst.x = offset.x;
+    dst.y = offset.y;
+    dst.width  = area.x;
+    dst.height = area.y;
+    Vector2 org = {0, 0};
+    DrawTexturePro(target.texture, src, dst, org, 0, WHITE);
+
+    giveBackTexture(target);
+    return logic_area;
+}
+
+void drawWidget(Widget *widget, Vector2 offset, Vector2 area)
+{
+    Vector2 logic_area;
+    if (!isBiggerThanViewport(widget))
+        logic_area = drawWidgetContents(widget, offset, area);
+    else if (pushClip(offset, area)) {
+        logic_area = drawWidgetContents(widget, offset, area);
+        popClip();
+    } else
+        logic_area = drawWidgetOffscreen(widget, offset, area);
 /*
     {
         Rectangle rect;
@@ -414,8 +582,9 @@ void drawWidget(Widget *widget, Vector2 offset, Vector2 area)
     widget->last_area = area;
     widget->last_logic_area = logic_area;
 
-    widget->scroll.x = clampHorizontalScrollValue(widget, widget->scroll.x);
-    widget->scroll.y =   clampVerticalScrollValue(widget, widget->scroll.y);
+    // The logic area may have shrunk under the scroll
+    setScrollX(widget, widget->scroll.x);
+    setScrollY(widget, widget->scroll.y);
 }
 
 void handleWidgetEvent(Widget *widget, Event event)
@@ -428,10 +597,8 @@ void handleWidgetEvent(Widget *widget, Event event)
         if (!widget->scrolling) {
             Vector2 scale = {.x=50, .y=50};
             Vector2 delta = event.wheel;
-            widget->scroll.x -= scale.x * delta.x;
-            widget->scroll.y -= scale.y * delta.y;
-            widget->scroll.x = clampHorizontalScrollValue(widget, widget->scroll.x);
-            widget->scroll.y = clampVerticalScrollValue(widget, widget->scroll.y);
+            setScrollX(widget, widget->scroll.x - scale.x * delta.x);
+            setScrollY(widget, widget->scroll.y - scale.y * delta.y);
         }
         break;
 
@@ -445,16 +612,14 @@ void handleWidgetEvent(Widget *widget, Event event)
                 // Scrolling vertically
                 float track = getVerticalScrollTrackRegion(widget).height;
                 float delta = (event.mouse.y - widget->mouse_start) * logic_area.y / track;
-                widget->scroll.y = widget->scroll_start + delta;
-                widget->scroll.y = clampVerticalScrollValue(widget, widget->scroll.y);
+                setScrollY(widget, widget->scroll_start + delta);
 
             } else {
 
                 // Scrolling horizontally
                 float track = getHorizontalScrollTrackRegion(widget).width;
                 float delta = (event.mouse.x - widget->mouse_start) * logic_area.x / track;
-                widget->scroll.x = widget->scroll_start + delta;
-                widget->scroll.x = clampHorizontalScrollValue(widget, widget->scroll.x);
+                setScrollX(widget, widget->scroll_start + delta);
             }
             handled = true;
         }
@@ -465,6 +630,7 @@ void handleWidgetEvent(Widget *widget, Event event)
             handled = true;
             widget->scrolling = false;
             setMouseFocus(NULL);
+            requestRedraw();
         }
         break;
         
@@ -476,6 +642,7 @@ void handleWidgetEvent(Widget *widget, Event event)
             widget->mouse_start = event.mouse.y;
             widget->scroll_start = widget->scroll.y;
             setMouseFocus(widget);
+            requestRedraw();
         } else if (CheckCollisionPointRec(event.mouse, getHorizontalScrollThumbRegion(widget))) {
             handled = true;
             widget->scrolling = true;
@@ -483,6 +650,7 @@ void handleWidgetEvent(Widget *widget, Event event)
             widget->mouse_start = event.mouse.x;
             widget->scroll_start = widget->scroll.x;
             setMouseFocus(widget);
+            requestRedraw();
         }
         break;
 
@@ -499,12 +667,20 @@ void handleWidgetEvent(Widget *widget, Event event)
 
 void setScrollX(Widget *widget, float x)
 {
-    widget->scroll.x = clampHorizontalScrollValue(widget, x);
+    x = clampHorizontalScrollValue(widget, x);
+    if (x != widget->scroll.x) {
+        widget->scroll.x = x;
+        requestRedraw();
+    }
 }
 
 void setScrollY(Widget *widget, float y)
 {
-    widget->scroll.y = clampVerticalScrollValue(widget, y);
+    y = clampVerticalScrollValue(widget, y);
+    if (y != widget->scroll.y) {
+        widget->scroll.y = y;
+        requestRedraw();
+    }
 }
 
 static Widget *focus = NULL;
@@ -512,9 +688,6 @@ static Widget *mouse_focus = NULL;
 
 void freeWidget(Widget *widget)
 {
-    if (widget->target.id != 0)
-        UnloadRenderTexture(widget->target);
-    
     if (widget->free)
         widget->free(widget);
     
@@ -526,6 +699,12 @@ void freeWidget(Widget *widget)
 
 void setFocus(Widget *widget)
 {
+    if (focus == widget)
+        return;
+    if (focus)
+        requestRedraw();
+    if (widget)
+        requestRedraw();
     focus = widget;
 }
 
@@ -543,3 +722,36 @@ Widget *getMouseFocus(void)
 {
     return mouse_focus;
 }
+
+/* Redraw Requests
+**
+**   Widgets ask for the window to be drawn again when
+**   something that's drawn changes, like their content,
+**   scroll or focus, and frames are only drawn when one of
+**   them did (see drawFrame). There's one flag for the whole
+**   window, which is always drawn in full: it's what lets an
+**   idle window skip frames, not a way to draw less of it.
+**
+**   Asking while a frame is drawn asks for another one right
+**   away, which is how widgets animate or wait for something
+**   to happen in the background.
+*/
+
+static bool redraw_requested = true;
+
+void requestRedraw(void)
+{
+    redraw_requested = true;
+}
+
+bool isRedrawRequested(void)
+{
+    return redraw_requested;
+}
+
+// Called when a frame starts being drawn, so that the
+// requests made from now on are drawn by the next one.
+void clearRedrawRequest(void)
+{
+    redraw_requested = false;
+}
@@ -39,7 +39,6 @@ struct Widget {
     bool scrolldir;
     float  mouse_start;
     float scroll_start;
-    RenderTexture2D target;
     WidgetFuncDraw draw;
     WidgetFuncFree free;
     WidgetFuncHandleEvent handleEvent;
@@ -51,6 +50,10 @@ Widget *getFocus(void);
 void    setMouseFocus(Widget *widget);
 Widget *getMouseFocus(void);
 
+void requestRedraw(void);
+bool isRedrawRequested(void);
+void clearRedrawRequest(void);
+
 void initWidget(Widget *widget, WidgetStyle *style, WidgetFuncDraw draw, WidgetFuncFree free, WidgetFuncHandleEvent handleEvent);
 void freeWidget(Widget *widget);
 void drawWidget(Widget *widget, Vector2 offset, Vector2 area);
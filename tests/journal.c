@@ -0,0 +1,113 @@
+// Tests of the undo journal
+//
+// Usage: test_journal [seed]
+//
+// A long history of edits is recorded in a journal whose
+// memory limit is smaller than any record, so all but the
+// newest record are moved to its temporary file. Part of
+// the history is undone and written over, then all of it
+// is undone and redone, and the text is compared with the
+// one saved before each change at every step.
+
+#include "../src/utils/journal.h"
+#include "test.h"
+#include "text.h"
+
+// Apply the steps of one change, and of the ones joined to it
+static bool replayChange(Journal *journal, Text *text, bool redo)
+{
+    JournalStep step;
+    if (!(redo ? Journal_redo(journal, &step) : Journal_undo(journal, &step)))
+        return false;
+    for (;;) {
+        replaceText(text, step.offset, step.remove_len, step.insert, step.insert_len);
+        if (!step.more)
+            return true;
+        bool ok = redo ? Journal_redo(journal, &step) : Journal_undo(journal, &step);
+        CHECK(ok, "A joined step is missing");
+        if (!ok)
+            return true;
+    }
+}
+
+static void testJournal(void)
+{
+    // Records are larger than the memory limit,
+    // so all but the newest are in the file.
+    Journal *journal = Journal_create(64);
+
+    Text text = {malloc(1024), 1024};
+    for (size_t i = 0; i < text.size; i++)
+        text.data[i] = 'a' + rand() % 26;
+
+    Text  *saved = malloc(sizeof(Text));
+    size_t num_saved = 1;
+    size_t current = 0;
+    saved[0] = copyText(text.data, text.size);
+
+    for (int i = 0; i < 600 && failures == 0; i++) {
+
+        if (i == 400) {
+            // Undo part of the history and write over it
+            for (int k = 0; k < 150; k++) {
+                CHECK(replayChange(journal, &text, false), "Nothing to undo");
+                current--;
+            }
+            for (size_t k = current + 1; k < num_saved; k++)
+                free(saved[k].data);
+            num_saved = current + 1;
+        }
+
+        // Replacements are never merged with each other,
+        // but some are joined to the previous one.
+        size_t offset  = rand() % text.size;
+        size_t removed = 1 + rand() % MIN(text.size - offset, (size_t) 8);
+        char inserted[16];
+        size_t inserted_len = 1 + rand() % 16;
+        for (size_t k = 0; k < inserted_len; k++)
+            inserted[k] = 'A' + rand() % 26;
+        bool joined = i > 0 && i != 400 && rand() % 4 == 0;
+
+        char *dst = Journal_record(journal, offset, removed, inserted, inserted_len, offset, joined);
+        CHECK(dst != NULL, "Couldn't record");
+        memcpy(dst, text.data + offset, removed);
+        replaceText(&text, offset, removed, inserted, inserted_len);
+
+        if (joined) {
+            free(saved[current].data);
+            saved[current] = copyText(text.data, text.size);
+        } else {
+            saved = realloc(saved, (++num_saved) * sizeof(Text));
+            saved[++current] = copyText(text.data, text.size);
+        }
+    }
+
+    while (failures == 0 && replayChange(journal, &text, false)) {
+        CHECK(current > 0, "Undid past the start");
+        current--;
+        CHECK(sameBytes(&saved[current], text.data, text.size),
+              "Undo from the file gives the wrong text at change %zu", current);
+    }
+    CHECK(current == 0, "Could only undo back to change %zu", current);
+
+    while (failures == 0 && replayChange(journal, &text, true)) {
+        current++;
+        CHECK(current < num_saved, "Redid past the end");
+        CHECK(sameBytes(&saved[current], text.data, text.size),
+              "Redo from the file gives the wrong text at change %zu", current);
+    }
+    CHECK(current + 1 == num_saved, "Could only redo up to change %zu of %zu", current, num_saved);
+
+    Journal_destroy(journal);
+    for (size_t i = 0; i < num_saved; i++)
+        free(saved[i].data);
+    free(saved);
+    free(text.data);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = startTest(argc, argv);
+    testJournal();
+    return finishTest(seed, "Journal replays its history");
+}
@@ -0,0 +1,62 @@
+// Scaffolding of the tests of vectorized kernels
+//
+// The tests include the module the kernels are in, since
+// they're private to it, and then this file, which uses
+// the Kernels table the module defines. The vectorized
+// kernels the CPU supports are compared with the scalar
+// ones, which are always the first set.
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string.h>
+#include "test.h"
+
+typedef struct {
+    const char *name;
+    Kernels     kernels;
+} KernelSet;
+
+static KernelSet sets[3];
+static size_t num_sets = 0;
+
+static void addKernelSet(const char *name, Kernels kernels)
+{
+    sets[num_sets++] = (KernelSet) {name, kernels};
+}
+
+// Say which of the [module] kernels are tested
+static void listKernelSets(const char *module)
+{
+    for (size_t k = 1; k < num_sets; k++)
+        printf("Testing the %s %s kernels\n", sets[k].name, module);
+    if (num_sets == 1)
+        printf("No vectorized %s kernels on this CPU\n", module);
+}
+
+static void fail(const char *name, const char *what, const char *str, size_t len)
+{
+    fprintf(stderr, "%s: %s differs on a string of %zu bytes:", name, what, len);
+    for (size_t i = 0; i < len && i < 64; i++)
+        fprintf(stderr, " %02x", (unsigned char) str[i]);
+    fprintf(stderr, len > 64 ? " ...\n" : "\n");
+    failures++;
+}
+
+// Copy [len] bytes of [src] at [shift] bytes from the start
+// of memory of their exact size, so that reads past them hit
+// the redzone of the address sanitizer. The copy is released
+// with freeString.
+static char *placeString(const char *src, size_t len, size_t shift)
+{
+    char *str = (char*) malloc(shift + len + 1) + shift;
+    memcpy(str, src, len);
+    return str;
+}
+
+static void freeString(char *str, size_t shift)
+{
+    free(str - shift);
+}
+
+#endif
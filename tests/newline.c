@@ -0,0 +1,100 @@
+// Tests of the newline kernels
+//
+// Usage: test_newline [seed]
+//
+// The vectorized kernels the CPU supports are compared with
+// the scalar ones on random strings and on strings built to
+// put newlines at the boundaries of the blocks the kernels
+// process. Strings are copied in buffers of their exact size
+// at varying alignments, so that reads past the end are
+// caught by the address sanitizer.
+
+#include "../src/utils/newline.c"
+#include "kernels.h"
+
+#define MAX_LENGTH 600
+
+static void checkString(const char *src, size_t len, size_t shift)
+{
+    char *str = placeString(src, len, shift);
+
+    size_t count = countScalar(str, len);
+    size_t last  = findLastScalar(str, len);
+
+    for (size_t k = 1; k < num_sets; k++) {
+        KernelSet *set = &sets[k];
+
+        if (set->kernels.count(str, len) != count)
+            fail(set->name, "count", str, len);
+
+        if (set->kernels.findLast(str, len) != last)
+            fail(set->name, "findLast", str, len);
+
+        for (size_t nth = 1; nth <= count + 1; nth++) {
+            size_t expected_nth = nth;
+            size_t actual_nth = nth;
+            size_t expected = findNthScalar(str, len, &expected_nth);
+            size_t actual = set->kernels.findNth(str, len, &actual_nth);
+            if (actual != expected || actual_nth != expected_nth) {
+                fail(set->name, "findNth", str, len);
+                break;
+            }
+        }
+    }
+    freeString(str, shift);
+}
+
+static void randomString(char *dst, size_t len)
+{
+    // Sometimes sparse, sometimes dense, sometimes bytes
+    // that only differ from '\n' in the sign bit.
+    int mode = rand() % 4;
+    for (size_t i = 0; i < len; i++) {
+        switch (mode) {
+            case 0: dst[i] = rand() % 64 ? 'a' + rand() % 26 : '\n'; break;
+            case 1: dst[i] = rand() % 2  ? '\n' : 'x'; break;
+            case 2: dst[i] = rand() % 2  ? '\n' : (char) 0x8A; break;
+            case 3: dst[i] = rand(); break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = startTest(argc, argv);
+
+    addKernelSet("scalar", (Kernels) {findLastScalar, findNthScalar, countScalar});
+#ifdef SIMD_X86
+    if (cpuHasSSE2())
+        addKernelSet("sse2", (Kernels) {findLastSSE2, findNthSSE2, countSSE2});
+    if (cpuHasAVX2())
+        addKernelSet("avx2", (Kernels) {findLastAVX2, findNthAVX2, countAVX2});
+#endif
+    listKernelSets("newline");
+
+    static char str[MAX_LENGTH];
+
+    // Every length around the block sizes, with no
+    // newlines, all newlines, and one at each position.
+    for (size_t len = 0; len <= 160; len++) {
+        memset(str, 'a', len);
+        checkString(str, len, len % 32);
+        memset(str, '\n', len);
+        checkString(str, len, len % 32);
+        for (size_t i = 0; i < len; i++) {
+            memset(str, 'a', len);
+            str[i] = '\n';
+            checkString(str, len, i % 32);
+            str[len-1-i] = '\n';
+            checkString(str, len, 0);
+        }
+    }
+
+    for (int i = 0; i < 20000; i++) {
+        size_t len = rand() % MAX_LENGTH;
+        randomString(str, len);
+        checkString(str, len, rand() % 32);
+    }
+
+    return finishTest(seed, "Newline kernels agree");
+}
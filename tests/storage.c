@@ -0,0 +1,539 @@
+// Tests of the text storage engines
+//
+// Usage: test_storage [seed]
+//
+// A gap buffer and a piece table get the same random sequence
+// of insertions, removals, batches of edits, cursor moves,
+// undos and redos, and after each step they're compared with
+// a flat array holding the text they should have.
+//
+// The piece table loads a file large enough that most of its
+// lines are estimated and only counted as they're looked up.
+// Its undo history is kept in so little memory that it's
+// almost all read back from the temporary file.
+
+#include "../src/utils/gap_buffer.h"
+#include "test.h"
+#include "text.h"
+
+#define SAMPLE_FILE "test_storage_sample.txt"
+#define SAMPLE_SIZE (96 << 10) // More than the piece table counts on load
+#define NUM_ROUNDS  6
+#define NUM_STEPS   300
+
+/////////////////////////////////////////////////////////////////
+// Model                                                       //
+/////////////////////////////////////////////////////////////////
+
+static bool isAuxiliaryByte(char byte)
+{
+    return (byte & 0xC0) == 0x80;
+}
+
+// Offset after [num] symbols following [offset]
+static size_t skipForwards(const Text *text, size_t offset, size_t num)
+{
+    while (num > 0 && offset < text->size) {
+        offset++;
+        while (offset < text->size && isAuxiliaryByte(text->data[offset]))
+            offset++;
+        num--;
+    }
+    return offset;
+}
+
+// Offset of the [num]-th symbol preceding [offset]
+static size_t skipBackwards(const Text *text, size_t offset, size_t num)
+{
+    while (num > 0 && offset > 0) {
+        offset--;
+        while (offset > 0 && isAuxiliaryByte(text->data[offset]))
+            offset--;
+        num--;
+    }
+    return offset;
+}
+
+// Start of a random symbol, or the end of the text
+static size_t randomOffset(const Text *text)
+{
+    size_t offset = rand() % (text->size + 1);
+    return skipBackwards(text, skipForwards(text, offset, 1), 1);
+}
+
+// Offsets of the newlines of the model
+static size_t *newlines;
+static size_t  num_newlines;
+
+static void indexLines(const Text *text)
+{
+    newlines = realloc(newlines, (text->size + 1) * sizeof(size_t));
+    num_newlines = 0;
+    for (size_t i = 0; i < text->size; i++)
+        if (text->data[i] == '\n')
+            newlines[num_newlines++] = i;
+}
+
+static size_t getLineOffset(const Text *text, size_t line)
+{
+    if (line == 0)
+        return 0;
+    if (line > num_newlines)
+        return text->size;
+    return newlines[line-1] + 1;
+}
+
+static size_t getLineIndex(size_t offset)
+{
+    // Number of newlines before the offset
+    size_t lo = 0;
+    size_t hi = num_newlines;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (newlines[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Append a random valid UTF-8 string with some newlines
+static size_t randomString(char *dst, size_t max_runes)
+{
+    static const char *runes[] = {"a", "b", "z", " ", "\n", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+
+    size_t len = 0;
+    size_t num = rand() % (max_runes + 1);
+    for (size_t i = 0; i < num; i++) {
+        const char *rune = runes[rand() % (sizeof(runes) / sizeof(runes[0]))];
+        memcpy(dst + len, rune, strlen(rune));
+        len += strlen(rune);
+    }
+    return len;
+}
+
+/////////////////////////////////////////////////////////////////
+// Buffers against the model                                   //
+/////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char *name;
+    GapBuffer  *buff;
+    bool        estimated; // Its line count may be an estimate
+} Engine;
+
+static Engine engines[2];
+
+// States of the text that undo and redo can go back to
+static Text  *states;
+static size_t num_states;
+static size_t current_state;
+
+static Text   model;
+static size_t cursor;
+
+static bool sameText(GapBuffer *buff, const Text *text)
+{
+    static char  *mem = NULL;
+    static size_t cap = 0;
+
+    size_t size = GapBuffer_getByteCount(buff);
+    if (size != text->size)
+        return false;
+    if (cap < size + 1) {
+        cap = 2 * (size + 1);
+        mem = realloc(mem, cap);
+    }
+    GapBuffer_copyDataOut(buff, mem, size + 1);
+    return sameBytes(text, mem, size);
+}
+
+// Save the text as the latest state, dropping those that
+// could be redone like the buffers do
+static void pushState(void)
+{
+    for (size_t i = current_state + 1; i < num_states; i++)
+        free(states[i].data);
+    num_states = ++current_state + 1;
+    states = realloc(states, num_states * sizeof(Text));
+    states[current_state] = copyText(model.data, model.size);
+}
+
+static void checkLines(Engine *engine)
+{
+    GapBuffer *buff = engine->buff;
+    size_t lines = num_newlines + 1;
+
+    // Mostly around the cursor, like views do, so that the
+    // rest of the lines of the piece table stay estimated.
+    for (int i = 0; i < 4; i++) {
+        size_t line = rand() % (lines + 2);
+        size_t offset = rand() % (model.size + 1);
+        if (rand() % 8) {
+            line = getLineIndex(cursor) + rand() % 100;
+            offset = MIN(cursor + rand() % 4096, model.size);
+        }
+
+        size_t found = GapBuffer_getLineOffset(buff, line);
+        CHECK(found == getLineOffset(&model, line),
+              "%s: line %zu is at %zu instead of %zu", engine->name, line, found, getLineOffset(&model, line));
+
+        found = GapBuffer_getLineIndex(buff, offset);
+        CHECK(found == getLineIndex(offset),
+              "%s: offset %zu is in line %zu instead of %zu", engine->name, offset, found, getLineIndex(offset));
+        CHECK(found < GapBuffer_getLineCount(buff),
+              "%s: line %zu is past the line count %zu", engine->name, found, GapBuffer_getLineCount(buff));
+    }
+
+    if (!engine->estimated || rand() % 16 == 0) {
+        // Looking up the last line counts all of them
+        GapBuffer_getLineIndex(buff, model.size);
+        CHECK(GapBuffer_getLineCount(buff) == lines,
+              "%s: %zu lines instead of %zu", engine->name, GapBuffer_getLineCount(buff), lines);
+    }
+}
+
+static void appendLimited(Text *text, size_t cap, const char *str, size_t len)
+{
+    len = MIN(len, cap - text->size);
+    if (len > 0)
+        memcpy(text->data + text->size, str, len);
+    text->size += len;
+}
+
+static void checkIterator(Engine *engine)
+{
+    // One more byte than the text, to tell if lines go past it
+    size_t cap = model.size + 2;
+    Text text = {malloc(cap), 0};
+
+    GapBufferIter iter;
+    GapBufferLine line;
+    GapBufferIter_init(&iter, engine->buff);
+    while (GapBufferIter_next(&iter, &line)) {
+        appendLimited(&text, cap, line.str[0], line.len[0]);
+        appendLimited(&text, cap, line.str[1], line.len[1]);
+        appendLimited(&text, cap, "\n", 1);
+    }
+    GapBufferIter_free(&iter);
+
+    // The last line has no newline, unless it's empty
+    // in which case the iterator skips it.
+    if (model.size > 0 && model.data[model.size-1] != '\n')
+        text.size--;
+    CHECK(sameBytes(&model, text.data, text.size),
+          "%s: iterated lines aren't the text", engine->name);
+    free(text.data);
+}
+
+static void checkEngine(Engine *engine)
+{
+    indexLines(&model);
+    CHECK(sameText(engine->buff, &model), "%s: wrong text", engine->name);
+    CHECK(GapBuffer_rawCursorPosition(engine->buff) == cursor,
+          "%s: cursor at %zu instead of %zu", engine->name, GapBuffer_rawCursorPosition(engine->buff), cursor);
+    checkLines(engine);
+}
+
+static void stepInsert(void)
+{
+    char str[256];
+    size_t len = randomString(str, rand() % 4 ? 4 : 40);
+    for (int k = 0; k < 2; k++)
+        CHECK(GapBuffer_insertString(engines[k].buff, str, len), "%s: insertion failed", engines[k].name);
+    replaceText(&model, cursor, 0, str, len);
+    cursor += len;
+    if (len > 0)
+        pushState();
+}
+
+static void stepRemove(void)
+{
+    // Sometimes where the piece table didn't count the lines
+    if (rand() % 4 == 0) {
+        cursor = randomOffset(&model);
+        for (int k = 0; k < 2; k++)
+            GapBuffer_moveAbsoluteRaw(engines[k].buff, cursor);
+    }
+
+    size_t num = rand() % (rand() % 4 ? 8 : 200);
+    size_t start = cursor;
+    size_t end = cursor;
+    int kind = rand() % 3;
+    for (int k = 0; k < 2; k++) {
+        GapBuffer *buff = engines[k].buff;
+        size_t removed;
+        switch (kind) {
+            case 0:
+            end = skipForwards(&model, cursor, num);
+            removed = GapBuffer_removeForwards(buff, num);
+            break;
+
+            case 1:
+            start = skipBackwards(&model, cursor, num);
+            removed = GapBuffer_removeBackwards(buff, num);
+            break;
+
+            default:
+            end = skipForwards(&model, cursor, num);
+            GapBuffer_removeForwardsRaw(buff, end - cursor);
+            removed = end - start;
+            break;
+        }
+        CHECK(removed == end - start, "%s: removed %zu bytes instead of %zu", engines[k].name, removed, end - start);
+    }
+    replaceText(&model, start, end - start, "", 0);
+    cursor = start;
+    if (end > start)
+        pushState();
+}
+
+static void stepMove(void)
+{
+    int kind = rand() % 3;
+    size_t num = rand() % (rand() % 4 ? 10 : model.size + 1);
+    int off = (int) MIN(num, (size_t) 1000) * (rand() % 2 ? 1 : -1);
+    size_t raw = randomOffset(&model);
+
+    for (int k = 0; k < 2; k++) {
+        GapBuffer *buff = engines[k].buff;
+        switch (kind) {
+            case 0: GapBuffer_moveRelative(buff, off); break;
+            case 1: GapBuffer_moveAbsolute(buff, num); break;
+            case 2: GapBuffer_moveAbsoluteRaw(buff, raw); break;
+        }
+    }
+    switch (kind) {
+        case 0: cursor = off < 0 ? skipBackwards(&model, cursor, -off) : skipForwards(&model, cursor, off); break;
+        case 1: cursor = skipForwards(&model, 0, num); break;
+        case 2: cursor = raw; break;
+    }
+}
+
+static void stepBatch(void)
+{
+    // Sorted edits that don't overlap, at symbol boundaries
+    GapBufferEdit edits[4];
+    char strs[4][256];
+    size_t count = 1 + rand() % 4;
+    // Also far from the cursor, where the piece table
+    // may not have counted the lines yet.
+    size_t offset = 0;
+    if (rand() % 2)
+        offset = randomOffset(&model);
+    for (size_t i = 0; i < count; i++) {
+        offset = skipForwards(&model, offset, rand() % 64);
+        size_t end = skipForwards(&model, offset, rand() % (rand() % 4 ? 4 : 200));
+        edits[i] = (GapBufferEdit) {
+            .offset = offset,
+            .delete_len = end - offset,
+            .insert = strs[i],
+            .insert_len = randomString(strs[i], 6),
+        };
+        offset = end;
+    }
+
+    bool changed = false;
+    size_t shift = 0;
+    for (size_t i = 0; i < count; i++) {
+        replaceText(&model, edits[i].offset + shift, edits[i].delete_len, edits[i].insert, edits[i].insert_len);
+        shift += edits[i].insert_len - edits[i].delete_len;
+        changed = changed || edits[i].delete_len > 0 || edits[i].insert_len > 0;
+    }
+
+    for (int k = 0; k < 2; k++)
+        CHECK(GapBuffer_applyEdits(engines[k].buff, edits, count), "%s: edits failed", engines[k].name);
+    GapBuffer_mapOffsets(edits, count, &cursor, 1);
+    if (changed)
+        pushState();
+}
+
+static void stepUndo(bool redo)
+{
+    bool replayed[2];
+    for (int k = 0; k < 2; k++) {
+        GapBuffer *buff = engines[k].buff;
+        replayed[k] = redo ? GapBuffer_redo(buff, NULL, NULL) : GapBuffer_undo(buff, NULL, NULL);
+    }
+    CHECK(replayed[0] == replayed[1], "The engines disagree on whether there's something to %s", redo ? "redo" : "undo");
+
+    if (!replayed[0]) {
+        CHECK(current_state == (redo ? num_states - 1 : 0), "Nothing to %s at state %zu of %zu",
+              redo ? "redo" : "undo", current_state, num_states);
+        return;
+    }
+
+    // Runs of typing or deleting are undone together,
+    // so some states may be skipped.
+    size_t i = current_state;
+    bool found = false;
+    while (!found && (redo ? i+1 < num_states : i > 0)) {
+        i = redo ? i+1 : i-1;
+        found = sameText(engines[0].buff, &states[i]);
+    }
+    CHECK(found, "%s didn't go back to a previous state", redo ? "Redo" : "Undo");
+    if (!found)
+        return;
+
+    current_state = i;
+    free(model.data);
+    model = copyText(states[i].data, states[i].size);
+    cursor = GapBuffer_rawCursorPosition(engines[0].buff);
+    CHECK(cursor <= model.size && (cursor == model.size || !isAuxiliaryByte(model.data[cursor])),
+          "The cursor isn't at a symbol after an undo");
+}
+
+static void writeSample(const Text *text)
+{
+    FILE *stream = fopen(SAMPLE_FILE, "wb");
+    if (stream == NULL || fwrite(text->data, 1, text->size, stream) != text->size) {
+        fprintf(stderr, "Couldn't write " SAMPLE_FILE "\n");
+        exit(1);
+    }
+    fclose(stream);
+}
+
+// Load the text of the model in new buffers
+static void loadEngines(void)
+{
+    writeSample(&model);
+
+    engines[0] = (Engine) {"gap buffer",  GapBuffer_create(0), false};
+    engines[1] = (Engine) {"piece table", GapBuffer_createPieceTable(), true};
+    for (int k = 0; k < 2; k++) {
+        if (engines[k].buff == NULL || !GapBuffer_insertFile(engines[k].buff, SAMPLE_FILE)) {
+            fprintf(stderr, "%s: couldn't load " SAMPLE_FILE "\n", engines[k].name);
+            exit(1);
+        }
+        GapBuffer_moveAbsoluteRaw(engines[k].buff, 0);
+    }
+    remove(SAMPLE_FILE);
+
+    // History of the piece table is spilled to the file
+    GapBuffer_enableUndo(engines[0].buff, 1 << 20);
+    GapBuffer_enableUndo(engines[1].buff, 256);
+
+    cursor = 0;
+    current_state = (size_t) -1;
+    pushState();
+    indexLines(&model);
+}
+
+static void testEngines(void)
+{
+    model.size = 0;
+    model.data = malloc(SAMPLE_SIZE + 8);
+    while (model.size < SAMPLE_SIZE)
+        model.size += randomString(model.data + model.size, 1);
+
+    // The lines of the piece table are only estimated
+    // until they're counted, so it's loaded again from
+    // time to time.
+    for (int round = 0; round < NUM_ROUNDS && failures == 0; round++) {
+        loadEngines();
+
+        for (int step = 0; step < NUM_STEPS && failures == 0; step++) {
+            size_t old_lines = num_newlines;
+            size_t old_counts[2];
+            for (int k = 0; k < 2; k++)
+                old_counts[k] = GapBuffer_getLineCount(engines[k].buff);
+
+            int kind = rand() % 10;
+            switch (kind) {
+                case 0: case 1: stepInsert(); break;
+                case 2: case 3: stepRemove(); break;
+                case 4: case 5: stepMove(); break;
+                case 6: stepBatch(); break;
+                case 7: stepUndo(false); break;
+                case 8: stepUndo(true); break;
+                case 9:
+                for (int k = 0; k < 2; k++)
+                    checkIterator(&engines[k]);
+                break;
+            }
+
+            // Even estimated counts change by the lines
+            // that were added or removed.
+            indexLines(&model);
+            for (int k = 0; k < 2 && kind < 7; k++)
+                CHECK(GapBuffer_getLineCount(engines[k].buff) - old_counts[k] == num_newlines - old_lines,
+                      "%s: the line count changed by %zd instead of %zd", engines[k].name,
+                      (ssize_t) (GapBuffer_getLineCount(engines[k].buff) - old_counts[k]), (ssize_t) (num_newlines - old_lines));
+
+            for (int k = 0; k < 2; k++)
+                checkEngine(&engines[k]);
+        }
+
+        // Back to the loaded file and forwards again
+        while (failures == 0 && current_state > 0)
+            stepUndo(false);
+        CHECK(sameText(engines[1].buff, &states[0]), "Undoing everything doesn't give back the file");
+        while (failures == 0 && current_state + 1 < num_states)
+            stepUndo(true);
+        for (int k = 0; k < 2; k++)
+            checkEngine(&engines[k]);
+
+        for (int k = 0; k < 2; k++)
+            GapBuffer_destroy(engines[k].buff);
+    }
+
+    for (size_t i = 0; i < num_states; i++)
+        free(states[i].data);
+    free(states);
+    free(model.data);
+    free(newlines);
+}
+// Files inserted in buffers that aren't empty are read in
+// blocks, and symbols cut between blocks must be accepted.
+static void testInsertFile(void)
+{
+    static const char emoji[] = "\xf0\x9f\x98\x80";
+
+    Text text = {malloc(SAMPLE_SIZE + 8), 0};
+    for (size_t shift = 0; shift < 4; shift++) {
+        text.size = shift;
+        memset(text.data, 'a', shift);
+        while (text.size < SAMPLE_SIZE) {
+            memcpy(text.data + text.size, emoji, 4);
+            text.size += 4;
+        }
+
+        for (int corrupt = 0; corrupt < 2; corrupt++) {
+            if (corrupt)
+                text.data[text.size / 2] = (char) 0xFF;
+            writeSample(&text);
+
+            Engine engines[] = {
+                {"gap buffer",  GapBuffer_create(0), false},
+                {"piece table", GapBuffer_createPieceTable(), true},
+            };
+            for (int k = 0; k < 2; k++) {
+                GapBuffer *buff = engines[k].buff;
+                GapBuffer_insertString(buff, "x\n", 2);
+
+                Text expected = copyText("x\n", 2);
+                if (!corrupt)
+                    replaceText(&expected, 2, 0, text.data, text.size);
+
+                bool inserted = GapBuffer_insertFile(buff, SAMPLE_FILE);
+                CHECK(inserted != corrupt, "%s: inserting a file %s", engines[k].name,
+                      corrupt ? "that isn't UTF-8 succeeded" : "failed");
+                CHECK(sameText(buff, &expected), "%s: wrong text after inserting a file", engines[k].name);
+
+                free(expected.data);
+                GapBuffer_destroy(buff);
+            }
+        }
+    }
+    remove(SAMPLE_FILE);
+    free(text.data);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = startTest(argc, argv);
+    testInsertFile();
+    testEngines();
+    return finishTest(seed, "Storage engines agree with the model");
+}
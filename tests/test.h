@@ -0,0 +1,50 @@
+// Scaffolding shared by the tests
+//
+// Each test is a program that takes the seed of its random
+// inputs as its only argument, counts the checks that fail
+// and exits with 1 if any did.
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef MIN
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+#endif
+
+static size_t failures = 0;
+
+#define CHECK(cond, ...)                                       \
+    do {                                                       \
+        if (!(cond)) {                                         \
+            fprintf(stderr, __VA_ARGS__);                      \
+            fprintf(stderr, " (%s:%d)\n", __FILE__, __LINE__); \
+            failures++;                                        \
+        }                                                      \
+    } while (0)
+
+// Seed the random inputs with the first argument, or 1
+static unsigned int startTest(int argc, char **argv)
+{
+    unsigned int seed = 1;
+    if (argc > 1)
+        seed = atoi(argv[1]);
+    srand(seed);
+    return seed;
+}
+
+// Print [summary] if no check failed and
+// return the exit status of the test.
+static int finishTest(unsigned int seed, const char *summary)
+{
+    if (failures > 0) {
+        fprintf(stderr, "%zu failures (seed %u)\n", failures, seed);
+        return 1;
+    }
+    printf("%s\n", summary);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,38 @@
+// Flat copies of text, which the tests of the storage
+// engines and of the journal use as the reference.
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char  *data;
+    size_t size;
+} Text;
+
+static Text copyText(const char *data, size_t size)
+{
+    Text text = {malloc(size + 1), size};
+    memcpy(text.data, data, size);
+    return text;
+}
+
+static bool sameBytes(const Text *text, const char *data, size_t size)
+{
+    return text->size == size && !memcmp(text->data, data, size);
+}
+
+static void replaceText(Text *text, size_t offset, size_t removed, const char *str, size_t len)
+{
+    if (len > removed)
+        text->data = realloc(text->data, text->size - removed + len + 1);
+    memmove(text->data + offset + len, text->data + offset + removed, text->size - offset - removed);
+    if (len > 0)
+        memcpy(text->data + offset, str, len);
+    text->size = text->size - removed + len;
+}
+
+#endif
@@ -0,0 +1,157 @@
+// Tests of the UTF-8 kernels
+//
+// Usage: test_utf8 [seed]
+//
+// The vectorized kernels the CPU supports are compared with
+// the scalar ones. Strings mix symbols of every length and
+// place them across the boundaries of the blocks the kernels
+// process. Some are corrupted with the errors a validator
+// must catch: truncated symbols, stray auxiliary bytes,
+// overlong forms, surrogates and values past U+10FFFF.
+// Counting and skipping symbols are only checked on valid
+// strings, since they assume them.
+
+#include "../src/utils/utf8.c"
+#include "kernels.h"
+
+#define MAX_LENGTH 600
+
+static void checkDecode(KernelSet *set, const char *str, size_t len, size_t max)
+{
+    static uint32_t expected[MAX_LENGTH + 4];
+    static uint32_t actual[MAX_LENGTH + 4];
+    size_t expected_consumed;
+    size_t actual_consumed;
+    size_t expected_num = decodeScalar(str, len, expected, max, &expected_consumed);
+    size_t actual_num = set->kernels.decode(str, len, actual, max, &actual_consumed);
+    if (actual_num != expected_num || actual_consumed != expected_consumed
+        || memcmp(actual, expected, expected_num * sizeof(uint32_t)))
+        fail(set->name, "decode", str, len);
+}
+
+static void checkString(const char *src, size_t len, size_t shift)
+{
+    char *str = placeString(src, len, shift);
+
+    bool valid = isValidScalar(str, len);
+    size_t ascii = skipASCIIScalar(str, len);
+    size_t count = countRunesScalar(str, len);
+
+    for (size_t k = 1; k < num_sets; k++) {
+        KernelSet *set = &sets[k];
+
+        if (set->kernels.isValid(str, len) != valid)
+            fail(set->name, "isValid", str, len);
+
+        if (set->kernels.skipASCII(str, len) != ascii)
+            fail(set->name, "skipASCII", str, len);
+
+        size_t maxes[] = {0, 1, 7, 16, 31, 32, 33, 64, count / 2, count, MAX_LENGTH + 4};
+        for (size_t i = 0; i < sizeof(maxes) / sizeof(maxes[0]); i++)
+            checkDecode(set, str, len, maxes[i]);
+
+        if (!valid)
+            continue;
+
+        if (set->kernels.countRunes(str, len) != count)
+            fail(set->name, "countRunes", str, len);
+
+        for (size_t num = 0; num <= count + 1; num++)
+            if (set->kernels.skipRunes(str, len, num) != skipRunesScalar(str, len, num)) {
+                fail(set->name, "skipRunes", str, len);
+                break;
+            }
+    }
+    freeString(str, shift);
+}
+
+// Append a random valid symbol of [bytes] bytes, or
+// of a random length if [bytes] is 0.
+static size_t appendRune(char *dst, int bytes)
+{
+    static const uint32_t lo[] = {0, 0x00, 0x80, 0x800, 0x10000};
+    static const uint32_t hi[] = {0, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
+
+    if (bytes == 0)
+        bytes = 1 + rand() % 4;
+
+    uint32_t rune;
+    do
+        rune = lo[bytes] + rand() % (hi[bytes] - lo[bytes] + 1);
+    while (rune >= 0xD800 && rune <= 0xDFFF);
+    return UTF8_encodeRune(dst, rune);
+}
+
+// Overwrite the bytes at [i] with an error a validator must catch
+static void insertError(char *dst, size_t i, size_t len)
+{
+    static const char *errors[] = {
+        "\x80",             // Stray auxiliary byte
+        "\xC2",             // Truncated
+        "\xE2\x82",         // Truncated
+        "\xF0\x9F\x98",     // Truncated
+        "\xC0\x80",         // Overlong
+        "\xE0\x80\x80",     // Overlong
+        "\xF0\x80\x80\x80", // Overlong
+        "\xED\xA0\x80",     // Surrogate
+        "\xF4\x90\x80\x80", // Past U+10FFFF
+        "\xF8\x88\x80\x80", // Not a leading byte
+        "\xFF",
+    };
+    const char *error = errors[rand() % (sizeof(errors) / sizeof(errors[0]))];
+    size_t n = strlen(error);
+    if (i + n <= len)
+        memcpy(dst + i, error, n);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = startTest(argc, argv);
+
+    addKernelSet("scalar", (Kernels) {isValidScalar, skipASCIIScalar, countRunesScalar, skipRunesScalar, decodeScalar});
+#ifdef SIMD_X86
+    if (cpuHasSSE2())
+        addKernelSet("sse2", (Kernels) {isValidSSE2, skipASCIISSE2, countRunesSSE2, skipRunesSSE2, decodeSSE2});
+    if (cpuHasAVX2())
+        addKernelSet("avx2", (Kernels) {isValidAVX2, skipASCIIAVX2, countRunesAVX2, skipRunesAVX2, decodeAVX2});
+#endif
+    listKernelSets("UTF-8");
+
+    static char str[MAX_LENGTH + 4];
+
+    // A symbol of each length after every number of ASCII
+    // bytes around the block sizes, so that it straddles
+    // each boundary. The same strings are cut short to
+    // truncate the symbol at the end.
+    for (size_t prefix = 0; prefix <= 130; prefix++)
+        for (int bytes = 1; bytes <= 4; bytes++) {
+            memset(str, 'a', prefix);
+            size_t len = prefix + appendRune(str + prefix, bytes);
+            for (size_t cut = 0; cut < (size_t) bytes; cut++)
+                checkString(str, len - cut, prefix % 32);
+            memset(str + len, 'b', 40);
+            checkString(str, len + 40, 0);
+        }
+
+    for (int i = 0; i < 20000; i++) {
+        size_t max = rand() % MAX_LENGTH;
+        size_t len = 0;
+        bool ascii_runs = rand() % 2;
+        while (len < max) {
+            if (ascii_runs && rand() % 4 == 0) {
+                size_t run = rand() % 40;
+                run = MIN(run, max - len);
+                memset(str + len, 'a' + rand() % 26, run);
+                len += run;
+            } else
+                len += appendRune(str + len, 0);
+        }
+        if (rand() % 2)
+            insertError(str, rand() % (len + 1), len);
+        if (rand() % 8 == 0)
+            len -= rand() % MIN(len + 1, (size_t) 4); // Maybe truncate
+        checkString(str, len, rand() % 32);
+    }
+
+    return finishTest(seed, "UTF-8 kernels agree");
+}